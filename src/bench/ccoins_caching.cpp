@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -85,4 +86,58 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+static std::vector<COutPoint> RandomOutpoints(size_t count)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        outpoints.emplace_back(rng.rand256(), rng.randrange(4));
+    }
+    return outpoints;
+}
+
+// Fill a cache with coins, look all of them up and flush it, like the coins
+// tip between two flushes. This mostly measures the allocation of the cache
+// entries.
+static void CCoinsCacheFill(benchmark::State& state)
+{
+    const std::vector<COutPoint> outpoints = RandomOutpoints(10000);
+    const Coin coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false);
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    coins.ReserveCache(outpoints.size() * 128);
+    while (state.KeepRunning()) {
+        for (const COutPoint& outpoint : outpoints) {
+            coins.AddCoin(outpoint, Coin(coin), false);
+        }
+        for (const COutPoint& outpoint : outpoints) {
+            assert(!coins.AccessCoin(outpoint).IsSpent());
+        }
+        coins.Flush();
+    }
+}
+
+// Look up coins in a large cache in random order, which mostly measures the
+// cache misses of finding the entries.
+static void CCoinsCacheAccess(benchmark::State& state)
+{
+    const std::vector<COutPoint> outpoints = RandomOutpoints(200000);
+    const Coin coin(CTxOut(COIN, CScript() << OP_TRUE), 1, false);
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    coins.ReserveCache(outpoints.size() * 128);
+    for (const COutPoint& outpoint : outpoints) {
+        coins.AddCoin(outpoint, Coin(coin), false);
+    }
+    FastRandomContext rng(true);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; ++i) {
+            assert(!coins.AccessCoin(outpoints[rng.randrange(outpoints.size())]).IsSpent());
+        }
+    }
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
+BENCHMARK(CCoinsCacheFill, 50);
+BENCHMARK(CCoinsCacheAccess, 5000);
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <hash.h>
 #include <util/system.h>
 #include <validation.h>
 #include <checkqueue.h>
@@ -17,6 +18,7 @@ static const size_t BATCHES = 101;
 static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
 static const unsigned int QUEUE_BATCH_SIZE = 128;
+static const int HASH_JOB_ROUNDS = 4;
 
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
@@ -60,3 +62,64 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.join_all();
 }
 BENCHMARK(CCheckQueueSpeedPrevectorJob, 1400);
+
+// This Benchmark compares how CCheckQueue and CWorkStealingCheckQueue scale
+// with the number of threads (including the master), on checks that each do
+// a few microseconds of hashing. Compare the runs with the same workload
+// across thread counts to get the scaling curve of each queue.
+struct HashJob {
+    uint256 hash;
+    HashJob() {}
+    explicit HashJob(FastRandomContext& insecure_rand) : hash(insecure_rand.rand256()) {}
+    bool operator()()
+    {
+        for (int i = 0; i < HASH_JOB_ROUNDS; ++i) {
+            hash = Hash(hash.begin(), hash.end());
+        }
+        return true;
+    }
+    void swap(HashJob& x) { std::swap(hash, x.hash); }
+};
+
+template <template <typename> class Queue>
+static void CheckQueueScaling(benchmark::State& state, int threads)
+{
+    Queue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < threads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        FastRandomContext insecure_rand(true);
+        CCheckQueueControl<HashJob, Queue<HashJob>> control(&queue);
+        std::vector<std::vector<HashJob>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.reserve(BATCH_SIZE);
+            for (size_t x = 0; x < BATCH_SIZE; ++x)
+                vChecks.emplace_back(insecure_rand);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+#define CHECKQUEUE_SCALING_BENCHMARKS(threads)                                                             \
+    static void CCheckQueueScaling##threads(benchmark::State& state)                                       \
+    {                                                                                                      \
+        CheckQueueScaling<CCheckQueue>(state, threads);                                                    \
+    }                                                                                                      \
+    static void CWorkStealingCheckQueueScaling##threads(benchmark::State& state)                           \
+    {                                                                                                      \
+        CheckQueueScaling<CWorkStealingCheckQueue>(state, threads);                                        \
+    }                                                                                                      \
+    BENCHMARK(CCheckQueueScaling##threads, 400);                                                           \
+    BENCHMARK(CWorkStealingCheckQueueScaling##threads, 400);
+
+CHECKQUEUE_SCALING_BENCHMARKS(1)
+CHECKQUEUE_SCALING_BENCHMARKS(2)
+CHECKQUEUE_SCALING_BENCHMARKS(4)
+CHECKQUEUE_SCALING_BENCHMARKS(8)
+CHECKQUEUE_SCALING_BENCHMARKS(16)
+CHECKQUEUE_SCALING_BENCHMARKS(32)
@@ -0,0 +1,119 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <consensus/validation.h>
+#include <key.h>
+#include <script/interpreter.h>
+#include <script/sigcache.h>
+#include <test/util.h>
+#include <txmempool.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <thread>
+#include <vector>
+
+//! Transactions accepted in each iteration, split evenly across the threads
+static constexpr size_t MEMPOOL_ACCEPT_BATCH{96};
+//! Inputs of each transaction, each with a signature to verify
+static constexpr size_t MEMPOOL_ACCEPT_TX_INPUTS{4};
+
+static void SignInputs(CMutableTransaction& tx, const CKey& key, const CScript& script_pub)
+{
+    for (size_t n = 0; n < tx.vin.size(); ++n) {
+        std::vector<unsigned char> sig;
+        const uint256 hash = SignatureHash(script_pub, tx, n, SIGHASH_ALL, 0, SigVersion::BASE);
+        bool ret{key.Sign(hash, sig)};
+        assert(ret);
+        sig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[n].scriptSig = CScript() << sig;
+    }
+}
+
+/**
+ * Accept MEMPOOL_ACCEPT_BATCH independent transactions to the mempool from
+ * num_threads threads at once, none of which holds cs_main, then empty the
+ * mempool again. Transactions accepted per second are MEMPOOL_ACCEPT_BATCH
+ * divided by the time per iteration.
+ *
+ * The signature and script execution caches are shrunk to their minimum, so
+ * that every iteration verifies every signature as for transactions seen for
+ * the first time. Without cache hits this includes the second verification
+ * with the next block's script flags.
+ */
+static void MempoolAccept(benchmark::State& state, int num_threads)
+{
+    gArgs.ForceSetArg("-maxsigcachesize", "0");
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript SCRIPT_PUB{CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG};
+
+    const CTxIn coinbase_in{MineBlock(SCRIPT_PUB)};
+    for (int i = 0; i < COINBASE_MATURITY; ++i) {
+        MineBlock(SCRIPT_PUB);
+    }
+
+    // Split the coinbase into the outputs spent by the batch and confirm it.
+    CMutableTransaction funding;
+    funding.vin.push_back(coinbase_in);
+    const size_t num_outputs{MEMPOOL_ACCEPT_BATCH * MEMPOOL_ACCEPT_TX_INPUTS};
+    const CAmount output_value{(50 * COIN - COIN / 1000) / (CAmount)num_outputs};
+    for (size_t o = 0; o < num_outputs; ++o) {
+        funding.vout.emplace_back(output_value, SCRIPT_PUB);
+    }
+    SignInputs(funding, key, SCRIPT_PUB);
+    {
+        CValidationState validation_state;
+        bool ret{::AcceptToMemoryPool(::mempool, validation_state, MakeTransactionRef(funding), nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+        assert(ret);
+    }
+    MineBlock(SCRIPT_PUB);
+
+    std::vector<CTransactionRef> txs;
+    for (size_t i = 0; i < MEMPOOL_ACCEPT_BATCH; ++i) {
+        CMutableTransaction tx;
+        for (size_t n = 0; n < MEMPOOL_ACCEPT_TX_INPUTS; ++n) {
+            tx.vin.emplace_back(funding.GetHash(), i * MEMPOOL_ACCEPT_TX_INPUTS + n);
+        }
+        tx.vout.emplace_back(output_value * (CAmount)MEMPOOL_ACCEPT_TX_INPUTS - COIN / 10000, SCRIPT_PUB);
+        SignInputs(tx, key, SCRIPT_PUB);
+        txs.push_back(MakeTransactionRef(tx));
+    }
+
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&txs, num_threads, t] {
+                for (size_t i = t; i < txs.size(); i += num_threads) {
+                    CValidationState validation_state;
+                    bool ret{::AcceptToMemoryPool(::mempool, validation_state, txs[i], nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+                    assert(ret);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        assert(::mempool.size() == txs.size());
+        ::mempool.clear();
+    }
+
+    gArgs.ForceSetArg("-maxsigcachesize", std::to_string(DEFAULT_MAX_SIG_CACHE_SIZE));
+    InitSignatureCache();
+    InitScriptExecutionCache();
+}
+
+static void MempoolAcceptThreads1(benchmark::State& state) { MempoolAccept(state, 1); }
+static void MempoolAcceptThreads2(benchmark::State& state) { MempoolAccept(state, 2); }
+static void MempoolAcceptThreads4(benchmark::State& state) { MempoolAccept(state, 4); }
+static void MempoolAcceptThreads8(benchmark::State& state) { MempoolAccept(state, 8); }
+
+BENCHMARK(MempoolAcceptThreads1, 15);
+BENCHMARK(MempoolAcceptThreads2, 15);
+BENCHMARK(MempoolAcceptThreads4, 15);
+BENCHMARK(MempoolAcceptThreads8, 15);
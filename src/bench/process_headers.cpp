@@ -0,0 +1,55 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <pow.h>
+#include <random.h>
+#include <validation.h>
+
+#include <vector>
+
+/**
+ * Measure accepting full headers messages of new headers, each extending the
+ * chain of headers accepted before it. The headers are mined before the
+ * measurement, so that every iteration adds MAX_HEADERS_RESULTS entries to
+ * the block index.
+ */
+static void ProcessHeaders(benchmark::State& state)
+{
+    const CChainParams& chainparams = Params();
+    FastRandomContext rng(true);
+
+    std::vector<std::vector<CBlockHeader>> runs(state.m_num_iters * state.m_num_evals);
+    uint256 prev_hash = chainparams.GenesisBlock().GetHash();
+    uint32_t time = chainparams.GenesisBlock().nTime;
+    for (std::vector<CBlockHeader>& run : runs) {
+        run.resize(MAX_HEADERS_RESULTS);
+        for (CBlockHeader& header : run) {
+            header.nVersion = 4;
+            header.hashPrevBlock = prev_hash;
+            header.hashMerkleRoot = rng.rand256();
+            header.nTime = ++time;
+            header.nBits = chainparams.GenesisBlock().nBits;
+            while (!CheckProofOfWork(header.GetHash(), header.nBits, chainparams.GetConsensus())) {
+                ++header.nNonce;
+            }
+            prev_hash = header.GetHash();
+        }
+    }
+
+    // Checking the whole block index after every header would dominate the measurement.
+    const bool check_block_index = fCheckBlockIndex;
+    fCheckBlockIndex = false;
+    auto run = runs.begin();
+    while (state.KeepRunning()) {
+        CValidationState validation_state;
+        bool ret{ProcessNewBlockHeaders(*run++, validation_state, chainparams)};
+        assert(ret);
+    }
+    fCheckBlockIndex = check_block_index;
+}
+
+BENCHMARK(ProcessHeaders, 20);
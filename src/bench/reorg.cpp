@@ -0,0 +1,89 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <consensus/validation.h>
+#include <crypto/sha256.h>
+#include <test/util.h>
+#include <txmempool.h>
+#include <validation.h>
+
+#include <vector>
+
+//! Number of outputs of the transaction in each block of the reorged chain
+static constexpr size_t REORG_TX_OUTPUTS{50};
+
+/**
+ * Build a regtest chain ending in reorg_depth blocks that each hold a
+ * transaction spending all outputs of the one in the block before it, so that
+ * disconnecting a block spends and restores REORG_TX_OUTPUTS coins. Then
+ * measure reorganizing away from those blocks and back to them.
+ */
+static void Reorg(benchmark::State& state, int reorg_depth)
+{
+    const std::vector<unsigned char> op_true{OP_TRUE};
+    CScriptWitness witness;
+    witness.stack.push_back(op_true);
+
+    uint256 witness_program;
+    CSHA256().Write(&op_true[0], op_true.size()).Finalize(witness_program.begin());
+
+    const CScript SCRIPT_PUB{CScript(OP_0) << std::vector<unsigned char>{witness_program.begin(), witness_program.end()}};
+
+    const CTxIn coinbase_in{MineBlock(SCRIPT_PUB)};
+    for (int i = 0; i < COINBASE_MATURITY; ++i) {
+        MineBlock(SCRIPT_PUB);
+    }
+
+    std::vector<CTxIn> inputs{coinbase_in};
+    CAmount value{50 * COIN};
+    for (int i = 0; i < reorg_depth; ++i) {
+        CMutableTransaction tx;
+        tx.vin = inputs;
+        for (CTxIn& in : tx.vin) {
+            in.scriptWitness = witness;
+        }
+        value = (value - COIN / 1000) / REORG_TX_OUTPUTS * REORG_TX_OUTPUTS;
+        for (size_t o = 0; o < REORG_TX_OUTPUTS; ++o) {
+            tx.vout.emplace_back(value / REORG_TX_OUTPUTS, SCRIPT_PUB);
+        }
+        const CTransactionRef txr{MakeTransactionRef(tx)};
+        {
+            LOCK(::cs_main); // Required for ::AcceptToMemoryPool.
+            CValidationState validation_state;
+            bool ret{::AcceptToMemoryPool(::mempool, validation_state, txr, nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */, false /* bypass_limits */, /* nAbsurdFee */ 0)};
+            assert(ret);
+        }
+        MineBlock(SCRIPT_PUB);
+        inputs.clear();
+        for (size_t o = 0; o < REORG_TX_OUTPUTS; ++o) {
+            inputs.emplace_back(txr->GetHash(), o);
+        }
+    }
+
+    CBlockIndex* tip = WITH_LOCK(::cs_main, return ::ChainActive().Tip());
+    CBlockIndex* fork_child = WITH_LOCK(::cs_main, return ::ChainActive()[tip->nHeight - reorg_depth + 1]);
+
+    while (state.KeepRunning()) {
+        CValidationState validation_state;
+        bool ret{InvalidateBlock(validation_state, Params(), fork_child)};
+        assert(ret);
+        {
+            LOCK(::cs_main);
+            ResetBlockFailureFlags(fork_child);
+        }
+        ret = ActivateBestChain(validation_state, Params());
+        assert(ret);
+        assert(WITH_LOCK(::cs_main, return ::ChainActive().Tip()) == tip);
+    }
+}
+
+static void ReorgDepth1(benchmark::State& state) { Reorg(state, 1); }
+static void ReorgDepth10(benchmark::State& state) { Reorg(state, 10); }
+static void ReorgDepth100(benchmark::State& state) { Reorg(state, 100); }
+
+BENCHMARK(ReorgDepth1, 1800);
+BENCHMARK(ReorgDepth10, 60);
+BENCHMARK(ReorgDepth100, 8);
@@ -129,6 +129,13 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    /**
+     * The block is at or below the base of a loaded UTXO snapshot. It was never
+     * downloaded nor validated, and its nTx is a placeholder (see
+     * LoadUTXOSnapshot), but it is part of the chain the snapshot commits to.
+     */
+    BLOCK_ASSUMED_VALID      =  256,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -316,6 +323,12 @@ public:
         return ((nStatus & BLOCK_VALID_MASK) >= nUpTo);
     }
 
+    //! Check whether this block is assumed valid, below a loaded UTXO snapshot.
+    bool IsAssumedValid() const
+    {
+        return nStatus & BLOCK_ASSUMED_VALID;
+    }
+
     //! Raise the validity level of this block index entry.
     //! Returns true if the validity was changed.
     bool RaiseValidity(enum BlockStatus nUpTo)
@@ -8,13 +8,16 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 
-template <typename T>
-class CCheckQueueControl;
+//! Number of deques of a CWorkStealingCheckQueue; threads beyond that share them
+static const unsigned int WORK_STEALING_QUEUES = 64;
 
 /**
  * Queue for verifications that have to be performed.
@@ -164,21 +167,207 @@ public:
 };
 
 /**
- * RAII-style controller object for a CCheckQueue that guarantees the passed
- * queue is finished before continuing.
+ * Queue for verifications with the same interface as CCheckQueue, in which
+ * every thread has its own deque of checks instead of all threads sharing a
+ * single queue behind one mutex.
+ *
+ * Add spreads new checks over the deques of the master and the workers. A
+ * thread takes batches from the back of its own deque and, once that runs
+ * dry, steals from the front of the others. The shared mutex is only taken
+ * to sleep when there is no work and to report that the last check is done,
+ * so it does not become a bottleneck as threads are added. Batches shrink as
+ * the work left runs out, so that all threads finish at about the same time.
  */
 template <typename T>
+class CWorkStealingCheckQueue
+{
+private:
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! The deques of checks; the master uses the first one
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    //! Mutex for idle threads to sleep on
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
+
+    //! The number of worker threads (not including the master).
+    std::atomic<unsigned int> nWorkers;
+
+    //! The number of checks waiting in the deques.
+    std::atomic<unsigned int> nQueued;
+
+    /**
+     * Number of verifications that haven't completed yet.
+     * This includes elements that are no longer queued, but still in the
+     * worker's own batches.
+     */
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! The deque the next batch of added checks goes to first
+    unsigned int nNextQueue;
+
+    //! The maximum number of elements to be processed in one batch
+    const unsigned int nBatchSize;
+
+    //! The number of deques in use by the master and the current workers
+    size_t ActiveQueues() const
+    {
+        return std::min<size_t>(queues.size(), nWorkers + 1);
+    }
+
+    /**
+     * Move a batch of checks to vChecks, from the back of the deque at home,
+     * or else from the front of another deque. Returns false if all deques
+     * were found empty.
+     */
+    bool Take(size_t home, std::vector<T>& vChecks)
+    {
+        const size_t nQueues = ActiveQueues();
+        for (size_t i = 0; i < nQueues; i++) {
+            WorkerQueue& victim = *queues[(home + i) % nQueues];
+            boost::unique_lock<boost::mutex> lock(victim.mutex);
+            if (victim.checks.empty()) continue;
+            // Decide how many work units to process now, as CCheckQueue does,
+            // but based on the checks queued in all deques. When stealing,
+            // leave the owner at least half of its deque.
+            size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, nQueued / (nQueues + 1)));
+            nNow = std::min(nNow, i == 0 ? victim.checks.size() : (victim.checks.size() + 1) / 2);
+            for (size_t j = 0; j < nNow; j++) {
+                vChecks.emplace_back();
+                if (i == 0) {
+                    vChecks.back().swap(victim.checks.back());
+                    victim.checks.pop_back();
+                } else {
+                    vChecks.back().swap(victim.checks.front());
+                    victim.checks.pop_front();
+                }
+            }
+            nQueued -= nNow;
+            return true;
+        }
+        return false;
+    }
+
+    /** Internal function that does bulk of the verification work. */
+    bool Loop(size_t home, bool fMaster = false)
+    {
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        do {
+            if (!Take(home, vChecks)) {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fMaster) {
+                    while (nTodo != 0 && nQueued == 0) {
+                        condMaster.wait(lock);
+                    }
+                    if (nTodo == 0) {
+                        // return the current status, and reset it for new work later
+                        return fAllOk.exchange(true);
+                    }
+                } else {
+                    while (nQueued == 0) {
+                        condWorker.wait(lock);
+                    }
+                }
+                continue;
+            }
+            // execute work
+            bool fOk = fAllOk;
+            for (T& check : vChecks)
+                if (fOk)
+                    fOk = check();
+            const unsigned int nNow = vChecks.size();
+            vChecks.clear();
+            if (!fOk) fAllOk = false;
+            if (nTodo.fetch_sub(nNow) == nNow) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
+        } while (true);
+    }
+
+public:
+    //! Mutex to ensure only one concurrent CCheckQueueControl
+    boost::mutex ControlMutex;
+
+    //! Create a new check queue
+    explicit CWorkStealingCheckQueue(unsigned int nBatchSizeIn) : nWorkers(0), nQueued(0), nTodo(0), fAllOk(true), nNextQueue(0), nBatchSize(nBatchSizeIn)
+    {
+        for (unsigned int i = 0; i < WORK_STEALING_QUEUES; i++) {
+            queues.emplace_back(new WorkerQueue());
+        }
+    }
+
+    //! Worker thread
+    void Thread()
+    {
+        Loop(1 + nWorkers++ % (queues.size() - 1));
+    }
+
+    //! Wait until execution finishes, and return whether all evaluations were successful.
+    bool Wait()
+    {
+        return Loop(0, true);
+    }
+
+    //! Add a batch of checks to the queue
+    void Add(std::vector<T>& vChecks)
+    {
+        if (vChecks.empty()) return;
+        nTodo += vChecks.size();
+        // Spread the checks over the deques in contiguous chunks.
+        const size_t nQueues = ActiveQueues();
+        const size_t nChunk = (vChecks.size() + nQueues - 1) / nQueues;
+        for (size_t nBegin = 0; nBegin < vChecks.size(); nBegin += nChunk) {
+            const size_t nEnd = std::min(nBegin + nChunk, vChecks.size());
+            WorkerQueue& queue = *queues[nNextQueue++ % nQueues];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (size_t i = nBegin; i < nEnd; i++) {
+                queue.checks.emplace_back();
+                queue.checks.back().swap(vChecks[i]);
+            }
+            nQueued += nEnd - nBegin;
+        }
+        {
+            // Make sure a worker about to sleep sees the new checks or gets notified.
+            boost::unique_lock<boost::mutex> lock(mutex);
+        }
+        if (vChecks.size() == 1)
+            condWorker.notify_one();
+        else
+            condWorker.notify_all();
+    }
+};
+
+/**
+ * RAII-style controller object for a CCheckQueue (or a queue with the same
+ * interface) that guarantees the passed queue is finished before continuing.
+ */
+template <typename T, typename Q = CCheckQueue<T>>
 class CCheckQueueControl
 {
 private:
-    CCheckQueue<T> * const pqueue;
+    Q * const pqueue;
     bool fDone;
 
 public:
     CCheckQueueControl() = delete;
     CCheckQueueControl(const CCheckQueueControl&) = delete;
     CCheckQueueControl& operator=(const CCheckQueueControl&) = delete;
-    explicit CCheckQueueControl(CCheckQueue<T> * const pqueueIn) : pqueue(pqueueIn), fDone(false)
+    explicit CCheckQueueControl(Q * const pqueueIn) : pqueue(pqueueIn), fDone(false)
     {
         // passed queue is supposed to be unused, or nullptr
         if (pqueue != nullptr) {
@@ -8,6 +8,11 @@
 #include <random.h>
 #include <version.h>
 
+#include <algorithm>
+#include <type_traits>
+
+#include <string.h>
+
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
@@ -30,36 +35,198 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
+CompactCoin::CompactCoin(const Coin& coin) : CompactCoin() {
+    if (coin.IsSpent()) return;
+    nValue = coin.out.nValue;
+    nCode = coin.nHeight * 2 + coin.fCoinBase;
+    const CScript& script = coin.out.scriptPubKey;
+    if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 && script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        nType = TYPE_P2PKH;
+        memcpy(vchData, &script[3], 20);
+    } else if (script.size() == 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+        nType = TYPE_P2SH;
+        memcpy(vchData, &script[2], 20);
+    } else if (script.size() == 22 && script[0] == OP_0 && script[1] == 20) {
+        nType = TYPE_P2WPKH;
+        memcpy(vchData, &script[2], 20);
+    } else if (script.size() <= MAX_INLINE_SCRIPT_SIZE) {
+        nType = script.size();
+        if (!script.empty()) memcpy(vchData, script.data(), script.size());
+    } else {
+        SetHeapScript(script.data(), script.size());
+    }
+}
+
+CompactCoin::CompactCoin(const CompactCoin& other) : nValue(other.nValue), nCode(other.nCode), nType(other.nType) {
+    if (nType == TYPE_HEAP) {
+        unsigned char* data;
+        uint32_t size;
+        other.GetHeapScript(data, size);
+        SetHeapScript(data, size);
+    } else {
+        memcpy(vchData, other.vchData, sizeof(vchData));
+    }
+}
+
+CompactCoin::CompactCoin(CompactCoin&& other) noexcept : nValue(other.nValue), nCode(other.nCode), nType(other.nType) {
+    memcpy(vchData, other.vchData, sizeof(vchData));
+    // The heap script (if any) now belongs to this coin.
+    other.nValue = -1;
+    other.nCode = 0;
+    other.nType = 0;
+}
+
+CompactCoin& CompactCoin::operator=(const CompactCoin& other) {
+    if (this != &other) {
+        *this = CompactCoin(other);
+    }
+    return *this;
+}
+
+CompactCoin& CompactCoin::operator=(CompactCoin&& other) noexcept {
+    if (this != &other) {
+        Clear();
+        nValue = other.nValue;
+        nCode = other.nCode;
+        nType = other.nType;
+        memcpy(vchData, other.vchData, sizeof(vchData));
+        other.nValue = -1;
+        other.nCode = 0;
+        other.nType = 0;
+        }
+    return *this;
+}
+
+void CompactCoin::Clear() {
+    if (nType == TYPE_HEAP) {
+        unsigned char* data;
+        uint32_t size;
+        GetHeapScript(data, size);
+        delete[] data;
+    }
+    nValue = -1;
+    nCode = 0;
+    nType = 0;
+}
+
+void CompactCoin::SetHeapScript(const unsigned char* data, uint32_t size) {
+    unsigned char* copy = new unsigned char[size];
+    memcpy(copy, data, size);
+    nType = TYPE_HEAP;
+    memcpy(vchData, &copy, sizeof(copy));
+    memcpy(vchData + sizeof(copy), &size, sizeof(size));
+}
+
+void CompactCoin::GetHeapScript(unsigned char*& data, uint32_t& size) const {
+    assert(nType == TYPE_HEAP);
+    memcpy(&data, vchData, sizeof(data));
+    memcpy(&size, vchData + sizeof(data), sizeof(size));
+}
+
+Coin CompactCoin::Expand() const {
+    Coin coin;
+    if (IsSpent()) return coin;
+    coin.out.nValue = nValue;
+    coin.nHeight = nCode >> 1;
+    coin.fCoinBase = nCode & 1;
+    CScript& script = coin.out.scriptPubKey;
+    switch (nType) {
+    case TYPE_P2PKH:
+        script.resize(25);
+        script[0] = OP_DUP;
+        script[1] = OP_HASH160;
+        script[2] = 20;
+        memcpy(&script[3], vchData, 20);
+        script[23] = OP_EQUALVERIFY;
+        script[24] = OP_CHECKSIG;
+        break;
+    case TYPE_P2SH:
+        script.resize(23);
+        script[0] = OP_HASH160;
+        script[1] = 20;
+        memcpy(&script[2], vchData, 20);
+        script[22] = OP_EQUAL;
+        break;
+    case TYPE_P2WPKH:
+        script.resize(22);
+        script[0] = OP_0;
+        script[1] = 20;
+        memcpy(&script[2], vchData, 20);
+        break;
+    case TYPE_HEAP: {
+        unsigned char* data;
+        uint32_t size;
+        GetHeapScript(data, size);
+        script.assign(data, data + size);
+        break;
+    }
+    default:
+        script.assign(vchData, vchData + nType);
+    }
+    return coin;
+}
+
+size_t CompactCoin::DynamicMemoryUsage() const {
+    size_t usage = 0;
+    if (nType == TYPE_HEAP) {
+        unsigned char* data;
+        uint32_t size;
+        GetHeapScript(data, size);
+        usage += memusage::MallocUsage(size);
+    }
+    return usage;
+}
+
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0), nAccessClock(0), nReservedCoins(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
+size_t CCoinsViewCache::UsedDynamicMemoryUsage() const {
+    const CCoinsMapMemoryResource* resource = cacheCoins.get_allocator().resource();
+    return DynamicMemoryUsage() - (resource ? resource->FreeBytes() : 0);
+}
+
 //
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        Touch(it->second);
         return it;
+    }
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(tmp)).first;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
     cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
+    Touch(ret->second);
     return ret;
 }
 
+void CCoinsViewCache::Touch(CCoinsCacheEntry& entry) const {
+    if (++nAccessClock == 0) {
+        // The clock wrapped around. Forget the access order rather than
+        // treating the oldest entries as the most recently used ones.
+        for (auto& cached : cacheCoins) {
+            cached.second.nLastAccess = 0;
+        }
+        nAccessClock = 1;
+    }
+    entry.nLastAccess = nAccessClock;
+}
+
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coin = it->second.coin;
+        coin = it->second.coin.Expand();
         return !coin.IsSpent();
     }
     return false;
@@ -81,9 +248,31 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
-    it->second.coin = std::move(coin);
+    it->second.coin = CompactCoin(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    Touch(it->second);
+}
+
+void CCoinsViewCache::EmplaceCoinFromBase(const COutPoint& outpoint, Coin&& coin) {
+    if (coin.IsSpent()) return;
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(coin));
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        Touch(it->second);
+    }
+}
+
+void CCoinsViewCache::EmplaceSpentCoinFromBase(const COutPoint& outpoint) {
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    if (inserted) {
+        cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+        Touch(it->second);
+    }
 }
 
 void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
@@ -102,7 +291,7 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     if (it == cacheCoins.end()) return false;
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
     if (moveout) {
-        *moveout = std::move(it->second.coin);
+        *moveout = it->second.coin.Expand();
     }
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
         cacheCoins.erase(it);
@@ -113,15 +302,13 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     return true;
 }
 
-static const Coin coinEmpty;
-
 //返回这个outpoint对应的coin
-const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+Coin CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return coinEmpty;
+        return Coin();
     } else {
-        return it->second.coin;
+        return it->second.coin.Expand();
     }
 }
 
@@ -163,6 +350,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 entry.coin = std::move(it->second.coin);
                 cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
+                Touch(entry);
                 // We can mark it FRESH in the parent if it was FRESH in the child
                 // Otherwise it might have just been flushed from the parent's cache
                 // and already exist in the grandparent
@@ -192,6 +380,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 itUs->second.coin = std::move(it->second.coin);
                 cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                Touch(itUs->second);
                 // NOTE: It is possible the child has a FRESH flag here in
                 // the event the entry we found in the parent is pruned. But
                 // we must not copy that FRESH flag to the parent as that
@@ -208,9 +397,82 @@ bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    // A pool keeps all memory it ever handed out, and the base may still be
+    // using the old entries (see CCoinsViewDB::RequestBackgroundWrite).
+    if (cacheCoins.get_allocator().resource()) ReallocateCache();
     return fOk;
 }
 
+void CCoinsViewCache::ReallocateCache() {
+    assert(cacheCoins.empty());
+    // Allocate the new map before the old one is destroyed, so that a
+    // failure leaves the cache as it was. The hasher cannot be assigned, so
+    // the map is then moved into place, which cannot throw.
+    CCoinsMap fresh(nReservedCoins, SaltedOutpointHasher(), CCoinsMap::key_equal(), CCoinsMapAllocator(std::make_shared<CCoinsMapMemoryResource>()));
+    static_assert(std::is_nothrow_move_constructible<CCoinsMap>::value, "CCoinsMap must be recreated without throwing");
+    cacheCoins.~CCoinsMap();
+    new (&cacheCoins) CCoinsMap(std::move(fresh));
+}
+
+void CCoinsViewCache::ReserveCache(size_t nMaxUsage) {
+    // Assume two pointers of node overhead and one bucket per entry.
+    nReservedCoins = nMaxUsage / (sizeof(CCoinsMap::value_type) + 3 * sizeof(void*));
+    ReallocateCache();
+}
+
+bool CCoinsViewCache::Sync() {
+    CCoinsMap mapDirty;
+    for (const auto& entry : cacheCoins) {
+        if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+            mapDirty.insert(entry);
+        }
+    }
+    bool fOk = base->BatchWrite(mapDirty, hashBlock);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            if (it->second.coin.IsSpent()) {
+                cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+                it = cacheCoins.erase(it);
+                continue;
+            }
+            // The base has this coin now.
+            it->second.flags = 0;
+        }
+        ++it;
+    }
+    return fOk;
+}
+
+void CCoinsViewCache::Trim(size_t nTargetUsage) {
+    size_t nUsage = UsedDynamicMemoryUsage();
+    if (nUsage <= nTargetUsage) return;
+    std::vector<CCoinsMap::iterator> vClean;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it) {
+        if (it->second.flags == 0) {
+            vClean.push_back(it);
+        }
+    }
+    const auto older = [](const CCoinsMap::iterator& a, const CCoinsMap::iterator& b) {
+        return a->second.nLastAccess < b->second.nLastAccess;
+    };
+    // Only order the oldest entries, about as many as need to be evicted
+    // judging by the average usage per entry, and take twice as many more
+    // each time that is not enough.
+    size_t nBatch = (nUsage - nTargetUsage) / (nUsage / cacheCoins.size() + 1) + 1;
+    std::vector<CCoinsMap::iterator>::iterator first = vClean.begin();
+    while (first != vClean.end()) {
+        const std::vector<CCoinsMap::iterator>::iterator last = first + std::min<size_t>(nBatch, vClean.end() - first);
+        std::nth_element(first, last, vClean.end(), older);
+        std::sort(first, last, older);
+        for (; first != last; ++first) {
+            if (UsedDynamicMemoryUsage() <= nTargetUsage) return;
+            cachedCoinsUsage -= (*first)->second.coin.DynamicMemoryUsage();
+            cacheCoins.erase(*first);
+        }
+        nBatch *= 2;
+    }
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -253,13 +515,13 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 static const size_t MIN_TRANSACTION_OUTPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize(CTxOut(), PROTOCOL_VERSION);
 static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_OUTPUT_WEIGHT;
 
-const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
+Coin AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
     COutPoint iter(txid, 0);
     while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
-        const Coin& alternate = view.AccessCoin(iter);
+        Coin alternate = view.AccessCoin(iter);
         if (!alternate.IsSpent()) return alternate;
         ++iter.n;
     }
-    return coinEmpty;
+    return Coin();
 }
@@ -12,6 +12,7 @@
 #include <crypto/siphash.h>
 #include <memusage.h>
 #include <serialize.h>
+#include <support/allocators/pool.h>
 #include <uint256.h>
 
 #include <assert.h>
@@ -83,6 +84,67 @@ public:
     }
 };
 
+/**
+ * A Coin in the compact form the coins cache keeps it in.
+ *
+ * Scripts of the common templates (P2PKH, P2SH and P2WPKH) are reduced to
+ * their 20-byte hash, other scripts of up to 20 bytes are stored inline and
+ * longer ones in a separate allocation. With the 4-byte packing this takes 36
+ * bytes, against 48 for a Coin, whose CTxOut has room for 28 script bytes and
+ * is 8-byte aligned. Expand() rebuilds the Coin; nothing is kept of it, so the
+ * cache never holds both forms of a coin.
+ */
+#pragma pack(push, 4)
+class CompactCoin
+{
+private:
+    //! Script types. Smaller values are the size of a script stored inline.
+    enum : unsigned char {
+        MAX_INLINE_SCRIPT_SIZE = 20,
+        TYPE_P2PKH,
+        TYPE_P2SH,
+        TYPE_P2WPKH,
+        TYPE_HEAP,
+    };
+
+    int64_t nValue;
+    //! height * 2 + coinbase, as in the serialization of Coin
+    uint32_t nCode;
+    unsigned char nType;
+    //! The script hash or inline script, or the pointer to and size of a TYPE_HEAP script
+    unsigned char vchData[MAX_INLINE_SCRIPT_SIZE];
+
+    void SetHeapScript(const unsigned char* data, uint32_t size);
+    void GetHeapScript(unsigned char*& data, uint32_t& size) const;
+
+public:
+    //! Construct a spent coin.
+    CompactCoin() : nValue(-1), nCode(0), nType(0) {}
+    explicit CompactCoin(const Coin& coin);
+    CompactCoin(const CompactCoin& other);
+    CompactCoin(CompactCoin&& other) noexcept;
+    CompactCoin& operator=(const CompactCoin& other);
+    CompactCoin& operator=(CompactCoin&& other) noexcept;
+    ~CompactCoin() { Clear(); }
+
+    void Clear();
+
+    bool IsSpent() const {
+        return nValue == -1;
+    }
+
+    Coin Expand() const;
+
+    size_t DynamicMemoryUsage() const;
+
+    //! Serialize as the Coin it represents.
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        Expand().Serialize(s);
+    }
+};
+#pragma pack(pop)
+
 class SaltedOutpointHasher
 {
 private:
@@ -104,8 +166,9 @@ public:
 
 struct CCoinsCacheEntry
 {
-    Coin coin; // The actual cached data.
+    CompactCoin coin; // The actual cached data.
     unsigned char flags;
+    uint32_t nLastAccess; // Access clock of the owning cache when this entry was last used, see CCoinsViewCache::Trim.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -117,11 +180,20 @@ struct CCoinsCacheEntry
          */
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), nLastAccess(0) {}
+    explicit CCoinsCacheEntry(const Coin& coin_) : coin(coin_), flags(0), nLastAccess(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * Cache entries are allocated from a pool (see PoolResource), which avoids the
+ * malloc overhead of a separate allocation per entry and keeps entries close
+ * together. The node layout of std::unordered_map is implementation defined;
+ * it adds one or two pointers and possibly the hash to the value, so allowing
+ * for four pointers makes sure nodes are pooled with all implementations.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>, sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4, alignof(void*)> CCoinsMapAllocator;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -213,6 +285,12 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Incremented on every access to an entry, to find the least recently used ones. */
+    mutable uint32_t nAccessClock;
+
+    /* Number of coins the hash table is sized for, see ReserveCache. */
+    size_t nReservedCoins;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -239,16 +317,13 @@ public:
     bool HaveCoinInCache(const COutPoint &outpoint) const;
 
     /**
-     * Return a reference to Coin in the cache, or a pruned one if not found. This is
+     * Return a copy of the Coin in the cache, or a pruned one if not found. This is
      * more efficient than GetCoin.
      *
-     * Generally, do not hold the reference returned for more than a short scope.
-     * While the current implementation allows for modifications to the contents
-     * of the cache while holding the reference, this behavior should not be relied
-     * on! To be safe, best to not hold the returned reference through any other
-     * calls to this cache.
+     * Cached coins are kept in compact form (see CompactCoin), so the coin is
+     * expanded into the returned value rather than referenced in place.
      */
-    const Coin& AccessCoin(const COutPoint &output) const;
+    Coin AccessCoin(const COutPoint &output) const;
 
     /**
      * Add a coin. Set potential_overwrite to true if a non-pruned version may
@@ -256,6 +331,22 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Insert an unspent coin that was read from the backing view ahead of time,
+     * unless the outpoint is already cached. The entry is left clean, exactly as
+     * if it had been pulled in by a lookup, so it can be Uncache()d or dropped
+     * on flush without writing anything back.
+     */
+    void EmplaceCoinFromBase(const COutPoint& outpoint, Coin&& coin);
+
+    /**
+     * Record that the backing view was found to have no unspent coin for an
+     * outpoint, unless the outpoint is already cached, so that looking it up
+     * again does not reach the backing view. The spent entry is left clean,
+     * like the ones inserted by EmplaceCoinFromBase.
+     */
+    void EmplaceSpentCoinFromBase(const COutPoint& outpoint);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -270,6 +361,33 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep the cached coins. Spent entries are dropped and all others are
+     * left unmodified, so they can be evicted later without writing anything.
+     * The modified entries are copied for the write, which temporarily needs
+     * memory for them.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Evict unmodified entries, least recently used first, until the memory
+     * usage of the cache is at most nTargetUsage or no unmodified entries are
+     * left. Modified entries are never evicted; Sync() first to make them
+     * evictable.
+     */
+    void Trim(size_t nTargetUsage);
+
+    /**
+     * Size the hash table for as many coins as fit in nMaxUsage bytes, so it
+     * does not need to be rehashed while the cache fills up, and allocate
+     * the entries from a pool. Only worth it for a long-lived cache such as
+     * the coins tip; short-lived views allocate their entries one by one.
+     * The cache must be empty. Flush() keeps the reservation.
+     */
+    void ReserveCache(size_t nMaxUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -282,6 +400,9 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Like DynamicMemoryUsage(), without the free memory of the pool, which is reused before it grows
+    size_t UsedDynamicMemoryUsage() const;
+
     /**
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -301,6 +422,12 @@ private:
      * memory usage.
      */
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+
+    //! Mark an entry as the most recently used one.
+    void Touch(CCoinsCacheEntry& entry) const;
+
+    //! Replace the (empty) cache by a new one, returning the memory of the old one.
+    void ReallocateCache();
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
@@ -315,6 +442,6 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool
 //! This function can be quite expensive because in the event of a transaction
 //! which is not found in the cache, it can cause up to MAX_OUTPUTS_PER_BLOCK
 //! lookups to database, so it should be used with care.
-const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
+Coin AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
 
 #endif // BITCOIN_COINS_H
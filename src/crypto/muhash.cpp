@@ -0,0 +1,157 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+/** 2^3072 - MAX_PRIME_DIFF is the largest 3072-bit prime. */
+constexpr uint32_t MAX_PRIME_DIFF = 1103717;
+
+/** Add c * MAX_PRIME_DIFF to limbs, starting at the least significant one. Returns the carry out of the top limb. */
+uint32_t AddMulDiff(uint32_t* limbs, uint64_t c)
+{
+    uint64_t carry = c * MAX_PRIME_DIFF;
+    for (int i = 0; i < Num3072::LIMBS && carry; ++i) {
+        carry += limbs[i];
+        limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    memset(limbs + 1, 0, sizeof(limbs) - sizeof(limbs[0]));
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] < (uint32_t)(0 - MAX_PRIME_DIFF)) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the prime is the same as adding MAX_PRIME_DIFF and dropping 2^3072.
+    AddMulDiff(limbs, 1);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint32_t product[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            carry += (uint64_t)limbs[i] * a.limbs[j] + product[i + j];
+            product[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        product[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // product = lo + hi * 2^3072 = lo + hi * MAX_PRIME_DIFF (mod p)
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        carry += (uint64_t)product[i + LIMBS] * MAX_PRIME_DIFF + product[i];
+        limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    // Fold the remaining overflow back in until the number fits in 3072 bits.
+    while (carry) {
+        carry = AddMulDiff(limbs, carry);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::Inverse()
+{
+    // By Fermat's little theorem the inverse is this number raised to p - 2. The
+    // exponent is all ones except for its lowest limb.
+    const uint32_t low = (uint32_t)(0 - MAX_PRIME_DIFF - 2);
+    const Num3072 base = *this;
+    SetToOne();
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const uint32_t word = i == 0 ? low : 0xFFFFFFFF;
+        for (int bit = 31; bit >= 0; --bit) {
+            Multiply(*this);
+            if ((word >> bit) & 1) Multiply(base);
+        }
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+/** Hash an arbitrary byte string to a number modulo the prime. */
+static Num3072 ToNum3072(Span<const unsigned char> in)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(in.data(), in.size()).Finalize(key);
+    unsigned char data[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Keystream(data, sizeof(data));
+    return Num3072(data);
+}
+
+MuHash3072& MuHash3072::Insert(Span<const unsigned char> in)
+{
+    m_numerator.Multiply(ToNum3072(in));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(Span<const unsigned char> in)
+{
+    m_denominator.Multiply(ToNum3072(in));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    m_numerator.Multiply(mul.m_numerator);
+    m_denominator.Multiply(mul.m_denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    m_numerator.Multiply(div.m_denominator);
+    m_denominator.Multiply(div.m_numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(uint256& out) const
+{
+    Num3072 result = m_denominator;
+    result.Inverse();
+    result.Multiply(m_numerator);
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    result.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out.begin());
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <serialize.h>
+#include <span.h>
+#include <uint256.h>
+
+#include <stdint.h>
+
+/** An integer modulo the prime 2^3072 - 1103717, stored as little-endian 32-bit limbs. */
+class Num3072
+{
+public:
+    static constexpr int LIMBS = 96;
+    static constexpr size_t BYTE_SIZE = 384;
+
+    uint32_t limbs[LIMBS];
+
+    /** Construct the number 1. */
+    Num3072() { SetToOne(); }
+    /** Construct a number from BYTE_SIZE little-endian bytes, reduced modulo the prime. */
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    /** Replace this number by its multiplicative inverse. */
+    void Inverse();
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        for (int i = 0; i < LIMBS; ++i) {
+            READWRITE(limbs[i]);
+        }
+    }
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/** A multiplicative hash of a set of byte strings (MuHash3072).
+ *
+ *  Every element is hashed to a number modulo a 3072-bit prime, and the set
+ *  hash is the product of the numbers of all elements. As multiplication is
+ *  commutative the result does not depend on the order in which elements are
+ *  added, and elements can be removed again by dividing them out. This makes
+ *  it possible to keep the hash of a set up to date while it changes, without
+ *  ever looking at the whole set.
+ *
+ *  Removals are accumulated in a separate denominator, so that Insert and
+ *  Remove only cost a multiplication; the single (expensive) modular inversion
+ *  happens in Finalize.
+ */
+class MuHash3072
+{
+private:
+    Num3072 m_numerator;
+    Num3072 m_denominator;
+
+public:
+    /** Construct the hash of the empty set. */
+    MuHash3072() {}
+
+    /** Add an element to the set. */
+    MuHash3072& Insert(Span<const unsigned char> in);
+    /** Remove an element from the set. It must have been inserted before. */
+    MuHash3072& Remove(Span<const unsigned char> in);
+
+    /** Combine with the hash of a disjoint set. */
+    MuHash3072& operator*=(const MuHash3072& mul);
+    /** Remove the elements of another hash, which must be a subset of this one. */
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    /** Compute the 256-bit hash of the set. Does not modify this object. */
+    void Finalize(uint256& out) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(m_numerator);
+        READWRITE(m_denominator);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -21,8 +21,8 @@
  * 1) bit_packed_atomic_flags is bit-packed atomic flags for garbage collection
  *
  * 2) cache is a cache which is performant in memory usage and lookup speed. It
- * is lockfree for erase operations. Elements are lazily erased on the next
- * insert.
+ * is lockfree for read and erase operations, which may run concurrently with
+ * an insert. Elements are lazily erased on the next insert.
  */
 namespace CuckooCache
 {
@@ -142,9 +142,15 @@ public:
  * User Must Guarantee:
  *
  * 1) Write Requires synchronized access (e.g., a lock)
- * 2) Read Requires no concurrent Write, synchronized with the last insert.
- * 3) Erase requires no concurrent Write, synchronized with last insert.
- * 4) An Erase caller must release all memory before allowing a new Writer.
+ * 2) setup() and setup_bytes() require no concurrent Read or Erase.
+ *
+ * Reads and Erases need no synchronization with insert(). Slots are stored in
+ * atomic words and guarded by sequence counters, which insert() makes odd
+ * while it writes a slot; a reader that sees a counter change treats the slot
+ * as not matching. So a Read may miss an element that a concurrent insert()
+ * is moving to another slot, but never returns a torn or never-inserted
+ * element, and an Erase may mark an element that replaced the one found as
+ * discardable. Both only cost a later cache miss.
  *
  *
  * Note on function names:
@@ -160,8 +166,21 @@ template <typename Element, typename Hash>
 class cache
 {
 private:
-    /** table stores all the elements */
-    std::vector<Element> table;
+    static_assert(sizeof(Element) % sizeof(uint64_t) == 0, "Element must be stored in whole 64-bit words");
+
+    /** The number of words each element is stored in */
+    static constexpr size_t ELEMENT_WORDS = sizeof(Element) / sizeof(uint64_t);
+
+    /** The number of adjacent slots sharing a sequence counter */
+    static constexpr uint32_t SLOTS_PER_SEQUENCE = 8;
+
+    /** table stores all the elements, as atomic words so that readers can load
+     * them while insert() stores others */
+    std::unique_ptr<std::atomic<uint64_t>[]> table;
+
+    /** sequences holds a counter for every SLOTS_PER_SEQUENCE slots, which is
+     * odd while insert() writes to one of them */
+    std::unique_ptr<std::atomic<uint32_t>[]> sequences;
 
     /** size stores the total available slots in the hash table */
     uint32_t size;
@@ -259,6 +278,49 @@ private:
         return ~(uint32_t)0;
     }
 
+    /** load_slot reads the element at index n. Readers must check the
+     * sequence counter around it, see slot_matches.
+     */
+    inline Element load_slot(uint32_t n) const
+    {
+        uint64_t words[ELEMENT_WORDS];
+        for (size_t i = 0; i < ELEMENT_WORDS; ++i)
+            words[i] = table[n * ELEMENT_WORDS + i].load(std::memory_order_relaxed);
+        Element e;
+        std::memcpy(static_cast<void*>(&e), words, sizeof(Element));
+        return e;
+    }
+
+    /** store_slot writes e to index n, making its sequence counter odd for the
+     * duration. Requires synchronized access, like insert.
+     */
+    inline void store_slot(uint32_t n, const Element& e)
+    {
+        uint64_t words[ELEMENT_WORDS];
+        std::memcpy(words, static_cast<const void*>(&e), sizeof(Element));
+        std::atomic<uint32_t>& sequence = sequences[n / SLOTS_PER_SEQUENCE];
+        const uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < ELEMENT_WORDS; ++i)
+            table[n * ELEMENT_WORDS + i].store(words[i], std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    /** slot_matches checks whether the element at index n is e, treating a
+     * slot written concurrently as not matching. Lock free.
+     */
+    inline bool slot_matches(uint32_t n, const Element& e) const
+    {
+        const std::atomic<uint32_t>& sequence = sequences[n / SLOTS_PER_SEQUENCE];
+        const uint32_t seq = sequence.load(std::memory_order_acquire);
+        if (seq & 1)
+            return false;
+        const Element found = load_slot(n);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence.load(std::memory_order_relaxed) == seq && found == e;
+    }
+
     /** allow_erase marks the element at index n as discardable. Threadsafe
      * without any concurrent insert.
      * @param n the index to allow erasure of
@@ -324,7 +386,7 @@ public:
     /** You must always construct a cache with some elements via a subsequent
      * call to setup or setup_bytes, otherwise operations may segfault.
      */
-    cache() : table(), size(), collection_flags(0), epoch_flags(),
+    cache() : table(), sequences(), size(), collection_flags(0), epoch_flags(),
     epoch_heuristic_counter(), epoch_size(), depth_limit(0), hash_function()
     {
     }
@@ -342,7 +404,13 @@ public:
         // depth_limit must be at least one otherwise errors can occur.
         depth_limit = static_cast<uint8_t>(std::log2(static_cast<float>(std::max((uint32_t)2, new_size))));
         size = std::max<uint32_t>(2, new_size);
-        table.resize(size);
+        const uint32_t n_sequences = (size + SLOTS_PER_SEQUENCE - 1) / SLOTS_PER_SEQUENCE;
+        sequences.reset(new std::atomic<uint32_t>[n_sequences]);
+        for (uint32_t i = 0; i < n_sequences; ++i)
+            sequences[i].store(0, std::memory_order_relaxed);
+        table.reset(new std::atomic<uint64_t>[size * ELEMENT_WORDS]);
+        for (uint32_t i = 0; i < size; ++i)
+            store_slot(i, Element());
         collection_flags.setup(size);
         epoch_flags.resize(size);
         // Set to 45% as described above
@@ -398,7 +466,7 @@ public:
         // Make sure we have not already inserted this element
         // If we have, make sure that it does not get deleted
         for (const uint32_t loc : locs)
-            if (table[loc] == e) {
+            if (load_slot(loc) == e) {
                 please_keep(loc);
                 epoch_flags[loc] = last_epoch;
                 return;
@@ -408,7 +476,7 @@ public:
             for (const uint32_t loc : locs) {
                 if (!collection_flags.bit_is_set(loc))
                     continue;
-                table[loc] = std::move(e);
+                store_slot(loc, e);
                 please_keep(loc);
                 epoch_flags[loc] = last_epoch;
                 return;
@@ -428,7 +496,9 @@ public:
             * for the next iteration.
             */
             last_loc = locs[(1 + (std::find(locs.begin(), locs.end(), last_loc) - locs.begin())) & 7];
-            std::swap(table[last_loc], e);
+            Element evicted = load_slot(last_loc);
+            store_slot(last_loc, e);
+            e = std::move(evicted);
             // Can't std::swap a std::vector<bool>::reference and a bool&.
             bool epoch = last_epoch;
             last_epoch = epoch_flags[last_loc];
@@ -439,6 +509,21 @@ public:
         }
     }
 
+    /** get_elements returns the elements that are not marked as discardable,
+     * those inserted in the older epoch first, so that inserting them into
+     * another cache in order favors keeping the newer ones. Requires
+     * synchronized access, like insert.
+     */
+    std::vector<Element> get_elements() const
+    {
+        std::vector<Element> elements;
+        for (const bool epoch : {false, true})
+            for (uint32_t i = 0; i < size; ++i)
+                if (epoch_flags[i] == epoch && !collection_flags.bit_is_set(i))
+                    elements.push_back(load_slot(i));
+        return elements;
+    }
+
     /* contains iterates through the hash locations for a given element
      * and checks to see if it is present.
      *
@@ -455,6 +540,9 @@ public:
      *
      * This is a great property for re-org performance for example.
      *
+     * contains may run concurrently with insert, in which case it may miss an
+     * element that insert is moving, see the class documentation.
+     *
      * contains returns a bool set true if the element was found.
      *
      * @param e the element to check
@@ -468,7 +556,7 @@ public:
     {
         std::array<uint32_t, 8> locs = compute_hashes(e);
         for (const uint32_t loc : locs)
-            if (table[loc] == e) {
+            if (slot_matches(loc, e)) {
                 if (erase)
                     allow_erase(loc);
                 return true;
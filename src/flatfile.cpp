@@ -96,3 +96,93 @@ bool FlatFileSeq::Flush(const FlatFilePos& pos, bool finalize)
     fclose(file);
     return true;
 }
+
+std::shared_ptr<const MappedFile> FlatFileMapCache::Map(const FlatFileSeq& seq, int file)
+{
+    if (m_max_mappings == 0) return nullptr;
+
+    std::shared_ptr<const MappedFile> mapping;
+    uint64_t generation;
+    {
+        LOCK(m_mutex);
+        ++m_readers[file];
+        auto it = m_mappings.find(file);
+        if (it != m_mappings.end()) {
+            it->second.last_used = ++m_use_count;
+            mapping = it->second.mapping;
+        }
+        generation = m_generation;
+    }
+
+    if (!mapping) {
+        // Map the file without holding the lock.
+        std::shared_ptr<MappedFile> opened = std::make_shared<MappedFile>();
+        if (!opened->Open(seq.FileName(FlatFilePos(file, 0)))) {
+            LogPrintf("Unable to map file %s\n", seq.FileName(FlatFilePos(file, 0)).string());
+            EndRead(file);
+            return nullptr;
+        }
+        mapping = opened;
+
+        LOCK(m_mutex);
+        if (generation == m_generation) {
+            auto inserted = m_mappings.emplace(file, Entry{mapping, ++m_use_count});
+            if (!inserted.second) {
+                // Another reader mapped the file in the meantime.
+                inserted.first->second.last_used = m_use_count;
+                mapping = inserted.first->second.mapping;
+            } else if (m_mappings.size() > m_max_mappings) {
+                auto oldest = m_mappings.begin();
+                for (auto it = m_mappings.begin(); it != m_mappings.end(); ++it) {
+                    if (it->second.last_used < oldest->second.last_used) oldest = it;
+                }
+                m_mappings.erase(oldest);
+            }
+        }
+    }
+
+    // The reader's reference ends the read once the mapping it holds is dropped, see Release().
+    const MappedFile* data = mapping.get();
+    return std::shared_ptr<const MappedFile>(data, [this, file, mapping](const MappedFile*) mutable {
+        mapping.reset();
+        EndRead(file);
+    });
+}
+
+void FlatFileMapCache::EndRead(int file)
+{
+    {
+        LOCK(m_mutex);
+        auto it = m_readers.find(file);
+        if (--it->second == 0) m_readers.erase(it);
+    }
+    m_readers_cv.notify_all();
+}
+
+void FlatFileMapCache::Invalidate(int file)
+{
+    LOCK(m_mutex);
+    ++m_generation;
+    m_mappings.erase(file);
+}
+
+void FlatFileMapCache::Release(int file)
+{
+    WAIT_LOCK(m_mutex, lock);
+    ++m_generation;
+    m_mappings.erase(file);
+    m_readers_cv.wait(lock, [this, file] { return m_readers.count(file) == 0; });
+}
+
+void FlatFileMapCache::Clear()
+{
+    LOCK(m_mutex);
+    ++m_generation;
+    m_mappings.clear();
+}
+
+size_t FlatFileMapCache::Size() const
+{
+    LOCK(m_mutex);
+    return m_mappings.size();
+}
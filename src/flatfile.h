@@ -6,10 +6,15 @@
 #ifndef BITCOIN_FLATFILE_H
 #define BITCOIN_FLATFILE_H
 
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <string>
 
 #include <fs.h>
 #include <serialize.h>
+#include <sync.h>
+#include <util/mmap.h>
 
 struct FlatFilePos
 {
@@ -93,4 +98,51 @@ public:
     bool Flush(const FlatFilePos& pos, bool finalize = false);
 };
 
+/**
+ * A bounded pool of read-only memory mappings of the files of a FlatFileSeq, evicting the least
+ * recently used mapping when full. Readers share a mapping, so one evicted or invalidated while in
+ * use stays valid until its last reader releases it.
+ *
+ * A mapping shows its file as it was when mapped: callers must invalidate a file before reading
+ * anything written to it afterwards, and release it before truncating or removing it.
+ */
+class FlatFileMapCache
+{
+public:
+    explicit FlatFileMapCache(size_t max_mappings) : m_max_mappings(max_mappings) {}
+
+    /**
+     * Map the given file of seq, or return nullptr if it cannot be mapped. The caller counts as
+     * a reader of the file until it drops the returned pointer, so it must not wait for a lock
+     * held by a caller of Release() while holding it.
+     */
+    std::shared_ptr<const MappedFile> Map(const FlatFileSeq& seq, int file);
+
+    /** Drop the mapping of a file, if there is one. */
+    void Invalidate(int file);
+    /** Drop the mapping of a file and wait until no reader holds it, so the file is not mapped anymore. */
+    void Release(int file);
+    void Clear();
+
+    size_t Size() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const MappedFile> mapping;
+        uint64_t last_used;
+    };
+
+    const size_t m_max_mappings;
+    mutable Mutex m_mutex;
+    std::map<int, Entry> m_mappings GUARDED_BY(m_mutex);
+    uint64_t m_use_count GUARDED_BY(m_mutex){0};
+    //! Incremented on every invalidation, so a file mapped concurrently is not added to the pool
+    uint64_t m_generation GUARDED_BY(m_mutex){0};
+    //! Number of readers of each file, from the start of Map() until they drop their mapping
+    std::map<int, int> m_readers GUARDED_BY(m_mutex);
+    std::condition_variable m_readers_cv;
+
+    void EndRead(int file);
+};
+
 #endif // BITCOIN_FLATFILE_H
@@ -331,7 +331,8 @@ public:
     bool havePruned() override
     {
         LOCK(cs_main);
-        return ::fHavePruned;
+        // Blocks below a loaded UTXO snapshot are missing just like pruned ones.
+        return ::fHavePruned || ::fHaveUTXOSnapshot;
     }
     bool p2pEnabled() override { return g_connman != nullptr; }
     bool isReadyToBroadcast() override { return !::fImporting && !::fReindex && !IsInitialBlockDownload(); }
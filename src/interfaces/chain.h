@@ -191,7 +191,8 @@ public:
     //! Relay dust fee setting (-dustrelayfee), reflecting lowest rate it's economical to spend.
     virtual CFeeRate relayDustFee() = 0;
 
-    //! Check if any block has been pruned.
+    //! Check if any block has been pruned, or was never downloaded because
+    //! the chainstate was loaded from a UTXO snapshot.
     virtual bool havePruned() = 0;
 
     //! Check if p2p enabled.
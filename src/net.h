@@ -106,6 +106,25 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string command;
+    //! Payload shared with other owners (such as the block cache), sent instead of data without being copied
+    std::shared_ptr<const std::vector<unsigned char>> shared_data;
+    //! Double-SHA256 of shared_data, computed once by its owner rather than for every peer
+    uint256 shared_data_hash;
+};
+
+/** Bytes queued for sending to a peer, either owned by the queue or shared with other owners. */
+class CSendBuffer
+{
+public:
+    explicit CSendBuffer(std::vector<unsigned char>&& data) : m_data(std::move(data)) {}
+    explicit CSendBuffer(std::shared_ptr<const std::vector<unsigned char>> shared_data) : m_shared_data(std::move(shared_data)) {}
+
+    const unsigned char* data() const { return m_shared_data ? m_shared_data->data() : m_data.data(); }
+    size_t size() const { return m_shared_data ? m_shared_data->size() : m_data.size(); }
+
+private:
+    std::vector<unsigned char> m_data;
+    std::shared_ptr<const std::vector<unsigned char>> m_shared_data;
 };
 
 
@@ -626,7 +645,7 @@ public:
     size_t nSendSize{0}; // total size of all vSendMsg entries
     size_t nSendOffset{0}; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes GUARDED_BY(cs_vSend){0};
-    std::deque<std::vector<unsigned char>> vSendMsg GUARDED_BY(cs_vSend);
+    std::deque<CSendBuffer> vSendMsg GUARDED_BY(cs_vSend);
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
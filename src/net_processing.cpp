@@ -16,6 +16,7 @@
 #include <merkleblock.h>
 #include <netmessagemaker.h>
 #include <netbase.h>
+#include <node/blockcache.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <primitives/block.h>
@@ -1412,19 +1413,20 @@ void static ProcessGetBlockData(CNode* pfrom, const CChainParams& chainparams, c
             pblock = a_recent_block;
         } else if (inv.type == MSG_WITNESS_BLOCK) {
             // Fast-path: in this case it is possible to serve the block directly from disk,
-            // as the network format matches the format on disk
-            std::vector<uint8_t> block_data;
-            if (!ReadRawBlockFromDisk(block_data, pindex, chainparams.MessageStart())) {
+            // as the network format matches the format on disk. The bytes are
+            // queued without being copied and their checksum is cached with them.
+            uint256 block_data_hash;
+            std::shared_ptr<const std::vector<uint8_t>> block_data = g_block_cache.GetRawBlock(pindex, chainparams.MessageStart(), block_data_hash);
+            if (!block_data) {
                 assert(!"cannot load block from disk");
             }
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(block_data)));
+            connman->PushMessage(pfrom, msgMaker.MakeShared(NetMsgType::BLOCK, std::move(block_data), block_data_hash));
             // Don't set pblock as we've sent the block
         } else {
             // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams))
+            pblock = g_block_cache.GetBlock(pindex, consensusParams);
+            if (!pblock)
                 assert(!"cannot load block from disk");
-            pblock = pblockRead;
         }
         if (pblock) {
             if (inv.type == MSG_BLOCK)
@@ -2367,11 +2369,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        CBlock block;
-        bool ret = ReadBlockFromDisk(block, pindex, chainparams.GetConsensus());
-        assert(ret);
+        std::shared_ptr<const CBlock> pblock = g_block_cache.GetBlock(pindex, chainparams.GetConsensus());
+        assert(pblock);
 
-        SendBlockTransactions(block, req, pfrom, connman);
+        SendBlockTransactions(*pblock, req, pfrom, connman);
         return true;
     }
 
@@ -3672,10 +3673,9 @@ bool PeerLogicValidation::SendMessages(CNode* pto)
                         }
                     }
                     if (!fGotBlockFromCache) {
-                        CBlock block;
-                        bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
-                        assert(ret);
-                        CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
+                        std::shared_ptr<const CBlock> pblock = g_block_cache.GetBlock(pBestIndex, consensusParams);
+                        assert(pblock);
+                        CBlockHeaderAndShortTxIDs cmpctblock(*pblock, state.fWantsCmpctWitness);
                         connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                     }
                     state.pindexBestHeaderSent = pBestIndex;
@@ -29,6 +29,16 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    /** Make a message whose payload is already serialized and shared with other owners, so it is queued without being copied. */
+    CSerializedNetMsg MakeShared(std::string sCommand, std::shared_ptr<const std::vector<unsigned char>> data, const uint256& data_hash) const
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.shared_data = std::move(data);
+        msg.shared_data_hash = data_hash;
+        return msg;
+    }
+
 private:
     const int nVersion;
 };
@@ -0,0 +1,127 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/blockcache.h>
+
+#include <chain.h>
+#include <core_memusage.h>
+#include <hash.h>
+#include <memusage.h>
+#include <primitives/block.h>
+
+BlockCache g_block_cache;
+
+void BlockCache::SetMaxUsage(size_t max_usage)
+{
+    LOCK(m_mutex);
+    m_max_usage = max_usage;
+    Evict();
+}
+
+std::shared_ptr<const CBlock> BlockCache::GetBlock(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(m_mutex);
+        Entry* entry = Find(hash);
+        if (entry && entry->block) {
+            ++m_hits;
+            return entry->block;
+        }
+        ++m_misses;
+    }
+
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*block, pindex, consensusParams)) return nullptr;
+
+    LOCK(m_mutex);
+    if (m_max_usage == 0) return block;
+    Entry& entry = Insert(hash);
+    if (entry.block) return entry.block;
+    entry.block = block;
+    Account(entry);
+    return block;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> BlockCache::GetRawBlock(const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start, uint256& raw_hash)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    {
+        LOCK(m_mutex);
+        Entry* entry = Find(hash);
+        if (entry && entry->raw) {
+            ++m_hits;
+            raw_hash = entry->raw_hash;
+            return entry->raw;
+        }
+        ++m_misses;
+    }
+
+    std::shared_ptr<std::vector<uint8_t>> raw = std::make_shared<std::vector<uint8_t>>();
+    if (!ReadRawBlockFromDisk(*raw, pindex, message_start)) return nullptr;
+    raw_hash = Hash(raw->begin(), raw->end());
+
+    LOCK(m_mutex);
+    if (m_max_usage == 0) return raw;
+    Entry& entry = Insert(hash);
+    if (entry.raw) {
+        raw_hash = entry.raw_hash;
+        return entry.raw;
+    }
+    entry.raw = raw;
+    entry.raw_hash = raw_hash;
+    Account(entry);
+    return raw;
+}
+
+void BlockCache::Clear()
+{
+    LOCK(m_mutex);
+    m_entries.clear();
+    m_lru.clear();
+    m_usage = 0;
+}
+
+BlockCache::Stats BlockCache::GetStats() const
+{
+    LOCK(m_mutex);
+    return Stats{m_entries.size(), m_usage, m_max_usage, m_hits, m_misses};
+}
+
+BlockCache::Entry* BlockCache::Find(const uint256& hash)
+{
+    auto it = m_entries.find(hash);
+    if (it == m_entries.end()) return nullptr;
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+    return &it->second;
+}
+
+BlockCache::Entry& BlockCache::Insert(const uint256& hash)
+{
+    Entry* existing = Find(hash);
+    if (existing) return *existing;
+    m_lru.push_front(hash);
+    Entry& entry = m_entries[hash];
+    entry.lru_it = m_lru.begin();
+    return entry;
+}
+
+void BlockCache::Account(Entry& entry)
+{
+    m_usage -= entry.usage;
+    // Approximate the map and list node overhead with the size of the entry.
+    entry.usage = sizeof(Entry) + sizeof(uint256) * 2 + RecursiveDynamicUsage(entry.block) + (entry.raw ? memusage::DynamicUsage(entry.raw) + memusage::DynamicUsage(*entry.raw) : 0);
+    m_usage += entry.usage;
+    Evict();
+}
+
+void BlockCache::Evict()
+{
+    while (m_usage > m_max_usage && !m_lru.empty()) {
+        auto it = m_entries.find(m_lru.back());
+        m_usage -= it->second.usage;
+        m_entries.erase(it);
+        m_lru.pop_back();
+    }
+}
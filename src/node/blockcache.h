@@ -0,0 +1,84 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_BLOCKCACHE_H
+#define BITCOIN_NODE_BLOCKCACHE_H
+
+#include <protocol.h>
+#include <sync.h>
+#include <uint256.h>
+#include <validation.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/** -blockcachesize default (MiB) */
+static const int64_t DEFAULT_BLOCK_CACHE_SIZE = 32;
+
+/**
+ * A size-bounded, least recently used cache of blocks read from disk, shared
+ * by the code serving blocks to peers, REST and RPC. Blocks are kept both
+ * deserialized and as stored on disk, as requested; each form is read from
+ * disk the first time it is asked for. Disk reads happen without holding the
+ * cache lock, so a block missing from the cache may be read more than once.
+ */
+class BlockCache
+{
+public:
+    struct Stats {
+        size_t entries;
+        size_t usage;
+        size_t max_usage;
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    /** Set the memory limit, evicting blocks as needed. A limit of 0 disables the cache. */
+    void SetMaxUsage(size_t max_usage);
+
+    /** Return the block at pindex, or nullptr if it cannot be read from disk. */
+    std::shared_ptr<const CBlock> GetBlock(const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+    /**
+     * Return the block at pindex as stored on disk (serialized with witness
+     * data), or nullptr if it cannot be read. raw_hash is set to the
+     * double-SHA256 of the returned bytes, which is the checksum of a block
+     * message carrying them.
+     */
+    std::shared_ptr<const std::vector<uint8_t>> GetRawBlock(const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start, uint256& raw_hash);
+
+    void Clear();
+    Stats GetStats() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const CBlock> block;
+        std::shared_ptr<const std::vector<uint8_t>> raw;
+        uint256 raw_hash;
+        size_t usage{0};
+        std::list<uint256>::iterator lru_it;
+    };
+
+    /** Look up an entry and mark it as most recently used. */
+    Entry* Find(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    /** Find or create the entry for hash, for a block (form) just read from disk. */
+    Entry& Insert(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    void Account(Entry& entry) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+    void Evict() EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+
+    mutable Mutex m_mutex;
+    std::unordered_map<uint256, Entry, BlockHasher> m_entries GUARDED_BY(m_mutex);
+    //! Block hashes, most recently used first
+    std::list<uint256> m_lru GUARDED_BY(m_mutex);
+    size_t m_usage GUARDED_BY(m_mutex){0};
+    size_t m_max_usage GUARDED_BY(m_mutex){0};
+    uint64_t m_hits GUARDED_BY(m_mutex){0};
+    uint64_t m_misses GUARDED_BY(m_mutex){0};
+};
+
+extern BlockCache g_block_cache;
+
+#endif // BITCOIN_NODE_BLOCKCACHE_H
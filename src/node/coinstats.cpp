@@ -0,0 +1,148 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/coinstats.h>
+
+#include <serialize.h>
+#include <streams.h>
+#include <util/system.h>
+#include <version.h>
+
+#include <boost/thread.hpp>
+
+#include <memory>
+#include <vector>
+
+static uint64_t GetBogoSize(const CScript& scriptPubKey)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + scriptPubKey.size() /* scriptPubKey */;
+}
+
+//! Serialize a coin the way it is fed into the MuHash of the UTXO set.
+static std::vector<unsigned char> TxOutSer(const COutPoint& outpoint, const Coin& coin)
+{
+    std::vector<unsigned char> data;
+    CVectorWriter(SER_DISK, PROTOCOL_VERSION, data, 0, outpoint, static_cast<uint32_t>(coin.nHeight * 2 + coin.fCoinBase), coin.out);
+    return data;
+}
+
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out.scriptPubKey;
+        ss << VARINT(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += GetBogoSize(output.second.out.scriptPubKey);
+    }
+    ss << VARINT(0u);
+}
+
+CCoinsStatsBuilder::CCoinsStatsBuilder(const uint256& hashBlock, bool fMuHash) : m_ss(SER_GETHASH, PROTOCOL_VERSION), m_fMuHash(fMuHash)
+{
+    m_stats.hashBlock = hashBlock;
+    m_ss << hashBlock;
+}
+
+void CCoinsStatsBuilder::Add(const COutPoint& outpoint, Coin&& coin)
+{
+    if (!m_outputs.empty() && outpoint.hash != m_prevkey) {
+        ApplyStats(m_stats, m_ss, m_prevkey, m_outputs);
+        m_outputs.clear();
+    }
+    if (m_fMuHash) {
+        const std::vector<unsigned char> data = TxOutSer(outpoint, coin);
+        m_muhash.Insert(MakeSpan(data));
+    }
+    m_prevkey = outpoint.hash;
+    m_outputs[outpoint.n] = std::move(coin);
+}
+
+const CCoinsStats& CCoinsStatsBuilder::Finalize()
+{
+    if (!m_outputs.empty()) {
+        ApplyStats(m_stats, m_ss, m_prevkey, m_outputs);
+        m_outputs.clear();
+    }
+    m_stats.hashSerialized = m_ss.GetHash();
+    if (m_fMuHash) m_muhash.Finalize(m_stats.hashMuHash);
+    return m_stats;
+}
+
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, bool fMuHash)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+
+    CCoinsStatsBuilder builder(pcursor->GetBestBlock(), fMuHash);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            builder.Add(key, std::move(coin));
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    stats = builder.Finalize();
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+void RollingCoinsStats::Add(const COutPoint& outpoint, const Coin& coin)
+{
+    const std::vector<unsigned char> data = TxOutSer(outpoint, coin);
+    muhash.Insert(MakeSpan(data));
+    nTransactionOutputs++;
+    nTotalAmount += coin.out.nValue;
+    nBogoSize += GetBogoSize(coin.out.scriptPubKey);
+}
+
+void RollingCoinsStats::Remove(const COutPoint& outpoint, const Coin& coin)
+{
+    const std::vector<unsigned char> data = TxOutSer(outpoint, coin);
+    muhash.Remove(MakeSpan(data));
+    nTransactionOutputs--;
+    nTotalAmount -= coin.out.nValue;
+    nBogoSize -= GetBogoSize(coin.out.scriptPubKey);
+}
+
+void RollingCoinsStats::GetStats(CCoinsStats& stats) const
+{
+    stats.hashBlock = hashBlock;
+    stats.nTransactionOutputs = nTransactionOutputs;
+    stats.nBogoSize = nBogoSize;
+    stats.nTotalAmount = nTotalAmount;
+    muhash.Finalize(stats.hashMuHash);
+}
+
+bool ComputeRollingCoinsStats(CCoinsView* view, RollingCoinsStats& stats)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    assert(pcursor);
+
+    stats = RollingCoinsStats();
+    stats.hashBlock = pcursor->GetBestBlock();
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            stats.Add(key, coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_COINSTATS_H
+#define BITCOIN_NODE_COINSTATS_H
+
+#include <amount.h>
+#include <coins.h>
+#include <crypto/muhash.h>
+#include <hash.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <cstdint>
+#include <map>
+
+class CCoinsView;
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint256 hashMuHash;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+};
+
+/**
+ * Accumulates the statistics of a UTXO set one coin at a time. Coins must be
+ * added in the order the coins database stores them (grouped by txid), so that
+ * hashSerialized is the same no matter where the coins are read from.
+ */
+class CCoinsStatsBuilder
+{
+public:
+    //! With fMuHash, also compute hashMuHash (which costs a 3072-bit multiplication per coin).
+    explicit CCoinsStatsBuilder(const uint256& hashBlock, bool fMuHash = false);
+
+    void Add(const COutPoint& outpoint, Coin&& coin);
+
+    //! Hash the last transaction and return the result. Call once, after the last Add().
+    const CCoinsStats& Finalize();
+
+private:
+    CCoinsStats m_stats;
+    CHashWriter m_ss;
+    bool m_fMuHash;
+    MuHash3072 m_muhash;
+    uint256 m_prevkey;
+    std::map<uint32_t, Coin> m_outputs;
+};
+
+//! Calculate statistics about the unspent transaction output set. stats.nHeight is left to the caller.
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats, bool fMuHash = false);
+
+/**
+ * UTXO set statistics that are kept up to date while blocks are connected and
+ * disconnected, so they can be reported without scanning the coins database.
+ * The set hash is a MuHash3072 over every unspent output, which does not depend
+ * on the order coins are added and removed in.
+ */
+struct RollingCoinsStats
+{
+    //! The block these statistics describe the UTXO set after
+    uint256 hashBlock;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    RollingCoinsStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void Add(const COutPoint& outpoint, const Coin& coin);
+    void Remove(const COutPoint& outpoint, const Coin& coin);
+
+    //! Fill in the fields of stats that are tracked here.
+    void GetStats(CCoinsStats& stats) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+/** Build the rolling statistics for view from scratch. */
+bool ComputeRollingCoinsStats(CCoinsView* view, RollingCoinsStats& stats);
+
+#endif // BITCOIN_NODE_COINSTATS_H
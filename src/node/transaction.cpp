@@ -18,22 +18,30 @@ TransactionError BroadcastTransaction(const CTransactionRef tx, uint256& hashTx,
     std::promise<void> promise;
     hashTx = tx->GetHash();
 
+    bool fHaveChain = false;
+    bool fHaveMempool;
     { // cs_main scope
     LOCK(cs_main);
     CCoinsViewCache &view = *pcoinsTip;
-    bool fHaveChain = false;
     for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
         const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
         fHaveChain = !existingCoin.IsSpent();
     }
-    bool fHaveMempool = mempool.exists(hashTx);
+    fHaveMempool = mempool.exists(hashTx);
+    } // cs_main
+
+    // AcceptToMemoryPool takes cs_main itself, only while it needs it.
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
         bool fMissingInputs;
         if (!AcceptToMemoryPool(mempool, state, std::move(tx), &fMissingInputs,
                                 nullptr /* plTxnReplaced */, false /* bypass_limits */, highfee)) {
-            if (state.IsInvalid()) {
+            if (state.IsInvalid() && state.GetRejectReason() == "txn-already-in-mempool") {
+                // Accepted concurrently by another caller since the check
+                // above: treat it as already in the mempool.
+                promise.set_value();
+            } else if (state.IsInvalid()) {
                 err_string = FormatStateMessage(state);
                 return TransactionError::MEMPOOL_REJECTED;
             } else {
@@ -61,8 +69,6 @@ TransactionError BroadcastTransaction(const CTransactionRef tx, uint256& hashTx,
         promise.set_value();
     }
 
-    } // cs_main
-
     promise.get_future().wait();
 
     if (!g_connman) {
@@ -0,0 +1,51 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_UTXO_SNAPSHOT_H
+#define BITCOIN_NODE_UTXO_SNAPSHOT_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <cstdint>
+
+/**
+ * Metadata describing a serialized version of a UTXO set, as written by the
+ * dumptxoutset RPC. In the snapshot file it is followed by m_coins_count
+ * (COutPoint, Coin) pairs, in the order the coins database stores them.
+ */
+class SnapshotMetadata
+{
+public:
+    static const uint16_t CURRENT_VERSION = 1;
+
+    uint16_t m_version = CURRENT_VERSION;
+
+    //! The hash of the block that reflects the tip of the chain for the
+    //! UTXO set contained in this snapshot.
+    uint256 m_base_blockhash;
+
+    //! The number of coins in the UTXO set contained in this snapshot.
+    uint64_t m_coins_count = 0;
+
+    //! The number of on-chain transactions up to and including the base block.
+    uint64_t m_nchaintx = 0;
+
+    //! The serialized hash of the UTXO set (hash_serialized_2 in
+    //! gettxoutsetinfo), committing to every coin in the snapshot.
+    uint256 m_hash_serialized;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(m_version);
+        READWRITE(m_base_blockhash);
+        READWRITE(m_coins_count);
+        READWRITE(m_nchaintx);
+        READWRITE(m_hash_serialized);
+    }
+};
+
+#endif // BITCOIN_NODE_UTXO_SNAPSHOT_H
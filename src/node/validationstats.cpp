@@ -0,0 +1,90 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/validationstats.h>
+
+#include <algorithm>
+#include <cassert>
+
+ValidationStats g_validation_stats;
+
+const char* ValidationStageName(ValidationStage stage)
+{
+    switch (stage) {
+    case VALIDATION_STAGE_CHECK: return "check";
+    case VALIDATION_STAGE_FORKS: return "forks";
+    case VALIDATION_STAGE_CONNECT: return "connect";
+    case VALIDATION_STAGE_VERIFY: return "verify";
+    case VALIDATION_STAGE_INDEX: return "index";
+    case VALIDATION_STAGE_CALLBACKS: return "callbacks";
+    case VALIDATION_STAGE_READ: return "read";
+    case VALIDATION_STAGE_PREFETCH: return "prefetch";
+    case VALIDATION_STAGE_CONNECT_TOTAL: return "connect_total";
+    case VALIDATION_STAGE_FLUSH: return "flush";
+    case VALIDATION_STAGE_CHAINSTATE: return "chainstate";
+    case VALIDATION_STAGE_POST_CONNECT: return "post_connect";
+    case VALIDATION_STAGE_TOTAL: return "total";
+    case MAX_VALIDATION_STAGES: break;
+    } // no default case, so the compiler can warn about missing cases
+    assert(false);
+}
+
+LatencyWindow::LatencyWindow(size_t window_size) : m_window_size(window_size)
+{
+    assert(m_window_size > 0);
+}
+
+void LatencyWindow::Add(int64_t micros)
+{
+    if (m_samples.size() < m_window_size) {
+        m_samples.push_back(micros);
+    } else {
+        m_samples[m_next] = micros;
+    }
+    m_next = (m_next + 1) % m_window_size;
+    ++m_count;
+}
+
+LatencySummary LatencyWindow::GetSummary() const
+{
+    LatencySummary summary;
+    summary.count = m_count;
+    summary.window = m_samples.size();
+    if (m_samples.empty()) return summary;
+
+    std::vector<int64_t> sorted(m_samples);
+    std::sort(sorted.begin(), sorted.end());
+    // Nearest-rank percentiles
+    const auto percentile = [&](size_t p) { return sorted[(sorted.size() * p + 99) / 100 - 1]; };
+    summary.min = sorted.front();
+    summary.max = sorted.back();
+    summary.p50 = percentile(50);
+    summary.p90 = percentile(90);
+    summary.p99 = percentile(99);
+
+    int64_t total = 0;
+    for (int64_t micros : sorted) {
+        total += micros;
+        size_t bucket = 0;
+        while (bucket < 62 && (micros >> (bucket + 1)) > 0) ++bucket;
+        if (summary.histogram.size() <= bucket) summary.histogram.resize(bucket + 1);
+        ++summary.histogram[bucket];
+    }
+    summary.mean = total / (int64_t)sorted.size();
+    return summary;
+}
+
+ValidationStats::ValidationStats() : m_windows(MAX_VALIDATION_STAGES, LatencyWindow(VALIDATION_STATS_WINDOW)) {}
+
+void ValidationStats::Add(ValidationStage stage, int64_t micros)
+{
+    LOCK(m_mutex);
+    m_windows[stage].Add(micros);
+}
+
+LatencySummary ValidationStats::GetSummary(ValidationStage stage) const
+{
+    LOCK(m_mutex);
+    return m_windows[stage].GetSummary();
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NODE_VALIDATIONSTATS_H
+#define BITCOIN_NODE_VALIDATIONSTATS_H
+
+#include <sync.h>
+
+#include <cstdint>
+#include <vector>
+
+/** Number of most recent samples kept for each validation stage */
+static const size_t VALIDATION_STATS_WINDOW = 1000;
+
+/** The stages of connecting a block whose latency is recorded. */
+enum ValidationStage {
+    // ConnectBlock
+    VALIDATION_STAGE_CHECK,
+    VALIDATION_STAGE_FORKS,
+    VALIDATION_STAGE_CONNECT,
+    VALIDATION_STAGE_VERIFY,
+    VALIDATION_STAGE_INDEX,
+    VALIDATION_STAGE_CALLBACKS,
+    // ConnectTip
+    VALIDATION_STAGE_READ,
+    VALIDATION_STAGE_PREFETCH,
+    VALIDATION_STAGE_CONNECT_TOTAL,
+    VALIDATION_STAGE_FLUSH,
+    VALIDATION_STAGE_CHAINSTATE,
+    VALIDATION_STAGE_POST_CONNECT,
+    VALIDATION_STAGE_TOTAL,
+    MAX_VALIDATION_STAGES
+};
+
+/** Name of a validation stage, as reported by getvalidationstats */
+const char* ValidationStageName(ValidationStage stage);
+
+/** Summary of the latencies in a LatencyWindow, in microseconds. */
+struct LatencySummary {
+    //! Number of samples added since startup
+    uint64_t count{0};
+    //! Number of samples in the window, which the fields below describe
+    uint64_t window{0};
+    int64_t min{0};
+    int64_t max{0};
+    int64_t mean{0};
+    int64_t p50{0};
+    int64_t p90{0};
+    int64_t p99{0};
+    //! Number of samples in [2^i, 2^(i+1)) microseconds (the first bucket also holds smaller samples)
+    std::vector<uint64_t> histogram;
+};
+
+/** The latencies of the most recent samples of a single stage. */
+class LatencyWindow
+{
+public:
+    explicit LatencyWindow(size_t window_size);
+
+    void Add(int64_t micros);
+    LatencySummary GetSummary() const;
+
+private:
+    const size_t m_window_size;
+    std::vector<int64_t> m_samples;
+    size_t m_next{0};
+    uint64_t m_count{0};
+};
+
+/** Latencies of all validation stages. */
+class ValidationStats
+{
+public:
+    ValidationStats();
+
+    void Add(ValidationStage stage, int64_t micros);
+    LatencySummary GetSummary(ValidationStage stage) const;
+
+private:
+    mutable Mutex m_mutex;
+    std::vector<LatencyWindow> m_windows GUARDED_BY(m_mutex);
+};
+
+extern ValidationStats g_validation_stats;
+
+#endif // BITCOIN_NODE_VALIDATIONSTATS_H
@@ -17,6 +17,10 @@
 #include <index/blockfilterindex.h>
 #include <index/txindex.h>
 #include <key_io.h>
+#include <node/blockcache.h>
+#include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
+#include <node/validationstats.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -112,7 +116,10 @@ UniValue blockheaderToJSON(const CBlockIndex* tip, const CBlockIndex* blockindex
     result.pushKV("bits", strprintf("%08x", blockindex->nBits));
     result.pushKV("difficulty", GetDifficulty(blockindex));
     result.pushKV("chainwork", blockindex->nChainWork.GetHex());
-    result.pushKV("nTx", (uint64_t)blockindex->nTx);
+    // The transaction counts of blocks loaded from a UTXO snapshot are not known.
+    if (!blockindex->IsAssumedValid()) {
+        result.pushKV("nTx", (uint64_t)blockindex->nTx);
+    }
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
@@ -769,7 +776,7 @@ static UniValue getblockheader(const JSONRPCRequest& request)
             "  \"bits\" : \"1d00ffff\", (string) The bits\n"
             "  \"difficulty\" : x.xxx,  (numeric) The difficulty\n"
             "  \"chainwork\" : \"0000...1f3\"     (string) Expected number of hashes required to produce the current chain (in hex)\n"
-            "  \"nTx\" : n,             (numeric) The number of transactions in the block.\n"
+            "  \"nTx\" : n,             (numeric) The number of transactions in the block. Not returned for blocks loaded from a UTXO snapshot.\n"
             "  \"previousblockhash\" : \"hash\",  (string) The hash of the previous block\n"
             "  \"nextblockhash\" : \"hash\",      (string) The hash of the next block\n"
             "}\n"
@@ -813,14 +820,17 @@ static UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(tip, pblockindex);
 }
 
-static CBlock GetBlockChecked(const CBlockIndex* pblockindex)
+static std::shared_ptr<const CBlock> GetBlockChecked(const CBlockIndex* pblockindex)
 {
-    CBlock block;
     if (IsBlockPruned(pblockindex)) {
         throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
     }
+    if (pblockindex->IsAssumedValid() && !(pblockindex->nStatus & BLOCK_HAVE_DATA)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (loaded from a UTXO snapshot)");
+    }
 
-    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus())) {
+    std::shared_ptr<const CBlock> pblock = g_block_cache.GetBlock(pblockindex, Params().GetConsensus());
+    if (!pblock) {
         // Block not found on disk. This could be because we have the block
         // header in our index but don't have the block (for example if a
         // non-whitelisted node sends us an unrequested long chain of valid
@@ -829,7 +839,7 @@ static CBlock GetBlockChecked(const CBlockIndex* pblockindex)
         throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
     }
 
-    return block;
+    return pblock;
 }
 
 static CBlockUndo GetUndoChecked(const CBlockIndex* pblockindex)
@@ -838,6 +848,9 @@ static CBlockUndo GetUndoChecked(const CBlockIndex* pblockindex)
     if (IsBlockPruned(pblockindex)) {
         throw JSONRPCError(RPC_MISC_ERROR, "Undo data not available (pruned data)");
     }
+    if (pblockindex->IsAssumedValid() && !(pblockindex->nStatus & BLOCK_HAVE_UNDO)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Undo data not available (loaded from a UTXO snapshot)");
+    }
 
     if (!UndoReadFromDisk(blockUndo, pblockindex)) {
         throw JSONRPCError(RPC_MISC_ERROR, "Can't read undo data from disk");
@@ -916,7 +929,7 @@ static UniValue getblock(const JSONRPCRequest& request)
             verbosity = request.params[1].get_bool() ? 1 : 0;
     }
 
-    CBlock block;
+    std::shared_ptr<const CBlock> pblock;
     const CBlockIndex* pblockindex;
     const CBlockIndex* tip;
     {
@@ -928,89 +941,18 @@ static UniValue getblock(const JSONRPCRequest& request)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         }
 
-        block = GetBlockChecked(pblockindex);
+        pblock = GetBlockChecked(pblockindex);
     }
 
     if (verbosity <= 0)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
+        ssBlock << *pblock;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
 
-    return blockToJSON(block, tip, pblockindex, verbosity >= 2);
-}
-
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ? 1u : 0u);
-    stats.nTransactions++;
-    for (const auto& output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue, VarIntMode::NONNEGATIVE_SIGNED);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0u);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
+    return blockToJSON(*pblock, tip, pblockindex, verbosity >= 2);
 }
 
 static UniValue pruneblockchain(const JSONRPCRequest& request)
@@ -1068,41 +1010,83 @@ static UniValue pruneblockchain(const JSONRPCRequest& request)
 
 static UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
             RPCHelpMan{"gettxoutsetinfo",
                 "\nReturns statistics about the unspent transaction output set.\n"
-                "Note this call may take some time.\n",
-                {},
+                "Note this call may take some time, unless hash_type is 'muhash' and the node runs with -utxostats.\n",
+                {
+                    {"hash_type", RPCArg::Type::STR, /* default */ "hash_serialized_2", "Which UTXO set hash should be calculated. Options: 'hash_serialized_2' (the legacy algorithm), 'muhash'."},
+                },
                 RPCResult{
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (not available from -utxostats)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (only present if 'hash_serialized_2' hash_type is chosen)\n"
+            "  \"muhash\": \"hash\",      (string) The MuHash3072 of the unspent outputs (only present if 'muhash' hash_type is chosen)\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
                 },
                 RPCExamples{
                     HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
                 },
             }.ToString());
 
+    const std::string hash_type = request.params[0].isNull() ? "hash_serialized_2" : request.params[0].get_str();
+    if (hash_type != "hash_serialized_2" && hash_type != "muhash") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", hash_type));
+    }
+    const bool fMuHash = hash_type == "muhash";
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
+    if (fMuHash) {
+        // With -utxostats the statistics are kept up to date while connecting
+        // blocks, so there is no need to scan the coins database.
+        std::unique_ptr<RollingCoinsStats> rolling;
+        {
+            LOCK(cs_main);
+            if (g_coins_stats) {
+                rolling = MakeUnique<RollingCoinsStats>(*g_coins_stats);
+                stats.nHeight = LookupBlockIndex(rolling->hashBlock)->nHeight;
+            }
+        }
+        if (rolling) {
+            rolling->GetStats(stats);
+            ret.pushKV("height", (int64_t)stats.nHeight);
+            ret.pushKV("bestblock", stats.hashBlock.GetHex());
+            ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+            ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
+            ret.pushKV("muhash", stats.hashMuHash.GetHex());
+            ret.pushKV("disk_size", pcoinsdbview->EstimateSize());
+            ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+            return ret;
+        }
+    }
+
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStats(pcoinsdbview.get(), stats, fMuHash)) {
+        {
+            LOCK(cs_main);
+            stats.nHeight = LookupBlockIndex(stats.hashBlock)->nHeight;
+        }
         ret.pushKV("height", (int64_t)stats.nHeight);
         ret.pushKV("bestblock", stats.hashBlock.GetHex());
         ret.pushKV("transactions", (int64_t)stats.nTransactions);
         ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
         ret.pushKV("bogosize", (int64_t)stats.nBogoSize);
-        ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        if (fMuHash) {
+            ret.pushKV("muhash", stats.hashMuHash.GetHex());
+        } else {
+            ret.pushKV("hash_serialized_2", stats.hashSerialized.GetHex());
+        }
         ret.pushKV("disk_size", stats.nDiskSize);
         ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
     } else {
@@ -1461,11 +1445,11 @@ static UniValue getchaintips(const JSONRPCRequest& request)
     std::set<const CBlockIndex*> setOrphans;
     std::set<const CBlockIndex*> setPrevs;
 
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (const std::pair<const uint256, CBlockIndex>& item : mapBlockIndex)
     {
-        if (!::ChainActive().Contains(item.second)) {
-            setOrphans.insert(item.second);
-            setPrevs.insert(item.second->pprev);
+        if (!::ChainActive().Contains(&item.second)) {
+            setOrphans.insert(&item.second);
+            setPrevs.insert(item.second.pprev);
         }
     }
 
@@ -1738,6 +1722,17 @@ static UniValue getchaintxstats(const JSONRPCRequest& request)
     }
 
     const CBlockIndex* pindexPast = pindex->GetAncestor(pindex->nHeight - blockcount);
+    {
+        // Below the base block of a loaded UTXO snapshot, the counts are placeholders.
+        LOCK(cs_main);
+        const auto is_placeholder = [](const CBlockIndex* index) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+            const CBlockIndex* next = ::ChainActive().Next(index);
+            return index->IsAssumedValid() && next && next->IsAssumedValid();
+        };
+        if (is_placeholder(pindex) || is_placeholder(pindexPast)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Transaction counts are not known below the base block of a loaded UTXO snapshot");
+        }
+    }
     int nTimeDiff = pindex->GetMedianTimePast() - pindexPast->GetMedianTimePast();
     int nTxDiff = pindex->nChainTx - pindexPast->nChainTx;
 
@@ -1757,6 +1752,64 @@ static UniValue getchaintxstats(const JSONRPCRequest& request)
     return ret;
 }
 
+static UniValue getvalidationstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            RPCHelpMan{"getvalidationstats",
+                "\nReturns the latency of the stages of connecting a block, over the most recently connected blocks.\n"
+                "All times are in microseconds.\n",
+                {},
+                RPCResult{
+            "{\n"
+            "  \"stage\": {               (json object) One object for each of check, forks, connect, verify, index,\n"
+            "                                callbacks, read, prefetch, connect_total, flush, chainstate,\n"
+            "                                post_connect and total\n"
+            "    \"count\": xxxxx,         (numeric) Number of samples since startup\n"
+            "    \"window\": xxxxx,        (numeric) Number of most recent samples the fields below describe (at most " + std::to_string(VALIDATION_STATS_WINDOW) + ")\n"
+            "    \"min\": xxxxx,           (numeric) Minimum latency\n"
+            "    \"max\": xxxxx,           (numeric) Maximum latency\n"
+            "    \"mean\": xxxxx,          (numeric) Mean latency\n"
+            "    \"p50\": xxxxx,           (numeric) Median latency\n"
+            "    \"p90\": xxxxx,           (numeric) 90th percentile latency\n"
+            "    \"p99\": xxxxx,           (numeric) 99th percentile latency\n"
+            "    \"histogram\": [          (json array) Number of samples in each bucket. Bucket i holds latencies\n"
+            "      xxxxx,                 of at least 2^i and less than 2^(i+1) (the first bucket also holds 0)\n"
+            "      ...\n"
+            "    ]\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("getvalidationstats", "")
+            + HelpExampleRpc("getvalidationstats", "")
+                },
+            }.ToString());
+
+    UniValue ret(UniValue::VOBJ);
+    for (int i = 0; i < MAX_VALIDATION_STAGES; i++) {
+        const ValidationStage stage = static_cast<ValidationStage>(i);
+        const LatencySummary summary = g_validation_stats.GetSummary(stage);
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("count", summary.count);
+        obj.pushKV("window", summary.window);
+        obj.pushKV("min", summary.min);
+        obj.pushKV("max", summary.max);
+        obj.pushKV("mean", summary.mean);
+        obj.pushKV("p50", summary.p50);
+        obj.pushKV("p90", summary.p90);
+        obj.pushKV("p99", summary.p99);
+        UniValue histogram(UniValue::VARR);
+        for (uint64_t bucket : summary.histogram) {
+            histogram.push_back(bucket);
+        }
+        obj.pushKV("histogram", histogram);
+        ret.pushKV(ValidationStageName(stage), obj);
+    }
+    return ret;
+}
+
 template<typename T>
 static T CalculateTruncatedMedian(std::vector<T>& scores)
 {
@@ -1911,7 +1964,8 @@ static UniValue getblockstats(const JSONRPCRequest& request)
         }
     }
 
-    const CBlock block = GetBlockChecked(pindex);
+    const std::shared_ptr<const CBlock> pblock = GetBlockChecked(pindex);
+    const CBlock& block = *pblock;
     const CBlockUndo blockUndo = GetUndoChecked(pindex);
 
     const bool do_all = stats.size() == 0; // Calculate everything if nothing selected (default)
@@ -2404,12 +2458,174 @@ static UniValue getblockfilter(const JSONRPCRequest& request)
     return ret;
 }
 
+static UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            RPCHelpMan{"dumptxoutset",
+                "\nWrite the UTXO set at the current tip to a snapshot file, which can be loaded by another node with loadtxoutset.\n"
+                "The file commits to the serialized hash of the UTXO set, as reported by gettxoutsetinfo.\n",
+                {
+                    {"path", RPCArg::Type::STR, RPCArg::Optional::NO, "Path to the output file. If relative, will be prefixed by datadir."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"coins_written\": n,          (numeric) The number of coins written to the snapshot\n"
+            "  \"base_hash\": \"hash\",         (string) The hash of the block the snapshot was taken at\n"
+            "  \"base_height\": n,            (numeric) The height of the block the snapshot was taken at\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the UTXO set in the snapshot\n"
+            "  \"path\": \"...\"                (string) The absolute path the snapshot was written to\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("dumptxoutset", "utxo.dat")
+            + HelpExampleRpc("dumptxoutset", "utxo.dat")
+                },
+            }.ToString());
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    // Write to a temporary path first, so that an interrupted dump cannot be
+    // mistaken for a complete one.
+    const fs::path temppath = fs::absolute(request.params[0].get_str() + ".incomplete", GetDataDir());
+    if (fs::exists(path)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists. If you are sure this is what you want, move it out of the way first");
+    }
+
+    CAutoFile afile(fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + temppath.string() + " for writing.");
+    }
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    SnapshotMetadata metadata;
+    int nHeight;
+    {
+        // Hold cs_main so that the coins database is not written to between
+        // flushing the cache and taking the cursor, which iterates over a
+        // consistent snapshot of the database afterwards.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        const CBlockIndex* tip = LookupBlockIndex(pcursor->GetBestBlock());
+        assert(tip);
+        metadata.m_base_blockhash = tip->GetBlockHash();
+        metadata.m_nchaintx = tip->nChainTx;
+        nHeight = tip->nHeight;
+    }
+
+    // The metadata is written again once the number of coins and their hash are known.
+    afile << metadata;
+    CCoinsStatsBuilder builder(metadata.m_base_blockhash);
+    while (pcursor->Valid()) {
+        if (metadata.m_coins_count % 8192 == 0) {
+            boost::this_thread::interruption_point();
+        }
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+        afile << key;
+        afile << coin;
+        builder.Add(key, std::move(coin));
+        metadata.m_coins_count++;
+        pcursor->Next();
+    }
+    metadata.m_hash_serialized = builder.Finalize().hashSerialized;
+
+    if (fseek(afile.Get(), 0, SEEK_SET) != 0) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write snapshot metadata");
+    }
+    afile << metadata;
+    if (!FileCommit(afile.Get())) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write snapshot to disk");
+    }
+    afile.fclose();
+    if (!RenameOver(temppath, path)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + temppath.string() + " to " + path.string());
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_written", (int64_t)metadata.m_coins_count);
+    result.pushKV("base_hash", metadata.m_base_blockhash.GetHex());
+    result.pushKV("base_height", nHeight);
+    result.pushKV("hash_serialized_2", metadata.m_hash_serialized.GetHex());
+    result.pushKV("path", path.string());
+    return result;
+}
+
+static UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 2)
+        throw std::runtime_error(
+            RPCHelpMan{"loadtxoutset",
+                "\nLoad a UTXO set snapshot written by dumptxoutset into this node, and continue syncing from the block it was taken at.\n"
+                "This is only possible before the node has downloaded any block, and after the headers up to the snapshot block are known\n"
+                "(for example by syncing headers from peers, or with submitheader). The snapshot is rejected if its contents do not\n"
+                "match the expected UTXO set hash. Blocks below the snapshot block are treated as pruned, and as their transaction\n"
+                "counts are unknown, getchaintxstats and the verification progress are not accurate for them.\n",
+                {
+                    {"path", RPCArg::Type::STR, RPCArg::Optional::NO, "Path to the snapshot file. If relative, will be prefixed by datadir."},
+                    {"hash_serialized_2", RPCArg::Type::STR_HEX, RPCArg::Optional::NO, "The hash_serialized_2 of the UTXO set at the snapshot block, from a source you trust\n"
+            "                           (such as gettxoutsetinfo on your own node). The hash stored in the snapshot file is not trusted."},
+                },
+                RPCResult{
+            "{\n"
+            "  \"coins_loaded\": n,           (numeric) The number of coins loaded from the snapshot\n"
+            "  \"base_hash\": \"hash\",         (string) The hash of the block the snapshot was taken at, now the chain tip\n"
+            "  \"base_height\": n,            (numeric) The height of the block the snapshot was taken at\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the loaded UTXO set\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("loadtxoutset", "utxo.dat \"hash\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"hash\"")
+                },
+            }.ToString());
+
+    bool fIndexEnabled = g_txindex != nullptr;
+    ForEachBlockFilterIndex([&fIndexEnabled](BlockFilterIndex&) { fIndexEnabled = true; });
+    if (fIndexEnabled) {
+        throw JSONRPCError(RPC_MISC_ERROR, "A UTXO snapshot cannot be loaded while -txindex or -blockfilterindex is enabled");
+    }
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    const uint256 expected_hash_serialized = ParseHashV(request.params[1], "hash_serialized_2");
+    CAutoFile afile(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (afile.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open file " + path.string() + " for reading.");
+    }
+
+    SnapshotMetadata metadata;
+    try {
+        afile >> metadata;
+    } catch (const std::exception& e) {
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("Unable to read snapshot metadata: %s", e.what()));
+    }
+
+    std::string strError;
+    if (!LoadUTXOSnapshot(afile, metadata, expected_hash_serialized, Params(), strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("coins_loaded", (int64_t)metadata.m_coins_count);
+    result.pushKV("base_hash", metadata.m_base_blockhash.GetHex());
+    {
+        LOCK(cs_main);
+        result.pushKV("base_height", LookupBlockIndex(metadata.m_base_blockhash)->nHeight);
+    }
+    result.pushKV("hash_serialized_2", metadata.m_hash_serialized.GetHex());
+    return result;
+}
+
 // clang-format off
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      {} },
     { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"} },
+    { "blockchain",         "getvalidationstats",     &getvalidationstats,     {} },
     { "blockchain",         "getblockstats",          &getblockstats,          {"hash_or_height", "stats"} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
     { "blockchain",         "getblockcount",          &getblockcount,          {} },
@@ -2424,7 +2640,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
@@ -2432,6 +2648,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "preciousblock",          &preciousblock,          {"blockhash"} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           {"action", "scanobjects"} },
     { "blockchain",         "getblockfilter",         &getblockfilter,         {"blockhash", "filtertype"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           {"path", "hash_serialized_2"} },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        {"blockhash"} },
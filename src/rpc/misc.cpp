@@ -8,10 +8,12 @@
 #include <core_io.h>
 #include <crypto/ripemd160.h>
 #include <key_io.h>
+#include <memusage.h>
 #include <validation.h>
 #include <httpserver.h>
 #include <net.h>
 #include <netbase.h>
+#include <node/blockcache.h>
 #include <outputtype.h>
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
@@ -405,6 +407,30 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCBlockIndexMemoryInfo()
+{
+    LOCK(cs_main);
+    const BlockMapMemoryResource* resource = mapBlockIndex.get_allocator().resource();
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("entries", uint64_t(mapBlockIndex.size()));
+    obj.pushKV("usage", uint64_t(memusage::DynamicUsage(mapBlockIndex)));
+    obj.pushKV("free", uint64_t(resource->FreeBytes()));
+    obj.pushKV("chunks", uint64_t(resource->NumAllocatedChunks()));
+    return obj;
+}
+
+static UniValue RPCBlockCacheMemoryInfo()
+{
+    const BlockCache::Stats stats = g_block_cache.GetStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("entries", uint64_t(stats.entries));
+    obj.pushKV("usage", uint64_t(stats.usage));
+    obj.pushKV("limit", uint64_t(stats.max_usage));
+    obj.pushKV("hits", stats.hits);
+    obj.pushKV("misses", stats.misses);
+    return obj;
+}
+
 #ifdef HAVE_MALLOC_INFO
 static std::string RPCMallocInfo()
 {
@@ -448,6 +474,19 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"blockindex\": {           (json object) Information about the memory of the block index\n"
+            "    \"entries\": xxxxx,       (numeric) Number of block index entries\n"
+            "    \"usage\": xxxxx,         (numeric) Number of bytes allocated for the block index, including free memory\n"
+            "    \"free\": xxxxx,          (numeric) Number of allocated bytes not used by entries\n"
+            "    \"chunks\": xxxxx,        (numeric) Number of allocated chunks\n"
+            "  },\n"
+            "  \"blockcache\": {           (json object) Information about the cache of recently read blocks\n"
+            "    \"entries\": xxxxx,       (numeric) Number of cached blocks\n"
+            "    \"usage\": xxxxx,         (numeric) Number of bytes used by the cached blocks\n"
+            "    \"limit\": xxxxx,         (numeric) Maximum number of bytes used by the cached blocks (-blockcachesize)\n"
+            "    \"hits\": xxxxx,          (numeric) Number of block reads served from the cache\n"
+            "    \"misses\": xxxxx,        (numeric) Number of block reads that went to disk\n"
             "  }\n"
             "}\n"
                     },
@@ -465,6 +504,8 @@ static UniValue getmemoryinfo(const JSONRPCRequest& request)
     if (mode == "stats") {
         UniValue obj(UniValue::VOBJ);
         obj.pushKV("locked", RPCLockedMemoryInfo());
+        obj.pushKV("blockindex", RPCBlockIndexMemoryInfo());
+        obj.pushKV("blockcache", RPCBlockCacheMemoryInfo());
         return obj;
     } else if (mode == "mallocinfo") {
 #ifdef HAVE_MALLOC_INFO
@@ -15,6 +15,7 @@
 #include <key_io.h>
 #include <keystore.h>
 #include <merkleblock.h>
+#include <node/blockcache.h>
 #include <node/coin.h>
 #include <node/psbt.h>
 #include <node/transaction.h>
@@ -299,9 +300,10 @@ static UniValue gettxoutproof(const JSONRPCRequest& request)
         }
     }
 
-    CBlock block;
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+    std::shared_ptr<const CBlock> pblock = g_block_cache.GetBlock(pblockindex, Params().GetConsensus());
+    if (!pblock)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     unsigned int ntxFound = 0;
     for (const auto& tx : block.vtx)
@@ -921,12 +923,8 @@ static UniValue testmempoolaccept(const JSONRPCRequest& request)
 
     CValidationState state;
     bool missing_inputs;
-    bool test_accept_res;
-    {
-        LOCK(cs_main);
-        test_accept_res = AcceptToMemoryPool(mempool, state, std::move(tx), &missing_inputs,
-            nullptr /* plTxnReplaced */, false /* bypass_limits */, max_raw_tx_fee, /* test_accept */ true);
-    }
+    bool test_accept_res = AcceptToMemoryPool(mempool, state, std::move(tx), &missing_inputs,
+        nullptr /* plTxnReplaced */, false /* bypass_limits */, max_raw_tx_fee, /* test_accept */ true);
     result_0.pushKV("allowed", test_accept_res);
     if (!test_accept_res) {
         if (state.IsInvalid()) {
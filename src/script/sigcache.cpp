@@ -8,11 +8,11 @@
 #include <memusage.h>
 #include <pubkey.h>
 #include <random.h>
+#include <sync.h>
 #include <uint256.h>
 #include <util/system.h>
 
 #include <cuckoocache.h>
-#include <boost/thread.hpp>
 
 namespace {
 /**
@@ -27,7 +27,8 @@ private:
     uint256 nonce;
     typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
     map_type setValid;
-    boost::shared_mutex cs_sigcache;
+    //! Serializes inserts; lookups do not take it, see CuckooCache::cache
+    Mutex cs_sigcache;
 
 public:
     CSignatureCache()
@@ -44,19 +45,34 @@ public:
     bool
     Get(const uint256& entry, const bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
         return setValid.contains(entry, erase);
     }
 
     void Set(uint256& entry)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        LOCK(cs_sigcache);
         setValid.insert(entry);
     }
     uint32_t setup_bytes(size_t n)
     {
         return setValid.setup_bytes(n);
     }
+
+    std::vector<uint256> GetEntries(uint256& nonce_out)
+    {
+        LOCK(cs_sigcache);
+        nonce_out = nonce;
+        return setValid.get_elements();
+    }
+
+    void LoadEntries(const uint256& nonce_in, const std::vector<uint256>& entries)
+    {
+        LOCK(cs_sigcache);
+        nonce = nonce_in;
+        for (const uint256& entry : entries) {
+            setValid.insert(entry);
+        }
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -80,6 +96,16 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+std::vector<uint256> GetSignatureCacheEntries(uint256& nonce)
+{
+    return signatureCache.GetEntries(nonce);
+}
+
+void LoadSignatureCacheEntries(const uint256& nonce, const std::vector<uint256>& entries)
+{
+    signatureCache.LoadEntries(nonce, entries);
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
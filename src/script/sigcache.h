@@ -52,5 +52,14 @@ public:
 };
 
 void InitSignatureCache();
+/** Return the nonce of the signature cache and the entries in it. */
+std::vector<uint256> GetSignatureCacheEntries(uint256& nonce);
+/**
+ * Switch the signature cache to the given nonce and add entries computed with
+ * it, as returned by GetSignatureCacheEntries before a restart. Entries
+ * computed with the old nonce are no longer found. Only call this before the
+ * cache is used.
+ */
+void LoadSignatureCacheEntries(const uint256& nonce, const std::vector<uint256>& entries);
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -0,0 +1,207 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * A memory resource that carves small, fixed size blocks out of large chunks,
+ * for node based containers that allocate many blocks of the same size.
+ *
+ * Compared to allocating every node separately with operator new this saves
+ * the per allocation bookkeeping of malloc, keeps nodes close together in
+ * memory, and makes allocation and deallocation a few pointer operations.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are rounded up to a multiple of
+ * ELEM_ALIGN_BYTES and served from the chunks. Freed blocks go to a free list
+ * per size and are reused before new chunk memory. Chunks are only returned
+ * when the resource is destroyed. Larger blocks (such as the bucket array of
+ * a hash table) are passed on to operator new.
+ *
+ * Not thread safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    /** Free blocks are linked through their first bytes. */
+    struct ListNode {
+        ListNode* m_next;
+    };
+
+public:
+    /** Alignment and size granularity of pooled blocks. */
+    static constexpr std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static constexpr std::size_t DEFAULT_CHUNK_SIZE_BYTES = 256 * 1024;
+
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "chunks are only aligned to max_align_t");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= sizeof(ListNode), "blocks must be able to hold a free list node");
+
+private:
+    //! Free lists, indexed by block size in units of ELEM_ALIGN_BYTES
+    std::vector<ListNode*> m_free_lists;
+    std::vector<char*> m_chunks;
+    const std::size_t m_chunk_size_bytes;
+    //! Not yet used memory at the end of the newest chunk
+    char* m_available_begin{nullptr};
+    char* m_available_end{nullptr};
+    //! Bytes in the chunks that are not handed out
+    std::size_t m_free_bytes{0};
+
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t num_alignments)
+    {
+        ListNode* node = new (p) ListNode;
+        node->m_next = m_free_lists[num_alignments];
+        m_free_lists[num_alignments] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // Keep the rest of the current chunk around as a free block, so none
+        // of it is lost. It is always a multiple of ELEM_ALIGN_BYTES.
+        const std::size_t remaining = m_available_end - m_available_begin;
+        if (remaining > 0) PushFree(m_available_begin, remaining / ELEM_ALIGN_BYTES);
+
+        char* chunk = static_cast<char*>(::operator new(m_chunk_size_bytes));
+        m_chunks.push_back(chunk);
+        m_available_begin = chunk;
+        m_available_end = chunk + m_chunk_size_bytes;
+        m_free_bytes += m_chunk_size_bytes;
+    }
+
+public:
+    explicit PoolResource(std::size_t chunk_size_bytes = DEFAULT_CHUNK_SIZE_BYTES)
+        : m_free_lists(MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1),
+          m_chunk_size_bytes(chunk_size_bytes / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (char* chunk : m_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            return ::operator new(bytes);
+        }
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+        if (m_free_lists[num_alignments] != nullptr) {
+            ListNode* node = m_free_lists[num_alignments];
+            m_free_lists[num_alignments] = node->m_next;
+            m_free_bytes -= round_bytes;
+            return node;
+        }
+        if (round_bytes > static_cast<std::size_t>(m_available_end - m_available_begin)) {
+            AllocateChunk();
+        }
+        void* p = m_available_begin;
+        m_available_begin += round_bytes;
+        m_free_bytes -= round_bytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        PushFree(p, num_alignments);
+        m_free_bytes += num_alignments * ELEM_ALIGN_BYTES;
+    }
+
+    std::size_t NumAllocatedChunks() const { return m_chunks.size(); }
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+    /** Bytes in the chunks that are free to be handed out again. */
+    std::size_t FreeBytes() const { return m_free_bytes; }
+};
+
+/**
+ * Allocator using a shared PoolResource, usable with the standard node based
+ * containers. A default constructed allocator has no resource and falls back
+ * to operator new, so containers that are not worth pooling (for example short
+ * lived ones) need no resource.
+ *
+ * The resource is shared by all copies of the allocator, so it stays alive as
+ * long as a container (even one it was moved into) may use it.
+ */
+template <typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator() noexcept {}
+    explicit PoolAllocator(std::shared_ptr<ResourceType> resource) noexcept : m_resource(std::move(resource)) {}
+    // No move constructor: a container that is moved from keeps its resource.
+    PoolAllocator(const PoolAllocator& other) noexcept : m_resource(other.m_resource) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.m_resource) {}
+
+    T* allocate(std::size_t n)
+    {
+        if (!m_resource) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if (!m_resource) return ::operator delete(p);
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource.get(); }
+
+private:
+    template <typename U, std::size_t M, std::size_t A>
+    friend class PoolAllocator;
+
+    std::shared_ptr<ResourceType> m_resource;
+};
+
+template <typename T1, typename T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T1, typename T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
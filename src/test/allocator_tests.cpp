@@ -4,10 +4,13 @@
 
 #include <util/system.h>
 
+#include <memusage.h>
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/setup_common.h>
 
 #include <memory>
+#include <unordered_map>
 
 #include <boost/test/unit_test.hpp>
 
@@ -206,6 +209,77 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_mock)
     BOOST_CHECK(pool.stats().used == 0);
 }
 
+BOOST_AUTO_TEST_CASE(poolresource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks are rounded up to the alignment and carved from one chunk.
+    void* a = resource.Allocate(20, 8);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 24);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 48U);
+
+    // Freed blocks are reused for allocations of the same size.
+    resource.Deallocate(a, 20, 8);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 24U);
+    BOOST_CHECK(resource.Allocate(17, 8) == a);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 48U);
+
+    // Allocations that are too large or too strictly aligned are not pooled.
+    void* large = resource.Allocate(65, 8);
+    void* aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 1024U - 48U);
+    resource.Deallocate(large, 65, 8);
+    resource.Deallocate(aligned, 8, 16);
+
+    // A new chunk is only allocated once the current one is used up.
+    for (int i = 0; i < 1024 / 64; ++i) {
+        resource.Allocate(64, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    // The rest of the first chunk is still counted as free.
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 2 * 1024U - 48U - 16 * 64U);
+}
+
+BOOST_AUTO_TEST_CASE(poolallocator_map_tests)
+{
+    typedef PoolAllocator<std::pair<const int, int>, sizeof(std::pair<const int, int>) + sizeof(void*) * 4, alignof(void*)> Allocator;
+    typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator> Map;
+
+    auto resource = std::make_shared<Allocator::ResourceType>();
+    {
+        Map map(0, std::hash<int>(), std::equal_to<int>(), Allocator(resource));
+        for (int i = 0; i < 1000; ++i) {
+            map[i] = i;
+        }
+        BOOST_CHECK_EQUAL(resource->NumAllocatedChunks(), 1U);
+        const size_t free_bytes = resource->FreeBytes();
+        const size_t usage = memusage::DynamicUsage(map);
+        BOOST_CHECK(usage >= resource->ChunkSizeBytes());
+        for (int i = 0; i < 500; ++i) {
+            map.erase(i);
+        }
+        BOOST_CHECK(resource->FreeBytes() > free_bytes);
+        // The pool keeps the memory of the erased nodes.
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+        // Moving the map keeps using (and sharing) the same resource.
+        Map moved(std::move(map));
+        BOOST_CHECK(moved.get_allocator().resource() == resource.get());
+        for (int i = 500; i < 1000; ++i) {
+            BOOST_CHECK_EQUAL(moved.at(i), i);
+        }
+    }
+    BOOST_CHECK_EQUAL(resource.use_count(), 1);
+    BOOST_CHECK_EQUAL(resource->FreeBytes(), resource->ChunkSizeBytes() * resource->NumAllocatedChunks());
+
+    // Without a resource, the allocator uses operator new.
+    Map unpooled;
+    unpooled[1] = 1;
+    BOOST_CHECK(unpooled.get_allocator().resource() == nullptr);
+}
+
 // These tests used the live LockedPoolManager object, this is also used
 // by other tests so the conditions are somewhat less controllable and thus the
 // tests are somewhat more error-prone.
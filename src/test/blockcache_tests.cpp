@@ -0,0 +1,99 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <hash.h>
+#include <node/blockcache.h>
+#include <streams.h>
+#include <validation.h>
+
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(blockcache_hits_and_misses)
+{
+    const CBlockIndex* pindex = WITH_LOCK(cs_main, return ::ChainActive()[50]);
+    const Consensus::Params& consensus = Params().GetConsensus();
+
+    BlockCache cache;
+    cache.SetMaxUsage(1 << 20);
+
+    std::shared_ptr<const CBlock> pblock = cache.GetBlock(pindex, consensus);
+    BOOST_REQUIRE(pblock);
+    BOOST_CHECK_EQUAL(pblock->GetHash(), pindex->GetBlockHash());
+    BOOST_CHECK(cache.GetBlock(pindex, consensus) == pblock);
+
+    // The raw block is read separately and matches the serialized block.
+    uint256 raw_hash;
+    std::shared_ptr<const std::vector<uint8_t>> raw = cache.GetRawBlock(pindex, Params().MessageStart(), raw_hash);
+    BOOST_REQUIRE(raw);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *pblock;
+    BOOST_CHECK(std::vector<uint8_t>(ss.begin(), ss.end()) == *raw);
+    BOOST_CHECK_EQUAL(raw_hash, Hash(raw->begin(), raw->end()));
+    uint256 cached_raw_hash;
+    BOOST_CHECK(cache.GetRawBlock(pindex, Params().MessageStart(), cached_raw_hash) == raw);
+    BOOST_CHECK_EQUAL(cached_raw_hash, raw_hash);
+
+    BlockCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.entries, 1U);
+    BOOST_CHECK_EQUAL(stats.hits, 2U);
+    BOOST_CHECK_EQUAL(stats.misses, 2U);
+    BOOST_CHECK(stats.usage > raw->size());
+    BOOST_CHECK_EQUAL(stats.max_usage, 1U << 20);
+
+    cache.Clear();
+    stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.entries, 0U);
+    BOOST_CHECK_EQUAL(stats.usage, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_eviction)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    std::vector<const CBlockIndex*> indexes;
+    {
+        LOCK(cs_main);
+        for (int height = 1; height <= 10; height++) {
+            indexes.push_back(::ChainActive()[height]);
+        }
+    }
+
+    // A disabled cache keeps nothing.
+    BlockCache cache;
+    BOOST_CHECK(cache.GetBlock(indexes[0], consensus));
+    BOOST_CHECK_EQUAL(cache.GetStats().entries, 0U);
+
+    // Size the cache for about three blocks.
+    cache.SetMaxUsage(1 << 20);
+    cache.GetBlock(indexes[0], consensus);
+    const size_t block_usage = cache.GetStats().usage;
+    cache.SetMaxUsage(block_usage * 3 + block_usage / 2);
+
+    for (const CBlockIndex* pindex : indexes) {
+        BOOST_CHECK(cache.GetBlock(pindex, consensus));
+        // Keep using the first block, so it is never evicted.
+        BOOST_CHECK(cache.GetBlock(indexes[0], consensus));
+    }
+    BlockCache::Stats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.entries, 3U);
+    BOOST_CHECK(stats.usage <= stats.max_usage);
+
+    const uint64_t hits = stats.hits;
+    cache.GetBlock(indexes[0], consensus);
+    cache.GetBlock(indexes[9], consensus);
+    cache.GetBlock(indexes[8], consensus);
+    BOOST_CHECK_EQUAL(cache.GetStats().hits, hits + 3);
+    cache.GetBlock(indexes[7], consensus);
+    BOOST_CHECK_EQUAL(cache.GetStats().hits, hits + 3);
+
+    // Lowering the limit evicts the least recently used blocks.
+    cache.SetMaxUsage(block_usage);
+    BOOST_CHECK_EQUAL(cache.GetStats().entries, 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <key.h>
+#include <script/script.h>
+#include <script/interpreter.h>
+#include <streams.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <test/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blocktxoffsets_tests, TestChain100Setup)
+
+static std::vector<CMutableTransaction> CreateSpends(const std::vector<CTransactionRef>& coinbase_txns, const CKey& key, size_t count)
+{
+    CScript script_pub_key = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> spends(count);
+    for (size_t i = 0; i < count; ++i) {
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout = COutPoint(coinbase_txns[i]->GetHash(), 0);
+        // Outputs of different sizes, so the transactions are not all the same size
+        spends[i].vout.resize(1 + i);
+        for (CTxOut& out : spends[i].vout) {
+            out.nValue = CENT;
+            out.scriptPubKey = script_pub_key;
+        }
+        std::vector<unsigned char> sig;
+        uint256 hash = SignatureHash(script_pub_key, spends[i], 0, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(key.Sign(hash, sig));
+        sig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << sig;
+    }
+    return spends;
+}
+
+BOOST_AUTO_TEST_CASE(blocktxoffsets_serialization)
+{
+    CScript script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = CreateAndProcessBlock(CreateSpends(m_coinbase_txns, coinbaseKey, 3), script_pub_key);
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), 4U);
+
+    CBlockTxOffsets offsets(block);
+    BOOST_REQUIRE_EQUAL(offsets.short_txids.size(), block.vtx.size());
+    BOOST_REQUIRE_EQUAL(offsets.tx_sizes.size(), block.vtx.size());
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << offsets;
+    CBlockTxOffsets read;
+    ss >> read;
+    BOOST_CHECK(read.short_txids == offsets.short_txids);
+    BOOST_CHECK(read.tx_sizes == offsets.tx_sizes);
+
+    // Each transaction is found at its offset in the serialized block.
+    CDataStream block_stream(SER_DISK, CLIENT_VERSION);
+    block_stream << block;
+    const std::vector<unsigned char> block_data(block_stream.begin(), block_stream.end());
+    uint64_t offset = offsets.GetFirstTxOffset();
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        BOOST_CHECK_EQUAL(offsets.short_txids[i], CBlockTxOffsets::ShortTxid(block.vtx[i]->GetHash()));
+        CTransactionRef tx;
+        VectorReader(SER_DISK, CLIENT_VERSION, block_data, offset, tx);
+        BOOST_CHECK_EQUAL(tx->GetHash(), block.vtx[i]->GetHash());
+        offset += offsets.tx_sizes[i];
+    }
+    BOOST_CHECK_EQUAL(offset, block_data.size());
+}
+
+BOOST_AUTO_TEST_CASE(blocktxoffsets_get_transaction)
+{
+    CScript script_pub_key = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const CBlock block_without = CreateAndProcessBlock(CreateSpends(m_coinbase_txns, coinbaseKey, 1), script_pub_key);
+    fBlockTxOffsets = true;
+    std::vector<CTransactionRef> coinbase_txns(m_coinbase_txns.begin() + 1, m_coinbase_txns.end());
+    const CBlock block_with = CreateAndProcessBlock(CreateSpends(coinbase_txns, coinbaseKey, 3), script_pub_key);
+    fBlockTxOffsets = false;
+
+    const Consensus::Params& consensus = Params().GetConsensus();
+    const auto check_transactions = [&] {
+        // Transactions are found whether or not their block has a table.
+        for (const CBlock* block : {&block_without, &block_with}) {
+            const CBlockIndex* pindex = WITH_LOCK(cs_main, return LookupBlockIndex(block->GetHash()));
+            BOOST_REQUIRE(pindex);
+            for (const auto& block_tx : block->vtx) {
+                CTransactionRef tx;
+                uint256 hash_block;
+                BOOST_CHECK(GetTransaction(block_tx->GetHash(), tx, consensus, hash_block, pindex));
+                BOOST_CHECK_EQUAL(tx->GetHash(), block_tx->GetHash());
+                BOOST_CHECK_EQUAL(hash_block, block->GetHash());
+            }
+            CTransactionRef tx;
+            uint256 hash_block;
+            BOOST_CHECK(!GetTransaction(m_coinbase_txns[0]->GetHash(), tx, consensus, hash_block, pindex));
+        }
+    };
+
+    // The tables are kept in memory until the block index is written.
+    CBlockTxOffsets offsets;
+    BOOST_CHECK(!pblocktree->ReadBlockTxOffsets(block_with.GetHash(), offsets));
+    check_transactions();
+    FlushStateToDisk();
+    BOOST_CHECK(!pblocktree->ReadBlockTxOffsets(block_without.GetHash(), offsets));
+    BOOST_CHECK(pblocktree->ReadBlockTxOffsets(block_with.GetHash(), offsets));
+    check_transactions();
+
+    // Pruning a block's file drops its table.
+    fBlockTxOffsets = true;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindex = LookupBlockIndex(block_with.GetHash());
+        PruneOneBlockFile(pindex->nFile);
+    }
+    fBlockTxOffsets = false;
+    BOOST_CHECK(!pblocktree->ReadBlockTxOffsets(block_with.GetHash(), offsets));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
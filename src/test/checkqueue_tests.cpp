@@ -135,20 +135,17 @@ std::atomic<size_t> FakeCheckCheckCompletion::n_calls{0};
 std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
 
 // Queue Typedefs
-typedef CCheckQueue<FakeCheckCheckCompletion> Correct_Queue;
 typedef CCheckQueue<FakeCheck> Standard_Queue;
-typedef CCheckQueue<FailingCheck> Failing_Queue;
-typedef CCheckQueue<UniqueCheck> Unique_Queue;
-typedef CCheckQueue<MemoryCheck> Memory_Queue;
-typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
 
+// The tests below run against both CCheckQueue and CWorkStealingCheckQueue.
 
 /** This test case checks that the CCheckQueue works properly
  * with each specified size_t Checks pushed.
  */
+template <template <typename> class Queue>
 static void Correct_Queue_range(std::vector<size_t> range)
 {
-    auto small_queue = MakeUnique<Correct_Queue>(QUEUE_BATCH_SIZE);
+    auto small_queue = MakeUnique<Queue<FakeCheckCheckCompletion>>(QUEUE_BATCH_SIZE);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{small_queue->Thread();});
@@ -158,7 +155,7 @@ static void Correct_Queue_range(std::vector<size_t> range)
     for (const size_t i : range) {
         size_t total = i;
         FakeCheckCheckCompletion::n_calls = 0;
-        CCheckQueueControl<FakeCheckCheckCompletion> control(small_queue.get());
+        CCheckQueueControl<FakeCheckCheckCompletion, Queue<FakeCheckCheckCompletion>> control(small_queue.get());
         while (total) {
             vChecks.resize(std::min(total, (size_t) InsecureRandRange(10)));
             total -= vChecks.size();
@@ -179,7 +176,8 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Zero)
 {
     std::vector<size_t> range;
     range.push_back((size_t)0);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 /** Test that 1 check is correct
  */
@@ -187,7 +185,8 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_One)
 {
     std::vector<size_t> range;
     range.push_back((size_t)1);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 /** Test that MAX check is correct
  */
@@ -195,7 +194,8 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Max)
 {
     std::vector<size_t> range;
     range.push_back(100000);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 /** Test that random numbers of checks are correct
  */
@@ -205,14 +205,16 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random)
     range.reserve(100000/1000);
     for (size_t i = 2; i < 100000; i += std::max((size_t)1, (size_t)InsecureRandRange(std::min((size_t)1000, ((size_t)100000) - i))))
         range.push_back(i);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 
 
 /** Test that failing checks are caught */
-BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
+template <template <typename> class Queue>
+static void CheckQueue_Catches_Failure()
 {
-    auto fail_queue = MakeUnique<Failing_Queue>(QUEUE_BATCH_SIZE);
+    auto fail_queue = MakeUnique<Queue<FailingCheck>>(QUEUE_BATCH_SIZE);
 
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
@@ -220,7 +222,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
     }
 
     for (size_t i = 0; i < 1001; ++i) {
-        CCheckQueueControl<FailingCheck> control(fail_queue.get());
+        CCheckQueueControl<FailingCheck, Queue<FailingCheck>> control(fail_queue.get());
         size_t remaining = i;
         while (remaining) {
             size_t r = InsecureRandRange(10);
@@ -241,11 +243,17 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
     tg.interrupt_all();
     tg.join_all();
 }
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
+{
+    CheckQueue_Catches_Failure<CCheckQueue>();
+    CheckQueue_Catches_Failure<CWorkStealingCheckQueue>();
+}
 // Test that a block validation which fails does not interfere with
 // future blocks, ie, the bad state is cleared.
-BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
+template <template <typename> class Queue>
+static void CheckQueue_Recovers_From_Failure()
 {
-    auto fail_queue = MakeUnique<Failing_Queue>(QUEUE_BATCH_SIZE);
+    auto fail_queue = MakeUnique<Queue<FailingCheck>>(QUEUE_BATCH_SIZE);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{fail_queue->Thread();});
@@ -253,7 +261,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
 
     for (auto times = 0; times < 10; ++times) {
         for (const bool end_fails : {true, false}) {
-            CCheckQueueControl<FailingCheck> control(fail_queue.get());
+            CCheckQueueControl<FailingCheck, Queue<FailingCheck>> control(fail_queue.get());
             {
                 std::vector<FailingCheck> vChecks;
                 vChecks.resize(100, false);
@@ -267,23 +275,30 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
     tg.interrupt_all();
     tg.join_all();
 }
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
+{
+    CheckQueue_Recovers_From_Failure<CCheckQueue>();
+    CheckQueue_Recovers_From_Failure<CWorkStealingCheckQueue>();
+}
 
 // Test that unique checks are actually all called individually, rather than
 // just one check being called repeatedly. Test that checks are not called
 // more than once as well
-BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
+template <template <typename> class Queue>
+static void CheckQueue_UniqueCheck()
 {
-    auto queue = MakeUnique<Unique_Queue>(QUEUE_BATCH_SIZE);
+    auto queue = MakeUnique<Queue<UniqueCheck>>(QUEUE_BATCH_SIZE);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{queue->Thread();});
 
     }
 
+    UniqueCheck::results.clear();
     size_t COUNT = 100000;
     size_t total = COUNT;
     {
-        CCheckQueueControl<UniqueCheck> control(queue.get());
+        CCheckQueueControl<UniqueCheck, Queue<UniqueCheck>> control(queue.get());
         while (total) {
             size_t r = InsecureRandRange(10);
             std::vector<UniqueCheck> vChecks;
@@ -300,6 +315,11 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
     tg.interrupt_all();
     tg.join_all();
 }
+BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
+{
+    CheckQueue_UniqueCheck<CCheckQueue>();
+    CheckQueue_UniqueCheck<CWorkStealingCheckQueue>();
+}
 
 
 // Test that blocks which might allocate lots of memory free their memory aggressively.
@@ -307,9 +327,10 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
 // This test attempts to catch a pathological case where by lazily freeing
 // checks might mean leaving a check un-swapped out, and decreasing by 1 each
 // time could leave the data hanging across a sequence of blocks.
-BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
+template <template <typename> class Queue>
+static void CheckQueue_Memory()
 {
-    auto queue = MakeUnique<Memory_Queue>(QUEUE_BATCH_SIZE);
+    auto queue = MakeUnique<Queue<MemoryCheck>>(QUEUE_BATCH_SIZE);
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{queue->Thread();});
@@ -317,7 +338,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
     for (size_t i = 0; i < 1000; ++i) {
         size_t total = i;
         {
-            CCheckQueueControl<MemoryCheck> control(queue.get());
+            CCheckQueueControl<MemoryCheck, Queue<MemoryCheck>> control(queue.get());
             while (total) {
                 size_t r = InsecureRandRange(10);
                 std::vector<MemoryCheck> vChecks;
@@ -335,19 +356,25 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
     tg.interrupt_all();
     tg.join_all();
 }
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
+{
+    CheckQueue_Memory<CCheckQueue>();
+    CheckQueue_Memory<CWorkStealingCheckQueue>();
+}
 
 // Test that a new verification cannot occur until all checks
 // have been destructed
-BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
+template <template <typename> class Queue>
+static void CheckQueue_FrozenCleanup()
 {
-    auto queue = MakeUnique<FrozenCleanup_Queue>(QUEUE_BATCH_SIZE);
+    auto queue = MakeUnique<Queue<FrozenCleanupCheck>>(QUEUE_BATCH_SIZE);
     boost::thread_group tg;
     bool fails = false;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
         tg.create_thread([&]{queue->Thread();});
     }
     std::thread t0([&]() {
-        CCheckQueueControl<FrozenCleanupCheck> control(queue.get());
+        CCheckQueueControl<FrozenCleanupCheck, Queue<FrozenCleanupCheck>> control(queue.get());
         std::vector<FrozenCleanupCheck> vChecks(1);
         // Freezing can't be the default initialized behavior given how the queue
         // swaps in default initialized Checks (otherwise freezing destructor
@@ -379,6 +406,11 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
     tg.join_all();
     BOOST_REQUIRE(!fails);
 }
+BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
+{
+    CheckQueue_FrozenCleanup<CCheckQueue>();
+    CheckQueue_FrozenCleanup<CWorkStealingCheckQueue>();
+}
 
 
 /** Test that CCheckQueueControl is threadsafe */
@@ -7,8 +7,10 @@
 #include <consensus/validation.h>
 #include <script/standard.h>
 #include <test/setup_common.h>
+#include <txdb.h>
 #include <uint256.h>
 #include <undo.h>
+#include <util/memory.h>
 #include <util/strencodings.h>
 #include <validation.h>
 
@@ -58,7 +60,7 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coin;
+                map_[it->first] = it->second.coin.Expand();
                 if (it->second.coin.IsSpent() && InsecureRandRange(3) == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
@@ -256,6 +258,93 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(uncached_an_entry);
 }
 
+// A randomized simulation of -partialflush: blocks are connected on a
+// short-lived cache that is flushed into a long-lived one, which is
+// periodically synced to the base while keeping its entries, and trimmed.
+BOOST_AUTO_TEST_CASE(coins_cache_sync_simulation_test)
+{
+    bool synced_a_cache = false;
+    bool trimmed_an_entry = false;
+    bool found_an_entry = false;
+    bool missed_an_entry = false;
+
+    std::map<COutPoint, Coin> result;
+    CCoinsViewTest base;
+    CCoinsViewCacheTest tip(&base);
+
+    std::vector<uint256> txids;
+    txids.resize(NUM_SIMULATION_ITERATIONS / 8);
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        txids[i] = InsecureRand256();
+    }
+
+    std::unique_ptr<CCoinsViewCacheTest> block_view = MakeUnique<CCoinsViewCacheTest>(&tip);
+    for (unsigned int i = 0; i < NUM_SIMULATION_ITERATIONS; i++) {
+        const COutPoint outpoint(txids[InsecureRandRange(txids.size())], 0);
+        Coin& coin = result[outpoint];
+        BOOST_CHECK(coin == block_view->AccessCoin(outpoint));
+        if (coin.IsSpent() || InsecureRandRange(5) == 0) {
+            Coin newcoin;
+            newcoin.out.nValue = InsecureRand32();
+            newcoin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+            newcoin.nHeight = 1;
+            coin = newcoin;
+            block_view->AddCoin(outpoint, std::move(newcoin), true);
+        } else {
+            coin.Clear();
+            BOOST_CHECK(block_view->SpendCoin(outpoint));
+        }
+
+        // Every 20 iterations, end the block.
+        if (InsecureRandRange(20) == 0) {
+            BOOST_CHECK(block_view->Flush());
+            block_view = MakeUnique<CCoinsViewCacheTest>(&tip);
+        }
+
+        // Every 500 iterations, write the tip cache and evict from it.
+        if (InsecureRandRange(500) == 0) {
+            BOOST_CHECK(block_view->Flush());
+            BOOST_CHECK(tip.Sync());
+            synced_a_cache = true;
+            for (const auto& entry : tip.map()) {
+                BOOST_CHECK(!(entry.second.flags & CCoinsCacheEntry::DIRTY));
+            }
+            const size_t cache_size = tip.GetCacheSize();
+            tip.Trim(tip.DynamicMemoryUsage() / 2);
+            trimmed_an_entry |= tip.GetCacheSize() < cache_size;
+            tip.SelfTest();
+        }
+
+        // Once every 1000 iterations and at the end, verify the full cache.
+        if (InsecureRandRange(1000) == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
+            for (const auto& entry : result) {
+                const Coin& coin = block_view->AccessCoin(entry.first);
+                BOOST_CHECK(coin == entry.second);
+                (coin.IsSpent() ? missed_an_entry : found_an_entry) = true;
+            }
+            block_view->SelfTest();
+            tip.SelfTest();
+        }
+    }
+
+    // Everything synced to the base matches as well.
+    BOOST_CHECK(block_view->Flush());
+    BOOST_CHECK(tip.Sync());
+    for (const auto& entry : result) {
+        Coin coin;
+        if (base.GetCoin(entry.first, coin)) {
+            BOOST_CHECK(coin == entry.second);
+        } else {
+            BOOST_CHECK(entry.second.IsSpent());
+        }
+    }
+
+    BOOST_CHECK(synced_a_cache);
+    BOOST_CHECK(trimmed_an_entry);
+    BOOST_CHECK(found_an_entry);
+    BOOST_CHECK(missed_an_entry);
+}
+
 // Store of all necessary tx and undo data for next test
 typedef std::map<COutPoint, std::tuple<CTransaction,CTxUndo,Coin>> UtxoData;
 UtxoData utxoData;
@@ -528,6 +617,55 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_compact)
+{
+    const uint160 hash = uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"));
+    std::vector<CScript> scripts;
+    scripts.push_back(GetScriptForDestination(PKHash(hash)));
+    scripts.push_back(GetScriptForDestination(ScriptHash(hash)));
+    scripts.push_back(GetScriptForDestination(WitnessV0KeyHash(hash)));
+    scripts.push_back(GetScriptForDestination(WitnessV0ScriptHash(uint256S("ab"))));
+    scripts.push_back(CScript());
+    scripts.push_back(CScript() << OP_TRUE);
+    scripts.push_back(CScript() << std::vector<unsigned char>(19, 1)); // 20 bytes, the largest inline script
+    scripts.push_back(CScript() << std::vector<unsigned char>(20, 1));
+    // Almost, but not quite, a P2PKH script
+    scripts.push_back(CScript() << OP_DUP << OP_HASH160 << ToByteVector(hash) << OP_EQUALVERIFY << OP_CHECKSIGVERIFY);
+
+    BOOST_CHECK(sizeof(CompactCoin) < sizeof(Coin));
+    BOOST_CHECK(sizeof(CCoinsCacheEntry) < sizeof(Coin));
+    for (size_t i = 0; i < scripts.size(); ++i) {
+        const CScript& script = scripts[i];
+        const Coin coin(CTxOut(123456, script), 654321, true);
+        CompactCoin compact(coin);
+        BOOST_CHECK(!compact.IsSpent());
+        BOOST_CHECK(compact.Expand() == coin);
+        // Only scripts that are neither templates nor short need an allocation
+        BOOST_CHECK_EQUAL(compact.DynamicMemoryUsage() > 0, i >= 3 && script.size() > 20);
+
+        // Serializes exactly like the Coin it represents
+        CDataStream ss_coin(SER_DISK, CLIENT_VERSION), ss_compact(SER_DISK, CLIENT_VERSION);
+        ss_coin << coin;
+        ss_compact << compact;
+        BOOST_CHECK(ss_coin.str() == ss_compact.str());
+
+        CompactCoin copy(compact);
+        BOOST_CHECK(copy.Expand() == coin);
+        CompactCoin moved(std::move(copy));
+        BOOST_CHECK(moved.Expand() == coin);
+        BOOST_CHECK(copy.IsSpent());
+        copy = moved;
+        BOOST_CHECK(copy.Expand() == coin);
+        moved.Clear();
+        BOOST_CHECK(moved.IsSpent());
+        BOOST_CHECK_EQUAL(moved.DynamicMemoryUsage(), 0U);
+        BOOST_CHECK(copy.Expand() == coin);
+    }
+
+    BOOST_CHECK(CompactCoin().IsSpent());
+    BOOST_CHECK(CompactCoin(Coin()).IsSpent());
+}
+
 const static COutPoint OUTPOINT;
 const static CAmount PRUNED = -1;
 const static CAmount ABSENT = -2;
@@ -562,9 +700,10 @@ static size_t InsertCoinsMapEntry(CCoinsMap& map, CAmount value, char flags)
         return 0;
     }
     assert(flags != NO_ENTRY);
-    CCoinsCacheEntry entry;
+    Coin coin;
+    SetCoinsValue(value, coin);
+    CCoinsCacheEntry entry(coin);
     entry.flags = flags;
-    SetCoinsValue(value, entry.coin);
     auto inserted = map.emplace(OUTPOINT, std::move(entry));
     assert(inserted.second);
     return inserted.first->second.coin.DynamicMemoryUsage();
@@ -580,7 +719,7 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
         if (it->second.coin.IsSpent()) {
             value = PRUNED;
         } else {
-            value = it->second.coin.out.nValue;
+            value = it->second.coin.Expand().out.nValue;
         }
         flags = it->second.flags;
         assert(flags != NO_ENTRY);
@@ -773,6 +912,77 @@ BOOST_AUTO_TEST_CASE(ccoins_add)
     CheckAddCoin(VALUE2, VALUE3, VALUE3, DIRTY|FRESH, DIRTY|FRESH, true );
 }
 
+static void CheckEmplaceCoin(CAmount cache_value, CAmount emplace_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+
+    Coin coin;
+    SetCoinsValue(emplace_value, coin);
+    test.cache.EmplaceCoinFromBase(OUTPOINT, std::move(coin));
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_emplace)
+{
+    /* Check EmplaceCoinFromBase behavior, inserting a prefetched coin into a
+     * cache view and checking that existing entries always take precedence
+     * and that new entries are never marked as modified.
+     *
+     *               Cache   Emplace Result  Cache        Result
+     *               Value   Value   Value   Flags        Flags
+     */
+    CheckEmplaceCoin(ABSENT, PRUNED, ABSENT, NO_ENTRY   , NO_ENTRY   );
+    CheckEmplaceCoin(ABSENT, VALUE3, VALUE3, NO_ENTRY   , 0          );
+    CheckEmplaceCoin(PRUNED, VALUE3, PRUNED, 0          , 0          );
+    CheckEmplaceCoin(PRUNED, VALUE3, PRUNED, FRESH      , FRESH      );
+    CheckEmplaceCoin(PRUNED, VALUE3, PRUNED, DIRTY      , DIRTY      );
+    CheckEmplaceCoin(PRUNED, VALUE3, PRUNED, DIRTY|FRESH, DIRTY|FRESH);
+    CheckEmplaceCoin(VALUE2, VALUE3, VALUE2, 0          , 0          );
+    CheckEmplaceCoin(VALUE2, VALUE3, VALUE2, FRESH      , FRESH      );
+    CheckEmplaceCoin(VALUE2, VALUE3, VALUE2, DIRTY      , DIRTY      );
+    CheckEmplaceCoin(VALUE2, VALUE3, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
+}
+
+static void CheckEmplaceSpentCoin(CAmount cache_value, CAmount expected_value, char cache_flags, char expected_flags)
+{
+    SingleEntryCacheTest test(ABSENT, cache_value, cache_flags);
+
+    test.cache.EmplaceSpentCoinFromBase(OUTPOINT);
+    test.cache.SelfTest();
+
+    CAmount result_value;
+    char result_flags;
+    GetCoinsMapEntry(test.cache.map(), result_value, result_flags);
+    BOOST_CHECK_EQUAL(result_value, expected_value);
+    BOOST_CHECK_EQUAL(result_flags, expected_flags);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_emplace_spent)
+{
+    /* Check EmplaceSpentCoinFromBase behavior, recording an outpoint found
+     * missing from the backing view, and checking that existing entries always
+     * take precedence and that new entries are never marked as modified.
+     *
+     *                    Cache   Result  Cache        Result
+     *                    Value   Value   Flags        Flags
+     */
+    CheckEmplaceSpentCoin(ABSENT, PRUNED, NO_ENTRY   , 0          );
+    CheckEmplaceSpentCoin(PRUNED, PRUNED, 0          , 0          );
+    CheckEmplaceSpentCoin(PRUNED, PRUNED, FRESH      , FRESH      );
+    CheckEmplaceSpentCoin(PRUNED, PRUNED, DIRTY      , DIRTY      );
+    CheckEmplaceSpentCoin(PRUNED, PRUNED, DIRTY|FRESH, DIRTY|FRESH);
+    CheckEmplaceSpentCoin(VALUE2, VALUE2, 0          , 0          );
+    CheckEmplaceSpentCoin(VALUE2, VALUE2, FRESH      , FRESH      );
+    CheckEmplaceSpentCoin(VALUE2, VALUE2, DIRTY      , DIRTY      );
+    CheckEmplaceSpentCoin(VALUE2, VALUE2, DIRTY|FRESH, DIRTY|FRESH);
+}
+
 void CheckWriteCoins(CAmount parent_value, CAmount child_value, CAmount expected_value, char parent_flags, char child_flags, char expected_flags)
 {
     SingleEntryCacheTest test(ABSENT, parent_value, parent_flags);
@@ -858,4 +1068,163 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    const Coin coin(CTxOut(1, CScript() << OP_TRUE), 1, false);
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 4; ++i) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(outpoints.back(), Coin(coin), false);
+    }
+    const uint256 block = InsecureRand256();
+    cache.SetBestBlock(block);
+
+    // Syncing writes the coins to the base, but keeps them cached as
+    // unmodified entries. Spent coins are dropped.
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(base.GetBestBlock() == block);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(base.HaveCoin(outpoint));
+        BOOST_CHECK_EQUAL(cache.map().at(outpoint).flags, 0);
+    }
+    BOOST_CHECK(cache.SpendCoin(outpoints[3]));
+    BOOST_CHECK(cache.Sync());
+    Coin read;
+    BOOST_CHECK(!base.GetCoin(outpoints[3], read) || read.IsSpent());
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[3]));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 3U);
+    cache.SelfTest();
+
+    // Trimming evicts the least recently used coins first.
+    cache.AccessCoin(outpoints[0]);
+    cache.Trim(cache.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]));
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[1]));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[2]));
+    cache.SelfTest();
+
+    // Modified coins are never evicted.
+    const COutPoint added(InsecureRand256(), 0);
+    cache.AddCoin(added, Coin(coin), false);
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(added));
+    cache.SelfTest();
+
+    // Evicted coins are read back from the base.
+    BOOST_CHECK(cache.HaveCoin(outpoints[1]));
+
+    // Among many coins, exactly the least recently used ones are evicted.
+    std::vector<COutPoint> many;
+    for (uint32_t i = 0; i < 200; ++i) {
+        many.emplace_back(InsecureRand256(), i);
+        cache.AddCoin(many.back(), Coin(coin), false);
+    }
+    BOOST_CHECK(cache.Sync());
+    for (const COutPoint& outpoint : many) {
+        cache.AccessCoin(outpoint);
+    }
+    cache.Trim(cache.DynamicMemoryUsage() / 2);
+    size_t first_kept = 0;
+    while (first_kept < many.size() && !cache.HaveCoinInCache(many[first_kept])) ++first_kept;
+    BOOST_CHECK(first_kept > 0 && first_kept < many.size());
+    for (size_t i = first_kept; i < many.size(); ++i) {
+        BOOST_CHECK(cache.HaveCoinInCache(many[i]));
+    }
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_reserve)
+{
+    CCoinsViewTest base;
+    const Coin coin(CTxOut(1, CScript() << OP_TRUE), 1, false);
+
+    // Views allocate their entries one by one unless they reserve a pool.
+    CCoinsViewCacheTest view(&base);
+    BOOST_CHECK(view.map().get_allocator().resource() == nullptr);
+    view.AddCoin(COutPoint(InsecureRand256(), 0), Coin(coin), false);
+    BOOST_CHECK_EQUAL(view.UsedDynamicMemoryUsage(), view.DynamicMemoryUsage());
+
+    CCoinsViewCacheTest cache(&base);
+    cache.ReserveCache(1 << 20);
+    BOOST_CHECK(cache.map().get_allocator().resource() != nullptr);
+    BOOST_CHECK(cache.map().bucket_count() >= (1 << 20) / 128);
+    const size_t empty_usage = cache.DynamicMemoryUsage();
+    for (int i = 0; i < 1000; ++i) {
+        cache.AddCoin(COutPoint(InsecureRand256(), 0), Coin(coin), false);
+    }
+    BOOST_CHECK(cache.Sync());
+    const size_t usage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(usage > empty_usage);
+
+    // The pool keeps the memory of evicted entries, which is reused first.
+    const size_t used = cache.UsedDynamicMemoryUsage();
+    BOOST_CHECK(used > empty_usage && used < usage);
+    const size_t target = used - (used - empty_usage) / 2;
+    cache.Trim(target);
+    BOOST_CHECK(cache.GetCacheSize() > 0 && cache.GetCacheSize() < 1000);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), usage);
+    BOOST_CHECK(cache.UsedDynamicMemoryUsage() <= target);
+
+    // Flushing returns the pool and keeps the reservation.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(cache.map().get_allocator().resource() != nullptr);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), empty_usage);
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_db_background_write)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache cache(&db);
+    const Coin coin(CTxOut(1, CScript() << OP_TRUE), 1, false);
+    const COutPoint spent(InsecureRand256(), 0), kept(InsecureRand256(), 1), added(InsecureRand256(), 2);
+
+    const uint256 block1 = InsecureRand256();
+    cache.AddCoin(spent, Coin(coin), false);
+    cache.AddCoin(kept, Coin(coin), false);
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.GetBestBlock() == block1);
+
+    // Hand the next flush to the background writer. The database reflects
+    // it right away, whether or not the write has completed.
+    const uint256 block2 = InsecureRand256();
+    BOOST_CHECK(cache.SpendCoin(spent));
+    cache.AddCoin(added, Coin(coin), false);
+    cache.SetBestBlock(block2);
+    db.RequestBackgroundWrite();
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    BOOST_CHECK(!db.HaveCoin(spent));
+    BOOST_CHECK(db.HaveCoin(kept));
+    BOOST_CHECK(db.HaveCoin(added));
+
+    BOOST_CHECK(db.WaitForBackgroundWrite());
+    BOOST_CHECK(db.GetBestBlock() == block2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    Coin read;
+    BOOST_CHECK(!db.GetCoin(spent, read));
+    BOOST_CHECK(db.GetCoin(added, read) && read.out == coin.out);
+
+    // A synchronous write waits for a pending background write.
+    const uint256 block3 = InsecureRand256();
+    BOOST_CHECK(cache.SpendCoin(kept));
+    cache.SetBestBlock(block3);
+    db.RequestBackgroundWrite();
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(cache.SpendCoin(added));
+    cache.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache.Flush());
+    size_t coins = 0;
+    std::unique_ptr<CCoinsViewCursor> cursor(db.Cursor());
+    for (; cursor->Valid(); cursor->Next()) ++coins;
+    BOOST_CHECK_EQUAL(coins, 0U);
+    BOOST_CHECK(cursor->GetBestBlock() == cache.GetBestBlock());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
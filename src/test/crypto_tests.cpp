@@ -8,11 +8,13 @@
 #include <crypto/hkdf_sha256_32.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <crypto/ripemd160.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
 #include <random.h>
+#include <streams.h>
 #include <util/strencodings.h>
 #include <test/setup_common.h>
 
@@ -623,4 +625,83 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+static std::vector<unsigned char> MuHashElement(int i)
+{
+    std::vector<unsigned char> element(32 + i % 7);
+    for (size_t j = 0; j < element.size(); ++j) {
+        element[j] = (unsigned char)(i * 31 + j);
+    }
+    return element;
+}
+
+static uint256 MuHashFinal(const MuHash3072& muhash)
+{
+    uint256 out;
+    muhash.Finalize(out);
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    const uint256 empty = MuHashFinal(MuHash3072());
+
+    // The set hash does not depend on the insertion order.
+    MuHash3072 forward, backward;
+    for (int i = 0; i < 10; ++i) {
+        std::vector<unsigned char> element = MuHashElement(i);
+        forward.Insert(Span<const unsigned char>(element.data(), element.size()));
+    }
+    for (int i = 9; i >= 0; --i) {
+        std::vector<unsigned char> element = MuHashElement(i);
+        backward.Insert(Span<const unsigned char>(element.data(), element.size()));
+    }
+    const uint256 full = MuHashFinal(forward);
+    BOOST_CHECK(full != empty);
+    BOOST_CHECK(MuHashFinal(backward) == full);
+
+    // Removing elements again, in any order, gets back to the smaller set.
+    MuHash3072 partial;
+    for (int i = 0; i < 5; ++i) {
+        std::vector<unsigned char> element = MuHashElement(i);
+        partial.Insert(Span<const unsigned char>(element.data(), element.size()));
+    }
+    for (int i = 9; i >= 5; --i) {
+        std::vector<unsigned char> element = MuHashElement(i);
+        backward.Remove(Span<const unsigned char>(element.data(), element.size()));
+    }
+    BOOST_CHECK(MuHashFinal(backward) == MuHashFinal(partial));
+
+    // Combining and dividing whole sets.
+    MuHash3072 rest;
+    for (int i = 5; i < 10; ++i) {
+        std::vector<unsigned char> element = MuHashElement(i);
+        rest.Insert(Span<const unsigned char>(element.data(), element.size()));
+    }
+    MuHash3072 combined = partial;
+    combined *= rest;
+    BOOST_CHECK(MuHashFinal(combined) == full);
+    combined /= partial;
+    BOOST_CHECK(MuHashFinal(combined) == MuHashFinal(rest));
+    combined /= rest;
+    BOOST_CHECK(MuHashFinal(combined) == empty);
+
+    // Serialization keeps pending removals.
+    CDataStream ss(SER_DISK, 0);
+    ss << backward;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 restored;
+    ss >> restored;
+    BOOST_CHECK(MuHashFinal(restored) == MuHashFinal(partial));
+
+    // A number times its inverse is one.
+    unsigned char data[Num3072::BYTE_SIZE];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = InsecureRandBits(8);
+    }
+    Num3072 num(data), inv(data), one;
+    inv.Inverse();
+    num.Multiply(inv);
+    BOOST_CHECK(memcmp(num.limbs, one.limbs, sizeof(one.limbs)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
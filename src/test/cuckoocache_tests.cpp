@@ -266,6 +266,62 @@ BOOST_AUTO_TEST_CASE(cuckoocache_erase_parallel_ok)
     test_cache_erase_parallel<CuckooCache::cache<uint256, SignatureCacheHasher>>(megabytes);
 }
 
+/** This helper checks that lookups without a lock, running while elements are
+ * inserted, never find elements that were not inserted, and that the cache
+ * holds all elements once the inserts are done.
+ */
+template <typename Cache>
+static void test_cache_contains_during_insert(size_t megabytes)
+{
+    double load = 0.4;
+    SeedInsecureRand(true);
+    Cache set{};
+    size_t bytes = megabytes * (1 << 20);
+    set.setup_bytes(bytes);
+    uint32_t n_insert = static_cast<uint32_t>(load * (bytes / sizeof(uint256)));
+    std::vector<uint256> hashes(n_insert);
+    std::vector<uint256> fakes(n_insert / 4);
+    for (uint256& h : hashes)
+        h = InsecureRand256();
+    for (uint256& h : fakes)
+        h = InsecureRand256();
+
+    /** Insert the first half before the readers start */
+    for (uint32_t i = 0; i < (n_insert / 2); ++i)
+        set.insert(hashes[i]);
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> fake_hits{0};
+    std::vector<std::thread> threads;
+    for (uint32_t x = 0; x < 3; ++x)
+        threads.emplace_back([&] {
+            do {
+                for (const uint256& h : fakes)
+                    fake_hits += set.contains(h, false);
+                for (uint32_t i = 0; i < (n_insert / 2); ++i)
+                    set.contains(hashes[i], false);
+            } while (!done);
+        });
+
+    /** Insert the second half while the readers run */
+    for (uint32_t i = (n_insert / 2); i < n_insert; ++i)
+        set.insert(hashes[i]);
+    done = true;
+    for (std::thread& t : threads)
+        t.join();
+
+    BOOST_CHECK_EQUAL(fake_hits, 0U);
+    size_t count = 0;
+    for (const uint256& h : hashes)
+        count += set.contains(h, false);
+    BOOST_CHECK_EQUAL(count, n_insert);
+}
+BOOST_AUTO_TEST_CASE(cuckoocache_contains_during_insert_ok)
+{
+    size_t megabytes = 1;
+    test_cache_contains_during_insert<CuckooCache::cache<uint256, SignatureCacheHasher>>(megabytes);
+}
+
 
 template <typename Cache>
 static void test_cache_generations()
@@ -4,6 +4,10 @@
 
 #include <flatfile.h>
 #include <test/setup_common.h>
+#include <util/time.h>
+
+#include <atomic>
+#include <thread>
 
 #include <boost/test/unit_test.hpp>
 
@@ -120,4 +124,70 @@ BOOST_AUTO_TEST_CASE(flatfile_flush)
     BOOST_CHECK_EQUAL(fs::file_size(seq.FileName(FlatFilePos(0, 1))), 1);
 }
 
+BOOST_AUTO_TEST_CASE(flatfile_map_cache)
+{
+    auto data_dir = SetDataDir("flatfile_test");
+    FlatFileSeq seq(data_dir, "a", 100);
+
+    for (int n = 0; n < 3; ++n) {
+        CAutoFile file(seq.Open(FlatFilePos(n, 0)), SER_DISK, CLIENT_VERSION);
+        file << (uint32_t)n;
+    }
+
+    FlatFileMapCache maps(2);
+    std::shared_ptr<const MappedFile> map0 = maps.Map(seq, 0);
+    BOOST_REQUIRE(map0);
+    BOOST_CHECK_EQUAL(map0->size(), 4U);
+    BOOST_CHECK_EQUAL(map0->data()[0], 0);
+    BOOST_CHECK(maps.Map(seq, 0) == map0);
+    BOOST_CHECK(!maps.Map(seq, 3));
+
+    // The least recently used mapping is evicted when the pool is full.
+    BOOST_REQUIRE(maps.Map(seq, 1));
+    BOOST_REQUIRE(maps.Map(seq, 0));
+    std::shared_ptr<const MappedFile> map2 = maps.Map(seq, 2);
+    BOOST_REQUIRE(map2);
+    BOOST_CHECK_EQUAL(map2->data()[0], 2);
+    BOOST_CHECK_EQUAL(maps.Size(), 2U);
+    BOOST_CHECK(maps.Map(seq, 0) == map0);
+    BOOST_CHECK(maps.Map(seq, 1) != nullptr);
+    BOOST_CHECK_EQUAL(maps.Size(), 2U);
+
+    // Mapping an invalidated file shows what was written to it since, while
+    // its old mapping stays valid for readers holding it.
+    {
+        CAutoFile file(seq.Open(FlatFilePos(0, 4)), SER_DISK, CLIENT_VERSION);
+        file << (uint32_t)5;
+    }
+    maps.Invalidate(0);
+    std::shared_ptr<const MappedFile> remapped0 = maps.Map(seq, 0);
+    BOOST_REQUIRE(remapped0);
+    BOOST_CHECK(remapped0 != map0);
+    BOOST_CHECK_EQUAL(remapped0->size(), 8U);
+    BOOST_CHECK_EQUAL(remapped0->data()[4], 5);
+    BOOST_CHECK_EQUAL(map0->size(), 4U);
+    BOOST_CHECK_EQUAL(map0->data()[0], 0);
+
+    // Releasing a file waits until no reader holds a mapping of it.
+    std::atomic<bool> released{false};
+    std::thread release_thread([&] {
+        maps.Release(0);
+        released = true;
+    });
+    MilliSleep(10);
+    BOOST_CHECK(!released);
+    map0.reset();
+    BOOST_CHECK(!released);
+    remapped0.reset();
+    release_thread.join();
+    BOOST_CHECK(released);
+    BOOST_CHECK_EQUAL(maps.Size(), 1U);
+
+    maps.Clear();
+    BOOST_CHECK_EQUAL(maps.Size(), 0U);
+
+    FlatFileMapCache disabled(0);
+    BOOST_CHECK(!disabled.Map(seq, 0));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <serialize.h>
 #include <streams.h>
 #include <net.h>
+#include <netmessagemaker.h>
 #include <netbase.h>
 #include <chainparams.h>
 #include <util/system.h>
@@ -302,5 +303,29 @@ BOOST_AUTO_TEST_CASE(LocalAddress_BasicLifecycle)
     BOOST_CHECK_EQUAL(IsLocal(addr), false);
 }
 
+BOOST_AUTO_TEST_CASE(push_shared_message)
+{
+    CConnman connman(0x1337, 0x1337);
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+    const CNetMsgMaker msg_maker(PROTOCOL_VERSION);
+
+    // A message with a shared payload is queued exactly like one with the
+    // same payload owned by the message, but without copying the payload.
+    auto payload = std::make_shared<const std::vector<unsigned char>>(1000, 0x42);
+    connman.PushMessage(&node, msg_maker.Make(NetMsgType::BLOCK, MakeSpan(*payload)));
+    connman.PushMessage(&node, msg_maker.MakeShared(NetMsgType::BLOCK, payload, Hash(payload->begin(), payload->end())));
+
+    LOCK(node.cs_vSend);
+    BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 4U);
+    const CSendBuffer& owned_header = node.vSendMsg[0];
+    const CSendBuffer& shared_header = node.vSendMsg[2];
+    BOOST_REQUIRE_EQUAL(owned_header.size(), shared_header.size());
+    BOOST_CHECK(std::equal(owned_header.data(), owned_header.data() + owned_header.size(), shared_header.data()));
+    BOOST_CHECK(node.vSendMsg[1].data() != payload->data());
+    BOOST_CHECK(node.vSendMsg[3].data() == payload->data());
+    BOOST_CHECK_EQUAL(node.vSendMsg[3].size(), payload->size());
+    BOOST_CHECK_EQUAL(node.nSendSize, 2 * (CMessageHeader::HEADER_SIZE + payload->size()));
+}
 
 BOOST_AUTO_TEST_SUITE_END()
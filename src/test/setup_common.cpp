@@ -95,6 +95,13 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
     nScriptCheckThreads = 3;
     for (int i = 0; i < nScriptCheckThreads - 1; i++)
         threadGroup.create_thread([i]() { return ThreadScriptCheck(i); });
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread([i]() { return ThreadBlockCheck(i); });
+    threadGroup.create_thread(&ThreadBlockRead);
+
+    nCoinsPrefetchThreads = 2;
+    for (int i = 0; i < nCoinsPrefetchThreads; i++)
+        threadGroup.create_thread([i]() { return ThreadCoinsPrefetch(i); });
 
     g_banman = MakeUnique<BanMan>(GetDataDir() / "banlist.dat", nullptr, DEFAULT_MISBEHAVING_BANTIME);
     g_connman = MakeUnique<CConnman>(0x1337, 0x1337); // Deterministic randomness for tests.
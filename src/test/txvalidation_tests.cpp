@@ -7,9 +7,13 @@
 #include <amount.h>
 #include <consensus/validation.h>
 #include <primitives/transaction.h>
+#include <script/interpreter.h>
 #include <script/script.h>
 #include <test/setup_common.h>
 
+#include <atomic>
+#include <thread>
+
 #include <boost/test/unit_test.hpp>
 
 
@@ -55,4 +59,75 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_reject_coinbase, TestChain100Setup)
     BOOST_CHECK(state.GetReason() == ValidationInvalidReason::CONSENSUS);
 }
 
+/**
+ * Ensure that transactions accepted from several threads, without cs_main
+ * held, all end up in the mempool, and that of two conflicting ones exactly
+ * one does.
+ */
+BOOST_FIXTURE_TEST_CASE(tx_mempool_accept_concurrent, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const size_t num_spends = 40;
+    const int num_threads = 4;
+
+    auto sign = [&](CMutableTransaction& tx, size_t n) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, n, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[n].scriptSig = CScript() << vchSig;
+    };
+
+    CMutableTransaction funding;
+    funding.nVersion = 1;
+    funding.vin.resize(1);
+    funding.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    funding.vout.resize(num_spends);
+    for (CTxOut& out : funding.vout) {
+        out.nValue = CENT;
+        out.scriptPubKey = scriptPubKey;
+    }
+    sign(funding, 0);
+    CreateAndProcessBlock({funding}, scriptPubKey);
+
+    // Two conflicting spends of each output, neither signalling replacement.
+    std::vector<CTransactionRef> spends;
+    for (size_t i = 0; i < num_spends; ++i) {
+        for (CAmount fee : {1000, 2000}) {
+            CMutableTransaction spend;
+            spend.nVersion = 1;
+            spend.vin.resize(1);
+            spend.vin[0].prevout = COutPoint(funding.GetHash(), i);
+            spend.vout.resize(1);
+            spend.vout[0].nValue = CENT - fee;
+            spend.vout[0].scriptPubKey = scriptPubKey;
+            sign(spend, 0);
+            spends.push_back(MakeTransactionRef(spend));
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::atomic<int> accepted{0};
+    for (int t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&, t] {
+            for (size_t i = t; i < spends.size(); i += num_threads) {
+                CValidationState state;
+                if (AcceptToMemoryPool(mempool, state, spends[i], nullptr /* pfMissingInputs */,
+                        nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */)) {
+                    ++accepted;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    BOOST_CHECK_EQUAL(accepted, (int)num_spends);
+    BOOST_CHECK_EQUAL(mempool.size(), num_spends);
+    for (size_t i = 0; i < num_spends; ++i) {
+        BOOST_CHECK(mempool.exists(spends[2 * i]->GetHash()) != mempool.exists(spends[2 * i + 1]->GetHash()));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <pubkey.h>
 #include <txmempool.h>
 #include <random.h>
+#include <script/sigcache.h>
 #include <script/standard.h>
 #include <script/sign.h>
 #include <test/setup_common.h>
@@ -379,4 +380,132 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(mempool_parallel_script_checks, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const unsigned int n_inputs = MIN_PARALLEL_MEMPOOL_SCRIPT_CHECK_INPUTS + 4;
+
+    // Split a mature coinbase into enough outputs for a large transaction.
+    CMutableTransaction funding;
+    funding.nVersion = 1;
+    funding.vin.resize(1);
+    funding.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    funding.vout.resize(n_inputs);
+    for (CTxOut& out : funding.vout) {
+        out.nValue = 11*CENT;
+        out.scriptPubKey = scriptPubKey;
+    }
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, funding, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    funding.vin[0].scriptSig << vchSig;
+    CreateAndProcessBlock({funding}, scriptPubKey);
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(n_inputs);
+    for (unsigned int i = 0; i < n_inputs; ++i) {
+        spend.vin[i].prevout = COutPoint(funding.GetHash(), i);
+    }
+    spend.vout.resize(1);
+    spend.vout[0].nValue = n_inputs * 10*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < n_inputs; ++i) {
+        vchSig.clear();
+        hash = SignatureHash(scriptPubKey, spend, i, SIGHASH_ALL, 0, SigVersion::BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spend.vin[i].scriptSig << vchSig;
+    }
+
+    // A bad signature is reported the same way with and without script check
+    // threads.
+    CMutableTransaction invalid_spend(spend);
+    vchSig.clear();
+    BOOST_CHECK(coinbaseKey.Sign(uint256(), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    invalid_spend.vin[n_inputs / 2].scriptSig = CScript() << vchSig;
+    const CTransactionRef invalid_tx = MakeTransactionRef(invalid_spend);
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    std::string reject_reason[2];
+    for (int serial = 0; serial < 2; ++serial) {
+        const int threads = nScriptCheckThreads;
+        if (serial) nScriptCheckThreads = 0;
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, invalid_tx, nullptr, nullptr, true, 0));
+        nScriptCheckThreads = threads;
+        BOOST_CHECK(state.GetReason() == ValidationInvalidReason::CONSENSUS);
+        reject_reason[serial] = state.GetRejectReason();
+    }
+    BOOST_CHECK_EQUAL(reject_reason[0], reject_reason[1]);
+
+    BOOST_CHECK(ToMemPool(spend));
+    BOOST_CHECK(mempool.exists(spend.GetHash()));
+}
+
+BOOST_FIXTURE_TEST_CASE(script_caches_persist, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(m_coinbase_txns[0]->GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SigVersion::BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    const CTransaction tx(spend);
+
+    LOCK(cs_main);
+    PrecomputedTransactionData txdata(tx);
+    CValidationState state;
+    BOOST_CHECK(CheckInputs(tx, state, pcoinsTip.get(), true, SCRIPT_VERIFY_P2SH, true, true, txdata, nullptr));
+
+    uint256 sig_nonce;
+    const std::vector<uint256> sig_entries = GetSignatureCacheEntries(sig_nonce);
+    BOOST_CHECK_EQUAL(sig_entries.size(), 1U);
+    BOOST_CHECK(DumpScriptCaches());
+
+    // Emptied caches miss...
+    InitSignatureCache();
+    InitScriptExecutionCache();
+    uint256 nonce;
+    BOOST_CHECK(GetSignatureCacheEntries(nonce).empty());
+    std::vector<CScriptCheck> scriptchecks;
+    BOOST_CHECK(CheckInputs(tx, state, pcoinsTip.get(), true, SCRIPT_VERIFY_P2SH, true, true, txdata, &scriptchecks));
+    BOOST_CHECK_EQUAL(scriptchecks.size(), tx.vin.size());
+
+    // ... and hit again once reloaded.
+    BOOST_CHECK(LoadScriptCaches());
+    BOOST_CHECK(GetSignatureCacheEntries(nonce) == sig_entries);
+    BOOST_CHECK(nonce == sig_nonce);
+    scriptchecks.clear();
+    BOOST_CHECK(CheckInputs(tx, state, pcoinsTip.get(), true, SCRIPT_VERIFY_P2SH, true, true, txdata, &scriptchecks));
+    BOOST_CHECK(scriptchecks.empty());
+
+    // A damaged file is discarded.
+    BOOST_CHECK(DumpScriptCaches());
+    const fs::path path = GetDataDir() / "sigcache.dat";
+    {
+        FILE* file = fsbridge::fopen(path, "r+b");
+        BOOST_REQUIRE(file);
+        BOOST_CHECK_EQUAL(fseek(file, -40, SEEK_END), 0);
+        const int c = fgetc(file);
+        BOOST_CHECK_EQUAL(fseek(file, -40, SEEK_END), 0);
+        BOOST_CHECK_EQUAL(fputc(c ^ 0xff, file), c ^ 0xff);
+        fclose(file);
+    }
+    InitSignatureCache();
+    BOOST_CHECK(!LoadScriptCaches());
+    BOOST_CHECK(GetSignatureCacheEntries(nonce).empty());
+    BOOST_CHECK(!fs::exists(path));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <sync.h>
 #include <test/util.h>
 #include <util/strencodings.h>
+#include <util/mmap.h>
 #include <util/moneystr.h>
 #include <test/setup_common.h>
 
@@ -1479,6 +1480,35 @@ BOOST_AUTO_TEST_CASE(test_DirIsWritable)
     fs::remove(tmpdirname);
 }
 
+BOOST_AUTO_TEST_CASE(test_MappedFile)
+{
+    fs::path dirname = SetDataDir("test_MappedFile");
+    MappedFile file;
+    BOOST_CHECK(!file.Open(dirname / "missing"));
+    BOOST_CHECK(!file.IsOpen());
+
+    fs::path filename = dirname / "file";
+    FILE* f = fsbridge::fopen(filename, "wb");
+    BOOST_CHECK(f != nullptr);
+    fclose(f);
+    BOOST_CHECK(file.Open(filename));
+    BOOST_CHECK(file.IsOpen());
+    BOOST_CHECK_EQUAL(file.size(), 0U);
+
+    const std::string content = "mapped file content";
+    f = fsbridge::fopen(filename, "wb");
+    BOOST_CHECK_EQUAL(fwrite(content.data(), 1, content.size(), f), content.size());
+    fclose(f);
+    BOOST_CHECK(file.Open(filename));
+    BOOST_CHECK_EQUAL(std::string((const char*)file.data(), file.size()), content);
+
+    file.Close();
+    BOOST_CHECK(!file.IsOpen());
+    BOOST_CHECK(file.data() == nullptr);
+    BOOST_CHECK_EQUAL(file.size(), 0U);
+    fs::remove_all(dirname);
+}
+
 BOOST_AUTO_TEST_CASE(test_ToLower)
 {
     BOOST_CHECK_EQUAL(ToLower('@'), '@');
@@ -185,4 +185,132 @@ BOOST_AUTO_TEST_CASE(processnewblock_signals_ordering)
     BOOST_CHECK_EQUAL(sub.m_expected_tip, ::ChainActive().Tip()->GetBlockHash());
 }
 
+BOOST_AUTO_TEST_CASE(precheckblock_matches_checkblock)
+{
+    auto pblock = Block(Params().GenesisBlock().GetHash());
+    for (int i = 0; i < 500; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(1, CScript() << OP_TRUE);
+        pblock->vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    FinalizeBlock(pblock);
+
+    CValidationState state;
+    BOOST_CHECK(PreCheckBlock(*pblock, state, Params().GetConsensus()));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(!pblock->fChecked);
+
+    // A transaction with duplicate inputs is reported as by CheckBlock.
+    CMutableTransaction dup_inputs(*pblock->vtx[250]);
+    dup_inputs.vin.push_back(dup_inputs.vin[0]);
+    pblock->vtx[250] = MakeTransactionRef(std::move(dup_inputs));
+    FinalizeBlock(pblock);
+
+    CValidationState pre_state;
+    BOOST_CHECK(!PreCheckBlock(*pblock, pre_state, Params().GetConsensus()));
+    CValidationState check_state;
+    BOOST_CHECK(!CheckBlock(*pblock, check_state, Params().GetConsensus()));
+    BOOST_CHECK_EQUAL(pre_state.GetRejectReason(), "bad-txns-inputs-duplicate");
+    BOOST_CHECK_EQUAL(pre_state.GetDebugMessage(), check_state.GetDebugMessage());
+    BOOST_CHECK(!pblock->fChecked);
+
+    // The legacy sigops of all transactions are summed up.
+    CScript half_sigops;
+    for (unsigned int i = 0; i < MAX_BLOCK_SIGOPS_COST / WITNESS_SCALE_FACTOR / 2; i++) {
+        half_sigops << OP_CHECKSIG;
+    }
+    for (int i = 250; i < 252; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(1, half_sigops);
+        pblock->vtx[i] = MakeTransactionRef(std::move(tx));
+    }
+    FinalizeBlock(pblock);
+    BOOST_CHECK(PreCheckBlock(*pblock, state, Params().GetConsensus()));
+
+    CMutableTransaction one_more(*pblock->vtx[252]);
+    one_more.vout[0].scriptPubKey = CScript() << OP_CHECKSIG;
+    pblock->vtx[252] = MakeTransactionRef(std::move(one_more));
+    FinalizeBlock(pblock);
+    BOOST_CHECK(!PreCheckBlock(*pblock, state, Params().GetConsensus()));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-blk-sigops");
+}
+
+BOOST_AUTO_TEST_CASE(processnewblockheaders_batch)
+{
+    // A run of headers, half as long as a full headers message.
+    std::vector<CBlockHeader> headers;
+    uint256 prev_hash = Params().GenesisBlock().GetHash();
+    uint32_t time = Params().GenesisBlock().nTime;
+    for (int i = 0; i < 1000; i++) {
+        CBlockHeader header;
+        header.nVersion = 4;
+        header.hashPrevBlock = prev_hash;
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = ++time;
+        header.nBits = Params().GenesisBlock().nBits;
+        while (!CheckProofOfWork(header.GetHash(), header.nBits, Params().GetConsensus())) {
+            ++header.nNonce;
+        }
+        prev_hash = header.GetHash();
+        headers.push_back(header);
+    }
+
+    // The headers before one with invalid proof of work are accepted.
+    std::vector<CBlockHeader> bad_headers(headers);
+    while (CheckProofOfWork(bad_headers[700].GetHash(), bad_headers[700].nBits, Params().GetConsensus())) {
+        ++bad_headers[700].nNonce;
+    }
+    CValidationState state;
+    CBlockHeader first_invalid;
+    const CBlockIndex* pindex = nullptr;
+    BOOST_CHECK(!ProcessNewBlockHeaders(bad_headers, state, Params(), &pindex, &first_invalid));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    BOOST_CHECK_EQUAL(first_invalid.GetHash(), bad_headers[700].GetHash());
+    BOOST_CHECK_EQUAL(pindex->GetBlockHash(), headers[699].GetHash());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(LookupBlockIndex(headers[699].GetHash()) != nullptr);
+        BOOST_CHECK(LookupBlockIndex(headers[700].GetHash()) == nullptr);
+    }
+
+    CValidationState valid_state;
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, valid_state, Params(), &pindex, &first_invalid));
+    BOOST_CHECK(first_invalid.IsNull());
+    BOOST_CHECK_EQUAL(pindex->GetBlockHash(), headers.back().GetHash());
+    BOOST_CHECK_EQUAL(pindex->nHeight, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(activatebestchain_reads_ahead)
+{
+    // Connect a chain of blocks one at a time.
+    const int num_blocks = 20;
+    std::vector<std::shared_ptr<const CBlock>> blocks;
+    uint256 prev_hash = WITH_LOCK(cs_main, return ::ChainActive().Tip()->GetBlockHash());
+    for (int i = 0; i < num_blocks; i++) {
+        blocks.push_back(GoodBlock(prev_hash));
+        prev_hash = blocks.back()->GetHash();
+        BOOST_CHECK(ProcessNewBlock(Params(), blocks.back(), true, nullptr));
+    }
+    CBlockIndex* first = WITH_LOCK(cs_main, return LookupBlockIndex(blocks.front()->GetHash()));
+
+    // Disconnect them and connect them again from disk. Every step of
+    // ActivateBestChain connects one block, as each adds chain work, so all
+    // blocks but the first were read while the blocks before them were being
+    // connected.
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), first));
+    uint64_t read_ahead;
+    {
+        LOCK(cs_main);
+        ResetBlockFailureFlags(first);
+        read_ahead = GetBlocksReadAhead();
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(::ChainActive().Tip()->GetBlockHash(), blocks.back()->GetHash());
+    BOOST_CHECK_EQUAL(GetBlocksReadAhead() - read_ahead, (uint64_t)num_blocks - 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
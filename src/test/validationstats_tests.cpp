@@ -0,0 +1,66 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <node/validationstats.h>
+
+#include <test/setup_common.h>
+
+#include <set>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationstats_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(latency_window_summary)
+{
+    LatencyWindow window(100);
+    LatencySummary summary = window.GetSummary();
+    BOOST_CHECK_EQUAL(summary.count, 0U);
+    BOOST_CHECK_EQUAL(summary.window, 0U);
+    BOOST_CHECK(summary.histogram.empty());
+
+    // Samples 1..100 in reverse order.
+    for (int64_t i = 100; i >= 1; i--) {
+        window.Add(i);
+    }
+    summary = window.GetSummary();
+    BOOST_CHECK_EQUAL(summary.count, 100U);
+    BOOST_CHECK_EQUAL(summary.window, 100U);
+    BOOST_CHECK_EQUAL(summary.min, 1);
+    BOOST_CHECK_EQUAL(summary.max, 100);
+    BOOST_CHECK_EQUAL(summary.mean, 50);
+    BOOST_CHECK_EQUAL(summary.p50, 50);
+    BOOST_CHECK_EQUAL(summary.p90, 90);
+    BOOST_CHECK_EQUAL(summary.p99, 99);
+    // [1, 2), [2, 4), ... [64, 128)
+    const std::vector<uint64_t> expected{1, 2, 4, 8, 16, 32, 37};
+    BOOST_CHECK(summary.histogram == expected);
+
+    // Older samples leave the window, but are still counted.
+    for (int i = 0; i < 100; i++) {
+        window.Add(i < 50 ? 0 : 1000);
+    }
+    summary = window.GetSummary();
+    BOOST_CHECK_EQUAL(summary.count, 200U);
+    BOOST_CHECK_EQUAL(summary.window, 100U);
+    BOOST_CHECK_EQUAL(summary.min, 0);
+    BOOST_CHECK_EQUAL(summary.max, 1000);
+    BOOST_CHECK_EQUAL(summary.p50, 0);
+    BOOST_CHECK_EQUAL(summary.p90, 1000);
+    BOOST_CHECK_EQUAL(summary.histogram.size(), 10U);
+    BOOST_CHECK_EQUAL(summary.histogram[0], 50U);
+    BOOST_CHECK_EQUAL(summary.histogram[9], 50U);
+}
+
+BOOST_AUTO_TEST_CASE(validation_stage_names)
+{
+    std::set<std::string> names;
+    for (int i = 0; i < MAX_VALIDATION_STAGES; i++) {
+        names.insert(ValidationStageName(static_cast<ValidationStage>(i)));
+    }
+    BOOST_CHECK_EQUAL(names.size(), (size_t)MAX_VALIDATION_STAGES);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,15 +6,23 @@
 #include <txdb.h>
 
 #include <chainparams.h>
+#include <clientversion.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
 #include <hash.h>
 #include <random.h>
 #include <pow.h>
 #include <shutdown.h>
+#include <streams.h>
 #include <uint256.h>
+#include <util/memory.h>
+#include <util/mmap.h>
 #include <util/system.h>
 #include <ui_interface.h>
 
+#include <functional>
 #include <stdint.h>
+#include <string.h>
 
 #include <boost/thread.hpp>
 
@@ -28,6 +36,17 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_COINS_STATS = 'S';
+static const char DB_BLOCK_INDEX_SNAPSHOT = 'I';
+static const char DB_BLOCK_TX_OFFSETS = 'O';
+
+/** Block index snapshot layout: a header (magic, version, snapshot id, best
+ *  block of the coins database, number of entries), fixed size entries and the
+ *  SHA256 of all entries. */
+static const unsigned char BLOCK_INDEX_SNAPSHOT_MAGIC[4] = {'b', 'i', 'd', 'x'};
+static const uint32_t BLOCK_INDEX_SNAPSHOT_VERSION = 3;
+static const size_t BLOCK_INDEX_SNAPSHOT_HEADER_SIZE = 4 + 4 + 32 + 32 + 32 + 8;
+static const size_t BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE = 3 * 32 + 10 * 4;
 
 namespace {
 
@@ -57,15 +76,52 @@ CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(Get
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    {
+        LOCK(m_cs_background);
+        m_background_stop = true;
+    }
+    m_background_cv.notify_all();
+    if (m_background_thread.joinable()) m_background_thread.join();
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    if (m_background_active) {
+        LOCK(m_cs_background);
+        if (m_background_coins) {
+            CCoinsMap::const_iterator it = m_background_coins->find(outpoint);
+            if (it != m_background_coins->end()) {
+                coin = it->second.coin.Expand();
+                return !coin.IsSpent();
+            }
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    if (m_background_active) {
+        LOCK(m_cs_background);
+        if (m_background_coins) {
+            CCoinsMap::const_iterator it = m_background_coins->find(outpoint);
+            if (it != m_background_coins->end()) {
+                return !it->second.coin.IsSpent();
+            }
+        }
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
+    if (m_background_active) {
+        LOCK(m_cs_background);
+        if (!m_background_block.IsNull()) return m_background_block;
+    }
+    return ReadBestBlock();
+}
+
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -81,6 +137,82 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!m_background_requested) {
+        return WriteCoins(mapCoins, hashBlock, true);
+    }
+    m_background_requested = false;
+
+    {
+        WAIT_LOCK(m_cs_background, lock);
+        m_background_cv.wait(lock, [this] { return !m_background_pending; });
+        if (m_background_failed) return false;
+        // Take over the caller's entries without copying them.
+        m_background_coins = MakeUnique<CCoinsMap>(std::move(mapCoins));
+        mapCoins.clear();
+        m_background_block = hashBlock;
+        m_background_pending = true;
+        m_background_active = true;
+        if (!m_background_thread.joinable()) {
+            m_background_thread = std::thread(&TraceThread<std::function<void()>>, "coinsflush", std::function<void()>(std::bind(&CCoinsViewDB::ThreadBackgroundWrite, this)));
+        }
+    }
+    m_background_cv.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::WaitForBackgroundWrite() const {
+    WAIT_LOCK(m_cs_background, lock);
+    m_background_cv.wait(lock, [this] { return !m_background_pending; });
+    return !m_background_failed;
+}
+
+bool CCoinsViewDB::IsBackgroundWriteDone() const {
+    LOCK(m_cs_background);
+    return !m_background_pending && !m_background_failed;
+}
+
+void CCoinsViewDB::ThreadBackgroundWrite() {
+    while (true) {
+        uint256 hashBlock;
+        {
+            WAIT_LOCK(m_cs_background, lock);
+            m_background_cv.wait(lock, [this] { return m_background_pending || m_background_stop; });
+            if (!m_background_pending) return;
+            hashBlock = m_background_block;
+        }
+
+        const int64_t nStart = GetTimeMillis();
+        // Readers may be looking up coins in the map, so it is only released once everything is written.
+        const bool fOk = WriteCoinsBatched(*m_background_coins, hashBlock, true, false);
+        if (fOk) {
+            LogPrint(BCLog::COINDB, "Background write of %u coins for block %s took %dms\n", m_background_coins->size(), hashBlock.ToString(), GetTimeMillis() - nStart);
+        } else {
+            LogPrintf("Error: background write to the coins database failed\n");
+        }
+
+        std::unique_ptr<CCoinsMap> written;
+        {
+            LOCK(m_cs_background);
+            if (fOk) {
+                written = std::move(m_background_coins);
+                m_background_block.SetNull();
+                m_background_active = false;
+            } else {
+                // Keep serving the unwritten coins; the next flush reports the failure.
+                m_background_failed = true;
+            }
+            m_background_pending = false;
+        }
+        m_background_cv.notify_all();
+    }
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal) {
+    if (!WaitForBackgroundWrite()) return false;
+    return WriteCoinsBatched(mapCoins, hashBlock, fFinal, true);
+}
+
+bool CCoinsViewDB::WriteCoinsBatched(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -88,7 +220,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
+    uint256 old_tip = ReadBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
         std::vector<uint256> old_heads = GetHeadBlocks();
@@ -115,8 +247,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -132,8 +268,17 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     }
 
     // In the last batch, mark the database as consistent with hashBlock again.
-    batch.Erase(DB_HEAD_BLOCKS);
-    batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (fFinal) {
+        batch.Erase(DB_HEAD_BLOCKS);
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+        LOCK(m_cs_background);
+        // Statistics set for a later block while this write was in the
+        // background are kept for the write of that block.
+        if (m_pending_stats && m_pending_stats->hashBlock == hashBlock) {
+            batch.Write(DB_COINS_STATS, *m_pending_stats);
+            m_pending_stats.reset();
+        }
+    }
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
@@ -141,12 +286,51 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::EraseAllCoins(const uint256 &hashBlock) {
+    if (!WaitForBackgroundWrite()) return false;
+    CDBBatch batch(db);
+    size_t batch_size = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COIN);
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    for (; pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN; pcursor->Next()) {
+        batch.Erase(entry);
+        if (batch.SizeEstimate() > batch_size) {
+            db.WriteBatch(batch);
+            batch.Clear();
+        }
+    }
+    batch.Erase(DB_HEAD_BLOCKS);
+    batch.Write(DB_BEST_BLOCK, hashBlock);
+    return db.WriteBatch(batch);
+}
+
+void CCoinsViewDB::SetRollingStats(const RollingCoinsStats& stats)
+{
+    LOCK(m_cs_background);
+    m_pending_stats = MakeUnique<RollingCoinsStats>(stats);
+}
+
+bool CCoinsViewDB::ReadRollingStats(RollingCoinsStats& stats) const
+{
+    return db.Read(DB_COINS_STATS, stats);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(gArgs.IsArgSet("-blocksdir") ? GetDataDir() / "blocks" / "index" : GetBlocksDir() / "index", nCacheSize, fMemory, fWipe) {
+static fs::path GetBlockTreeDBDir()
+{
+    return gArgs.IsArgSet("-blocksdir") ? GetDataDir() / "blocks" / "index" : GetBlocksDir() / "index";
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetBlockTreeDBDir(), nCacheSize, fMemory, fWipe) {
+    if (!fMemory) {
+        m_snapshot_path = GetBlockTreeDBDir().parent_path() / "indexsnapshot.dat";
+    }
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -170,6 +354,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // Iterate over a database that has all coins of the best block.
+    WaitForBackgroundWrite();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -222,15 +408,20 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::vector<std::pair<uint256, const CBlockTxOffsets*> >& txOffsets) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
+    // Any block index snapshot is out of date once this is written
+    batch.Erase(DB_BLOCK_INDEX_SNAPSHOT);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    for (const auto& entry : txOffsets) {
+        batch.Write(std::make_pair(DB_BLOCK_TX_OFFSETS, entry.first), *entry.second);
+    }
     return WriteBatch(batch, true);
 }
 
@@ -246,8 +437,191 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+bool CBlockTreeDB::ReadBlockTxOffsets(const uint256& hash, CBlockTxOffsets& offsets)
+{
+    return Read(std::make_pair(DB_BLOCK_TX_OFFSETS, hash), offsets);
+}
+
+bool CBlockTreeDB::EraseBlockTxOffsets(const std::vector<uint256>& hashes)
+{
+    CDBBatch batch(*this);
+    for (const uint256& hash : hashes) {
+        batch.Erase(std::make_pair(DB_BLOCK_TX_OFFSETS, hash));
+    }
+    return WriteBatch(batch);
+}
+
+CBlockTxOffsets::CBlockTxOffsets(const CBlock& block)
+{
+    short_txids.reserve(block.vtx.size());
+    tx_sizes.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx) {
+        short_txids.push_back(ShortTxid(tx->GetHash()));
+        tx_sizes.push_back(::GetSerializeSize(*tx, CLIENT_VERSION));
+    }
+}
+
+uint16_t CBlockTxOffsets::ShortTxid(const uint256& txid)
+{
+    return ReadLE16(txid.begin());
+}
+
+uint64_t CBlockTxOffsets::GetFirstTxOffset() const
+{
+    return ::GetSerializeSize(CBlockHeader(), CLIENT_VERSION) + GetSizeOfCompactSize(short_txids.size());
+}
+
+bool CBlockTreeDB::WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& blockinfo, const uint256& coins_best_block)
+{
+    if (m_snapshot_path.empty()) return false;
+
+    const uint256 id = GetRandHash();
+    fs::path tmp_path = m_snapshot_path;
+    tmp_path += ".new";
+    CAutoFile file(fsbridge::fopen(tmp_path, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        return error("%s: failed to open %s", __func__, tmp_path.string());
+    }
+
+    try {
+        file.write((const char*)BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(BLOCK_INDEX_SNAPSHOT_MAGIC));
+        file << BLOCK_INDEX_SNAPSHOT_VERSION << id << coins_best_block << GetBlockFilesState() << (uint64_t)blockinfo.size();
+
+        CSHA256 hasher;
+        CDataStream entry(SER_DISK, CLIENT_VERSION);
+        for (const CBlockIndex* pindex : blockinfo) {
+            entry << pindex->GetBlockHash();
+            entry << (pindex->pprev ? pindex->pprev->GetBlockHash() : uint256());
+            entry << pindex->hashMerkleRoot;
+            entry << pindex->nHeight << pindex->nStatus << pindex->nTx;
+            entry << pindex->nFile << pindex->nDataPos << pindex->nUndoPos;
+            entry << pindex->nVersion << pindex->nTime << pindex->nBits << pindex->nNonce;
+            assert(entry.size() == BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE);
+            hasher.Write((const unsigned char*)entry.data(), entry.size());
+            file.write(entry.data(), entry.size());
+            entry.clear();
+        }
+        uint256 checksum;
+        hasher.Finalize(checksum.begin());
+        file << checksum;
+    } catch (const std::exception& e) {
+        return error("%s: failed to write %s: %s", __func__, tmp_path.string(), e.what());
+    }
+
+    if (!FileCommit(file.Get())) {
+        return error("%s: failed to commit %s", __func__, tmp_path.string());
+    }
+    file.fclose();
+    if (!RenameOver(tmp_path, m_snapshot_path)) {
+        return error("%s: failed to rename %s", __func__, tmp_path.string());
+    }
+    return Write(DB_BLOCK_INDEX_SNAPSHOT, id, true);
+}
+
+uint256 CBlockTreeDB::GetBlockFilesState()
 {
+    int nLastFile = 0;
+    CBlockFileInfo info;
+    if (ReadLastBlockFile(nLastFile)) {
+        ReadBlockFileInfo(nLastFile, info);
+    }
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    hasher << nLastFile << info;
+    return hasher.GetHash();
+}
+
+void CBlockTreeDB::DiscardBlockIndexSnapshot()
+{
+    Erase(DB_BLOCK_INDEX_SNAPSHOT, true);
+    fs::remove(m_snapshot_path);
+}
+
+bool CBlockTreeDB::LoadBlockIndexSnapshot(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, const uint256& coins_best_block)
+{
+    if (m_snapshot_path.empty()) return false;
+
+    MappedFile file;
+    if (!file.Open(m_snapshot_path)) return false;
+    uint256 id;
+    if (!Read(DB_BLOCK_INDEX_SNAPSHOT, id)) {
+        LogPrintf("Block index snapshot is out of date, loading the block index from the database\n");
+        return false;
+    }
+
+    const unsigned char* data = file.data();
+    if (file.size() < BLOCK_INDEX_SNAPSHOT_HEADER_SIZE ||
+        memcmp(data, BLOCK_INDEX_SNAPSHOT_MAGIC, sizeof(BLOCK_INDEX_SNAPSHOT_MAGIC)) != 0 ||
+        ReadLE32(data + 4) != BLOCK_INDEX_SNAPSHOT_VERSION ||
+        memcmp(data + 8, id.begin(), 32) != 0) {
+        LogPrintf("Block index snapshot does not match the database, loading the block index from the database\n");
+        return false;
+    }
+    // Versions that do not know about the snapshot change the database
+    // without erasing its id, but they do move the best block of the coins
+    // database when they connect or disconnect blocks.
+    if (coins_best_block.IsNull() || memcmp(data + 40, coins_best_block.begin(), 32) != 0) {
+        LogPrintf("Block index snapshot was written at a different chain tip, discarding it\n");
+        file.Close();
+        DiscardBlockIndexSnapshot();
+        return false;
+    }
+    // They also update the information of the last block file for every
+    // block they store, including blocks that are not connected.
+    const uint256 block_files_state = GetBlockFilesState();
+    if (memcmp(data + 72, block_files_state.begin(), 32) != 0) {
+        LogPrintf("Block index snapshot was written with different block files, discarding it\n");
+        file.Close();
+        DiscardBlockIndexSnapshot();
+        return false;
+    }
+    const uint64_t count = ReadLE64(data + 104);
+    if (count > (file.size() - BLOCK_INDEX_SNAPSHOT_HEADER_SIZE) / BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE ||
+        file.size() != BLOCK_INDEX_SNAPSHOT_HEADER_SIZE + count * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE + 32) {
+        LogPrintf("Block index snapshot has an unexpected size, loading the block index from the database\n");
+        return false;
+    }
+    const unsigned char* entries = data + BLOCK_INDEX_SNAPSHOT_HEADER_SIZE;
+    const size_t entries_size = count * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE;
+    unsigned char checksum[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(entries, entries_size).Finalize(checksum);
+    if (memcmp(checksum, entries + entries_size, sizeof(checksum)) != 0) {
+        LogPrintf("Block index snapshot is corrupted, loading the block index from the database\n");
+        return false;
+    }
+
+    for (const unsigned char* p = entries; p < entries + entries_size; p += BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE) {
+        uint256 hash, hash_prev;
+        memcpy(hash.begin(), p, 32);
+        memcpy(hash_prev.begin(), p + 32, 32);
+        CBlockIndex* pindexNew = insertBlockIndex(hash);
+        pindexNew->pprev          = insertBlockIndex(hash_prev);
+        memcpy(pindexNew->hashMerkleRoot.begin(), p + 64, 32);
+        pindexNew->nHeight        = ReadLE32(p + 96);
+        pindexNew->nStatus        = ReadLE32(p + 100);
+        pindexNew->nTx            = ReadLE32(p + 104);
+        pindexNew->nFile          = ReadLE32(p + 108);
+        pindexNew->nDataPos       = ReadLE32(p + 112);
+        pindexNew->nUndoPos       = ReadLE32(p + 116);
+        pindexNew->nVersion       = ReadLE32(p + 120);
+        pindexNew->nTime          = ReadLE32(p + 124);
+        pindexNew->nBits          = ReadLE32(p + 128);
+        pindexNew->nNonce         = ReadLE32(p + 132);
+
+        if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams)) {
+            // Let the database scan report the error
+            LogPrintf("%s: CheckProofOfWork failed: %s\n", __func__, pindexNew->ToString());
+            return false;
+        }
+    }
+
+    LogPrintf("Loaded %u block index entries from the snapshot\n", count);
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, const uint256& coins_best_block)
+{
+    if (LoadBlockIndexSnapshot(consensusParams, insertBlockIndex, coins_best_block)) return true;
+
     std::unique_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
@@ -9,11 +9,17 @@
 #include <coins.h>
 #include <dbwrapper.h>
 #include <chain.h>
+#include <fs.h>
+#include <node/coinstats.h>
 #include <primitives/block.h>
+#include <sync.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -47,8 +53,40 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /**
+     * Background writes (see RequestBackgroundWrite). The coins being written
+     * stay in m_background_coins, in front of the database for readers, until
+     * they are all in the database. Only the writer thread iterates over the
+     * map, and it is only modified with m_cs_background held while no write
+     * is pending, so lookups under the lock are safe during a write.
+     */
+    mutable Mutex m_cs_background;
+    //! Rolling statistics to store with the next final write, see SetRollingStats(). Read by the writer thread.
+    std::unique_ptr<RollingCoinsStats> m_pending_stats GUARDED_BY(m_cs_background);
+    mutable std::condition_variable m_background_cv;
+    std::unique_ptr<CCoinsMap> m_background_coins;
+    //! Best block of the coins in m_background_coins, null once they are written
+    uint256 m_background_block GUARDED_BY(m_cs_background);
+    bool m_background_pending GUARDED_BY(m_cs_background){false};
+    bool m_background_failed GUARDED_BY(m_cs_background){false};
+    bool m_background_stop GUARDED_BY(m_cs_background){false};
+    /**
+     * Whether m_background_coins is set, so that reads only take
+     * m_cs_background while a background write is outstanding or has failed.
+     * Only changed with m_cs_background held.
+     */
+    std::atomic<bool> m_background_active{false};
+    //! Whether the next BatchWrite goes to the background writer
+    bool m_background_requested{false};
+    std::thread m_background_thread;
+
+    void ThreadBackgroundWrite();
+    bool WriteCoinsBatched(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal, bool fErase);
+    uint256 ReadBestBlock() const;
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
@@ -57,6 +95,43 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    /**
+     * Like BatchWrite, but unless fFinal is set the database is left marked as
+     * being in transition to hashBlock. This lets a long sequence of writes
+     * (such as loading a UTXO snapshot) only count as complete once the last
+     * one has been written; an interruption is detected at startup.
+     */
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal);
+
+    /**
+     * Erase all coins and mark the database as consistent with hashBlock. This
+     * undoes an incomplete sequence of WriteCoins calls into a database that
+     * had no coins, such as an interrupted UTXO snapshot load.
+     */
+    bool EraseAllCoins(const uint256 &hashBlock);
+
+    /**
+     * Store stats together with the best block marker on the next final write,
+     * if they describe that block. Stored statistics that are left behind by
+     * later writes stay correct for the block they were computed at.
+     */
+    void SetRollingStats(const RollingCoinsStats& stats);
+    //! Read the stored rolling statistics. They are only current if their hashBlock is the best block.
+    bool ReadRollingStats(RollingCoinsStats& stats) const;
+
+    /**
+     * Let the next BatchWrite return as soon as the coins are handed to a
+     * background thread, which writes them with the usual crash-consistent
+     * best block markers. Until it is done, reads still see the new coins and
+     * GetBestBlock() returns the new best block; any other write first waits
+     * for it to complete.
+     */
+    void RequestBackgroundWrite() { m_background_requested = true; }
+    //! Wait until no background write is in progress. Returns false if one failed.
+    bool WaitForBackgroundWrite() const;
+    //! Whether the last background write, if any, is complete and succeeded. Does not block.
+    bool IsBackgroundWriteDone() const;
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
@@ -84,20 +159,87 @@ private:
     friend class CCoinsViewDB;
 };
 
-/** Access to the block database (blocks/index/) */
+/**
+ * Where the transactions of a block are in its serialization, so one can be
+ * read from the block file without reading the whole block (-blocktxoffsets).
+ */
+struct CBlockTxOffsets
+{
+    //! The first two bytes of each txid, in block order
+    std::vector<uint16_t> short_txids;
+    //! The serialized size (with witness data) of each transaction
+    std::vector<uint32_t> tx_sizes;
+
+    CBlockTxOffsets() {}
+    explicit CBlockTxOffsets(const CBlock& block);
+
+    static uint16_t ShortTxid(const uint256& txid);
+    /** Offset of the first transaction from the start of the serialized block */
+    uint64_t GetFirstTxOffset() const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << short_txids;
+        for (uint32_t size : tx_sizes) {
+            s << VARINT(size);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        s >> short_txids;
+        tx_sizes.resize(short_txids.size());
+        for (uint32_t& size : tx_sizes) {
+            s >> VARINT(size);
+        }
+    }
+};
+
+/** Access to the block database (blocks/index/)
+ *
+ * Next to the database a snapshot of the block index can be kept in a flat
+ * file (blocks/indexsnapshot.dat), which is much faster to load than iterating
+ * over the database. A random id that is stored in both marks the snapshot as
+ * current; it is erased with the first write to the block index after that, so
+ * a snapshot is only ever loaded if the database has not changed since. As
+ * versions without snapshots do not erase the id, the snapshot also records the
+ * best block of the coins database and the state of the last block file in the
+ * database, and is discarded if either has moved.
+ */
 class CBlockTreeDB : public CDBWrapper
 {
+private:
+    //! Location of the block index snapshot, empty for an in-memory database
+    fs::path m_snapshot_path;
+
+    /** Load the block index from the snapshot. Returns false if there is no current snapshot. */
+    bool LoadBlockIndexSnapshot(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, const uint256& coins_best_block);
+    //! Remove the snapshot and its id
+    void DiscardBlockIndexSnapshot();
+    //! Hash of the last block file number and its information in the database
+    uint256 GetBlockFilesState();
+
 public:
     explicit CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::vector<std::pair<uint256, const CBlockTxOffsets*> >& txOffsets);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     void ReadReindexing(bool &fReindexing);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    bool ReadBlockTxOffsets(const uint256& hash, CBlockTxOffsets& offsets);
+    bool EraseBlockTxOffsets(const std::vector<uint256>& hashes);
+    /** Load the block index, from the snapshot if it is current and was
+     *  written when the coins database was at coins_best_block. */
+    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, const uint256& coins_best_block);
+    /** Write a snapshot of the block index. blockinfo must hold every entry of
+     *  the database as it is on disk, parents before their children, and
+     *  coins_best_block is the best block of the coins database. */
+    bool WriteBlockIndexSnapshot(const std::vector<const CBlockIndex*>& blockinfo, const uint256& coins_best_block);
 };
 
 #endif // BITCOIN_TXDB_H
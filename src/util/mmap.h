@@ -0,0 +1,41 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_MMAP_H
+#define BITCOIN_UTIL_MMAP_H
+
+#include <fs.h>
+
+#include <stddef.h>
+
+/**
+ * A read-only memory mapping of a whole file.
+ *
+ * The file is mapped as it is at the time Open() is called; it must not be
+ * truncated while it is mapped.
+ */
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** Map the file at path. Returns false if it cannot be opened or mapped. */
+    bool Open(const fs::path& path);
+    void Close();
+
+    bool IsOpen() const { return m_open; }
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    bool m_open{false};
+    const unsigned char* m_data{nullptr};
+    size_t m_size{0};
+};
+
+#endif // BITCOIN_UTIL_MMAP_H
@@ -14,10 +14,15 @@
 #include <consensus/tx_check.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/common.h>
 #include <cuckoocache.h>
 #include <flatfile.h>
 #include <hash.h>
 #include <index/txindex.h>
+#include <memusage.h>
+#include <node/coinstats.h>
+#include <node/utxo_snapshot.h>
+#include <node/validationstats.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
 #include <policy/rbf.h>
@@ -46,6 +51,7 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <deque>
 #include <future>
 #include <sstream>
 #include <string>
@@ -156,11 +162,28 @@ private:
      */
     CCriticalSection m_cs_chainstate;
 
+    /** A block being read and checked on the block read thread, see ActivateBestChainStep. */
+    struct BlockRead {
+        std::future<std::shared_ptr<const CBlock>> block;
+        //! The ActivateBestChainStep call that started the read
+        uint64_t step;
+    };
+    /**
+     * Blocks being read ahead of being connected, by hash. These outlive the
+     * ActivateBestChainStep call that started them, as it returns after the
+     * first block that adds chain work, so that the reads overlap with
+     * connecting the blocks before them.
+     */
+    std::map<uint256, BlockRead> m_block_reads GUARDED_BY(cs_main);
+    uint64_t m_activate_step GUARDED_BY(cs_main){0};
+    //! Number of blocks connected whose read was started by an earlier ActivateBestChainStep
+    uint64_t m_blocks_read_ahead GUARDED_BY(cs_main){0};
+
 public:
     //! The current chain of blockheaders we consult and build on.
     //! @see CChain, CBlockIndex.
     CChain m_chain;
-    BlockMap mapBlockIndex GUARDED_BY(cs_main);
+    BlockMap mapBlockIndex GUARDED_BY(cs_main){0, BlockHasher(), BlockMap::key_equal(), BlockMapAllocator(std::make_shared<BlockMapMemoryResource>())};
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
     CBlockIndex *pindexBestInvalid = nullptr;
 
@@ -173,15 +196,23 @@ public:
      * that it doesn't descend from an invalid block, and then add it to mapBlockIndex.
      */
     bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /**
+     * As above, for a header whose hash is already known. If fCheckPOW is false
+     * the caller has already checked the header's proof of work.
+     */
+    bool AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, bool fCheckPOW, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const FlatFilePos* dbp, bool* fNewBlock) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    // If stats is given, it is updated to describe view after the block was (dis)connected.
+    // If blockUndo is given, it holds the undo data of the block, which is moved from.
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, RollingCoinsStats* stats = nullptr, CBlockUndo* blockUndo = nullptr);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                      CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+                      CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false, RollingCoinsStats* stats = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Block disconnection on our pcoinsTip:
-    bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions* disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    // pblock and pundo are the tip block and its undo data, if already read.
+    bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions* disconnectpool, std::shared_ptr<const CBlock> pblock = nullptr, std::unique_ptr<CBlockUndo> pundo = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     // Manual block validity manipulation:
     bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIndex* pindex) LOCKS_EXCLUDED(cs_main);
@@ -189,18 +220,22 @@ public:
     void ResetBlockFailureFlags(CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
+    bool LoadUTXOSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const uint256& expected_hash_serialized, const CChainParams& chainparams, std::string& strError) LOCKS_EXCLUDED(cs_main);
     bool RewindBlockIndex(const CChainParams& params) LOCKS_EXCLUDED(cs_main);
     bool LoadGenesisBlock(const CChainParams& chainparams);
 
     void PruneBlockIndexCandidates();
 
-    void UnloadBlockIndex();
+    void UnloadBlockIndex() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    uint64_t BlocksReadAhead() const EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return m_blocks_read_ahead; }
 
 private:
     bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     bool ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const std::shared_ptr<const CBlock>& pblock, ConnectTrace& connectTrace, DisconnectedBlockTransactions &disconnectpool) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
     CBlockIndex* AddToBlockIndex(const CBlockHeader& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /** Create a new block index entry for a given block hash */
     CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
     /**
@@ -222,6 +257,12 @@ private:
 
 CChain& ChainActive() { return g_chainstate.m_chain; }
 
+uint64_t GetBlocksReadAhead()
+{
+    AssertLockHeld(cs_main);
+    return g_chainstate.BlocksReadAhead();
+}
+
 /**
  * Mutex to guard access to validation specific variables, such as reading
  * or changing the chainstate.
@@ -240,14 +281,20 @@ Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
 int nScriptCheckThreads = 0;
+int nCoinsPrefetchThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fHavePruned = false;
+bool fHaveUTXOSnapshot = false;
 bool fPruneMode = false;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+bool fBackgroundFlush = DEFAULT_BACKGROUND_FLUSH;
+bool fPartialFlush = DEFAULT_PARTIAL_FLUSH;
+bool fBlockTxOffsets = DEFAULT_BLOCK_TX_OFFSETS;
+bool fMapBlockFiles = DEFAULT_MAP_BLOCK_FILES;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -275,6 +322,9 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Memory mappings of the block and undo files below nLastBlockFile, used for reading them */
+    FlatFileMapCache g_block_file_maps(MAX_MAPPED_BLOCK_FILES);
+    FlatFileMapCache g_undo_file_maps(MAX_MAPPED_BLOCK_FILES);
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -286,8 +336,21 @@ namespace {
 
     /** Dirty block file entries. */
     std::set<int> setDirtyFileInfo;
+
+    /** Transaction offset tables not yet written with the block index. */
+    std::map<uint256, CBlockTxOffsets> mapDirtyBlockTxOffsets;
+    size_t nDirtyBlockTxOffsetsUsage = 0;
 } // anon namespace
 
+/** Write the block index once the unwritten transaction offset tables use this much memory. */
+static const size_t MAX_DIRTY_BLOCK_TX_OFFSETS_USAGE = 16 << 20;
+
+static size_t BlockTxOffsetsUsage(const CBlockTxOffsets& offsets)
+{
+    return memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const uint256, CBlockTxOffsets> >)) +
+        memusage::DynamicUsage(offsets.short_txids) + memusage::DynamicUsage(offsets.tx_sizes);
+}
+
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
 {
     AssertLockHeld(cs_main);
@@ -310,6 +373,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
+std::unique_ptr<RollingCoinsStats> g_coins_stats;
 
 enum class FlushStateMode {
     NONE,
@@ -323,9 +387,11 @@ static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
+static bool CheckInputsForMempool(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags, PrecomputedTransactionData& txdata);
 static FILE* OpenUndoFile(const FlatFilePos &pos, bool fReadOnly = false);
 static FlatFileSeq BlockFileSeq();
 static FlatFileSeq UndoFileSeq();
+static bool MapFileRecord(FlatFileMapCache& maps, const FlatFileSeq& seq, const FlatFilePos& pos, size_t trailing_size, std::shared_ptr<const MappedFile>& mapping, Span<const unsigned char>& record);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
@@ -529,15 +595,13 @@ static void UpdateMempoolForReorg(DisconnectedBlockTransactions &disconnectpool,
 }
 
 // Used to avoid mempool polluting consensus critical paths if CCoinsViewMempool
-// were somehow broken and returning the wrong scriptPubKeys
-static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, const CTxMemPool& pool,
-                 unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata) EXCLUSIVE_LOCKS_REQUIRED(cs_main) {
+// were somehow broken and returning the wrong scriptPubKeys. Checked while
+// the coins are loaded, before the scripts are verified against them and the
+// result is cached (see MemPoolScriptChecks).
+static bool CheckCoinsFromMempoolAndCache(const CTransaction& tx, const CCoinsViewCache& view, const CTxMemPool& pool) EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
+{
     AssertLockHeld(cs_main);
-
-    // pool.cs should be locked already, but go ahead and re-take the lock here
-    // to enforce that mempool doesn't change between when we check the view
-    // and when we actually call through to CheckInputs
-    LOCK(pool.cs);
+    AssertLockHeld(pool.cs);
 
     assert(!tx.IsCoinBase());
     for (const CTxIn& txin : tx.vin) {
@@ -561,28 +625,34 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
         }
     }
 
-    return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
+    return true;
 }
 
-/**
- * @param[out] coins_to_uncache   Return any outpoints which were not previously present in the
- *                                coins cache, but were added as a result of validating the tx
- *                                for mempool acceptance. This allows the caller to optionally
- *                                remove the cache additions if the associated transaction ends
- *                                up being rejected by the mempool.
- */
-static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache, bool test_accept) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
-{
-    const CTransaction& tx = *ptx;
-    const uint256 hash = tx.GetHash();
-    AssertLockHeld(cs_main);
-    LOCK(pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
-    if (pfMissingInputs) {
-        *pfMissingInputs = false;
-    }
+namespace {
+/** What is learned about a transaction while checking it for the mempool, from its inputs to its insertion. */
+struct MemPoolAcceptWorkspace {
+    std::set<uint256> m_conflicts;
+    CTxMemPool::setEntries m_all_conflicting;
+    CTxMemPool::setEntries m_ancestors;
+    std::unique_ptr<CTxMemPoolEntry> m_entry;
+    bool m_replacement_transaction{false};
+    CAmount m_modified_fees{0};
+    CAmount m_conflicting_fees{0};
+    size_t m_conflicting_size{0};
+    //! The coins spent by the transaction, detached from the mempool once loaded
+    CCoinsView m_dummy;
+    CCoinsViewCache m_view{&m_dummy};
+    //! Script verification flags of the block after m_tip
+    unsigned int m_block_script_flags{0};
+    //! The chain tip and mempool update count the checks were made against
+    const CBlockIndex* m_tip{nullptr};
+    unsigned int m_pool_updates{0};
+};
+} // namespace
 
+/** The checks of a transaction that depend on neither the chain nor the mempool. */
+static bool MemPoolPreChecks(const CTransaction& tx, CValidationState& state)
+{
     if (!CheckTransaction(tx, state))
         return false; // state filled in by CheckTransaction
 
@@ -601,6 +671,39 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     if (::GetSerializeSize(tx, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) < MIN_STANDARD_TX_NONWITNESS_SIZE)
         return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "tx-size-small");
 
+    return true;
+}
+
+/**
+ * Check a transaction against the chain tip and the mempool, and load the
+ * coins it spends into ws.m_view.
+ *
+ * @param[out] coins_to_uncache   Return any outpoints which were not previously present in the
+ *                                coins cache, but were added as a result of validating the tx
+ *                                for mempool acceptance. This allows the caller to optionally
+ *                                remove the cache additions if the associated transaction ends
+ *                                up being rejected by the mempool.
+ */
+static bool MemPoolInputChecks(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
+                               bool* pfMissingInputs, int64_t nAcceptTime, bool bypass_limits, const CAmount& nAbsurdFee,
+                               std::vector<COutPoint>& coins_to_uncache, MemPoolAcceptWorkspace& ws) EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
+{
+    const CTransaction& tx = *ptx;
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+
+    std::set<uint256>& setConflicts = ws.m_conflicts;
+    CTxMemPool::setEntries& allConflicting = ws.m_all_conflicting;
+    CTxMemPool::setEntries& setAncestors = ws.m_ancestors;
+    std::unique_ptr<CTxMemPoolEntry>& entry = ws.m_entry;
+    bool& fReplacementTransaction = ws.m_replacement_transaction;
+    CAmount& nModifiedFees = ws.m_modified_fees;
+    CAmount& nConflictingFees = ws.m_conflicting_fees;
+    size_t& nConflictingSize = ws.m_conflicting_size;
+    CCoinsView& dummy = ws.m_dummy;
+    CCoinsViewCache& view = ws.m_view;
+
     // Only accept nLockTime-using transactions that can be mined in the next
     // block; we don't want our mempool filled up with transactions that can't
     // be mined yet.
@@ -613,7 +716,6 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
 
     // Check for conflicts with in-memory transactions
-    std::set<uint256> setConflicts;
     for (const CTxIn &txin : tx.vin)
     {
         const CTransaction* ptxConflicting = pool.GetConflictTx(txin.prevout);
@@ -653,320 +755,410 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
         }
     }
 
-    {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
-
-        LockPoints lp;
-        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
-        view.SetBackend(viewMemPool);
-
-        // do all inputs exist?
-        for (const CTxIn& txin : tx.vin) {
-            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
-                coins_to_uncache.push_back(txin.prevout);
-            }
+    LockPoints lp;
+    CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+    view.SetBackend(viewMemPool);
 
-            // Note: this call may add txin.prevout to the coins cache
-            // (pcoinsTip.cacheCoins) by way of FetchCoin(). It should be removed
-            // later (via coins_to_uncache) if this tx turns out to be invalid.
-            if (!view.HaveCoin(txin.prevout)) {
-                // Are inputs missing because we already have the tx?
-                for (size_t out = 0; out < tx.vout.size(); out++) {
-                    // Optimistically just do efficient check of cache for outputs
-                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
-                        return state.Invalid(ValidationInvalidReason::TX_CONFLICT, false, REJECT_DUPLICATE, "txn-already-known");
-                    }
-                }
-                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
-                if (pfMissingInputs) {
-                    *pfMissingInputs = true;
+    // do all inputs exist?
+    for (const CTxIn& txin : tx.vin) {
+        if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+            coins_to_uncache.push_back(txin.prevout);
+        }
+
+        // Note: this call may add txin.prevout to the coins cache
+        // (pcoinsTip.cacheCoins) by way of FetchCoin(). It should be removed
+        // later (via coins_to_uncache) if this tx turns out to be invalid.
+        if (!view.HaveCoin(txin.prevout)) {
+            // Are inputs missing because we already have the tx?
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                // Optimistically just do efficient check of cache for outputs
+                if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                    return state.Invalid(ValidationInvalidReason::TX_CONFLICT, false, REJECT_DUPLICATE, "txn-already-known");
                 }
-                return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
+            // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+            if (pfMissingInputs) {
+                *pfMissingInputs = true;
+            }
+            return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
         }
+    }
 
-        // Bring the best block into scope
-        view.GetBestBlock();
+    // Bring the best block into scope
+    view.GetBestBlock();
 
-        // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+    // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
+    view.SetBackend(dummy);
 
-        // Only accept BIP68 sequence locked transactions that can be mined in the next
-        // block; we don't want our mempool filled up with transactions that can't
-        // be mined yet.
-        // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-        // CoinsViewCache instead of create its own
-        if (!CheckSequenceLocks(pool, tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
-            return state.Invalid(ValidationInvalidReason::TX_PREMATURE_SPEND, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    // Only accept BIP68 sequence locked transactions that can be mined in the next
+    // block; we don't want our mempool filled up with transactions that can't
+    // be mined yet.
+    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
+    // CoinsViewCache instead of create its own
+    if (!CheckSequenceLocks(pool, tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return state.Invalid(ValidationInvalidReason::TX_PREMATURE_SPEND, false, REJECT_NONSTANDARD, "non-BIP68-final");
 
-        CAmount nFees = 0;
-        if (!Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view), nFees)) {
-            return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
-        }
+    CAmount nFees = 0;
+    if (!Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view), nFees)) {
+        return error("%s: Consensus::CheckTxInputs: %s, %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+    }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
 
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false, REJECT_NONSTANDARD, "bad-witness-nonstandard");
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false, REJECT_NONSTANDARD, "bad-witness-nonstandard");
 
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
 
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
-        pool.ApplyDelta(hash, nModifiedFees);
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    nModifiedFees = nFees;
+    pool.ApplyDelta(hash, nModifiedFees);
 
-        // Keep track of transactions that spend a coinbase, which we re-scan
-        // during reorgs to ensure COINBASE_MATURITY is still met.
-        bool fSpendsCoinbase = false;
-        for (const CTxIn &txin : tx.vin) {
-            const Coin &coin = view.AccessCoin(txin.prevout);
-            if (coin.IsCoinBase()) {
-                fSpendsCoinbase = true;
-                break;
-            }
+    // Keep track of transactions that spend a coinbase, which we re-scan
+    // during reorgs to ensure COINBASE_MATURITY is still met.
+    bool fSpendsCoinbase = false;
+    for (const CTxIn &txin : tx.vin) {
+        const Coin &coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase()) {
+            fSpendsCoinbase = true;
+            break;
         }
+    }
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, ::ChainActive().Height(),
-                              fSpendsCoinbase, nSigOpsCost, lp);
-        unsigned int nSize = entry.GetTxSize();
+    entry.reset(new CTxMemPoolEntry(ptx, nFees, nAcceptTime, ::ChainActive().Height(),
+                                    fSpendsCoinbase, nSigOpsCost, lp));
+    unsigned int nSize = entry->GetTxSize();
 
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops",
-                strprintf("%d", nSigOpsCost));
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops",
+            strprintf("%d", nSigOpsCost));
 
-        CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (!bypass_limits && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", strprintf("%d < %d", nModifiedFees, mempoolRejectFee));
-        }
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (!bypass_limits && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", strprintf("%d < %d", nModifiedFees, mempoolRejectFee));
+    }
 
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (!bypass_limits && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
-            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "min relay fee not met", strprintf("%d < %d", nModifiedFees, ::minRelayTxFee.GetFee(nSize)));
-        }
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (!bypass_limits && nModifiedFees < ::minRelayTxFee.GetFee(nSize)) {
+        return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "min relay fee not met", strprintf("%d < %d", nModifiedFees, ::minRelayTxFee.GetFee(nSize)));
+    }
 
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(ValidationInvalidReason::TX_NOT_STANDARD, false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
 
-        // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-        size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
-        size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_NONSTANDARD, "too-long-mempool-chain", errString);
-        }
+    // Calculate in-mempool ancestors, up to a limit.
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    if (!pool.CalculateMemPoolAncestors(*entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_NONSTANDARD, "too-long-mempool-chain", errString);
+    }
 
-        // A transaction that spends outputs that would be replaced by it is invalid. Now
-        // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
-        // intersect.
-        for (CTxMemPool::txiter ancestorIt : setAncestors)
+    // A transaction that spends outputs that would be replaced by it is invalid. Now
+    // that we have the set of all ancestors we can detect this
+    // pathological case by making sure setConflicts and setAncestors don't
+    // intersect.
+    for (CTxMemPool::txiter ancestorIt : setAncestors)
+    {
+        const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
+        if (setConflicts.count(hashAncestor))
         {
-            const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
-            if (setConflicts.count(hashAncestor))
-            {
-                return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-spends-conflicting-tx",
-                                 strprintf("%s spends conflicting transaction %s",
-                                           hash.ToString(),
-                                           hashAncestor.ToString()));
-            }
+            return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-txns-spends-conflicting-tx",
+                             strprintf("%s spends conflicting transaction %s",
+                                       hash.ToString(),
+                                       hashAncestor.ToString()));
         }
+    }
 
-        // Check if it's economically rational to mine this transaction rather
-        // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
-        uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
-
-        // If we don't hold the lock allConflicting might be incomplete; the
-        // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
-        // mempool consistency for us.
-        const bool fReplacementTransaction = setConflicts.size();
-        if (fReplacementTransaction)
-        {
-            CFeeRate newFeeRate(nModifiedFees, nSize);
-            std::set<uint256> setConflictsParents;
-            const int maxDescendantsToVisit = 100;
-            const CTxMemPool::setEntries setIterConflicting = pool.GetIterSet(setConflicts);
-            for (const auto& mi : setIterConflicting) {
-                // Don't allow the replacement to reduce the feerate of the
-                // mempool.
-                //
-                // We usually don't want to accept replacements with lower
-                // feerates than what they replaced as that would lower the
-                // feerate of the next block. Requiring that the feerate always
-                // be increased is also an easy-to-reason about way to prevent
-                // DoS attacks via replacements.
-                //
-                // We only consider the feerates of transactions being directly
-                // replaced, not their indirect descendants. While that does
-                // mean high feerate children are ignored when deciding whether
-                // or not to replace, we do require the replacement to pay more
-                // overall fees too, mitigating most cases.
-                CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
-                if (newFeeRate <= oldFeeRate)
-                {
-                    return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "insufficient fee",
-                            strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
-                                  hash.ToString(),
-                                  newFeeRate.ToString(),
-                                  oldFeeRate.ToString()));
-                }
-
-                for (const CTxIn &txin : mi->GetTx().vin)
-                {
-                    setConflictsParents.insert(txin.prevout.hash);
-                }
-
-                nConflictingCount += mi->GetCountWithDescendants();
-            }
-            // This potentially overestimates the number of actual descendants
-            // but we just want to be conservative to avoid doing too much
-            // work.
-            if (nConflictingCount <= maxDescendantsToVisit) {
-                // If not too many to replace, then calculate the set of
-                // transactions that would have to be evicted
-                for (CTxMemPool::txiter it : setIterConflicting) {
-                    pool.CalculateDescendants(it, allConflicting);
-                }
-                for (CTxMemPool::txiter it : allConflicting) {
-                    nConflictingFees += it->GetModifiedFee();
-                    nConflictingSize += it->GetTxSize();
-                }
-            } else {
-                return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_NONSTANDARD, "too many potential replacements",
-                        strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
-                            hash.ToString(),
-                            nConflictingCount,
-                            maxDescendantsToVisit));
-            }
+    // Check if it's economically rational to mine this transaction rather
+    // than the ones it replaces.
+    nConflictingFees = 0;
+    nConflictingSize = 0;
+    uint64_t nConflictingCount = 0;
 
-            for (unsigned int j = 0; j < tx.vin.size(); j++)
+    // If we don't hold the lock allConflicting might be incomplete; the
+    // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
+    // mempool consistency for us.
+    fReplacementTransaction = setConflicts.size();
+    if (fReplacementTransaction)
+    {
+        CFeeRate newFeeRate(nModifiedFees, nSize);
+        std::set<uint256> setConflictsParents;
+        const int maxDescendantsToVisit = 100;
+        const CTxMemPool::setEntries setIterConflicting = pool.GetIterSet(setConflicts);
+        for (const auto& mi : setIterConflicting) {
+            // Don't allow the replacement to reduce the feerate of the
+            // mempool.
+            //
+            // We usually don't want to accept replacements with lower
+            // feerates than what they replaced as that would lower the
+            // feerate of the next block. Requiring that the feerate always
+            // be increased is also an easy-to-reason about way to prevent
+            // DoS attacks via replacements.
+            //
+            // We only consider the feerates of transactions being directly
+            // replaced, not their indirect descendants. While that does
+            // mean high feerate children are ignored when deciding whether
+            // or not to replace, we do require the replacement to pay more
+            // overall fees too, mitigating most cases.
+            CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
+            if (newFeeRate <= oldFeeRate)
             {
-                // We don't want to accept replacements that require low
-                // feerate junk to be mined first. Ideally we'd keep track of
-                // the ancestor feerates and make the decision based on that,
-                // but for now requiring all new inputs to be confirmed works.
-                if (!setConflictsParents.count(tx.vin[j].prevout.hash))
-                {
-                    // Rather than check the UTXO set - potentially expensive -
-                    // it's cheaper to just check if the new input refers to a
-                    // tx that's in the mempool.
-                    if (pool.exists(tx.vin[j].prevout.hash)) {
-                        return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_NONSTANDARD, "replacement-adds-unconfirmed",
-                                         strprintf("replacement %s adds unconfirmed input, idx %d",
-                                                  hash.ToString(), j));
-                    }
-                }
+                return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "insufficient fee",
+                        strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
+                              hash.ToString(),
+                              newFeeRate.ToString(),
+                              oldFeeRate.ToString()));
             }
 
-            // The replacement must pay greater fees than the transactions it
-            // replaces - if we did the bandwidth used by those conflicting
-            // transactions would not be paid for.
-            if (nModifiedFees < nConflictingFees)
+            for (const CTxIn &txin : mi->GetTx().vin)
             {
-                return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "insufficient fee",
-                                 strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
-                                          hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
+                setConflictsParents.insert(txin.prevout.hash);
             }
 
-            // Finally in addition to paying more fees than the conflicts the
-            // new transaction must pay for its own bandwidth.
-            CAmount nDeltaFees = nModifiedFees - nConflictingFees;
-            if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
-            {
-                return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "insufficient fee",
-                        strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
-                              hash.ToString(),
-                              FormatMoney(nDeltaFees),
-                              FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+            nConflictingCount += mi->GetCountWithDescendants();
+        }
+        // This potentially overestimates the number of actual descendants
+        // but we just want to be conservative to avoid doing too much
+        // work.
+        if (nConflictingCount <= maxDescendantsToVisit) {
+            // If not too many to replace, then calculate the set of
+            // transactions that would have to be evicted
+            for (CTxMemPool::txiter it : setIterConflicting) {
+                pool.CalculateDescendants(it, allConflicting);
+            }
+            for (CTxMemPool::txiter it : allConflicting) {
+                nConflictingFees += it->GetModifiedFee();
+                nConflictingSize += it->GetTxSize();
             }
+        } else {
+            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_NONSTANDARD, "too many potential replacements",
+                    strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
+                        hash.ToString(),
+                        nConflictingCount,
+                        maxDescendantsToVisit));
         }
 
-        constexpr unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false,
-                        state.GetRejectCode(), state.GetRejectReason(), state.GetDebugMessage());
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            // We don't want to accept replacements that require low
+            // feerate junk to be mined first. Ideally we'd keep track of
+            // the ancestor feerates and make the decision based on that,
+            // but for now requiring all new inputs to be confirmed works.
+            if (!setConflictsParents.count(tx.vin[j].prevout.hash))
+            {
+                // Rather than check the UTXO set - potentially expensive -
+                // it's cheaper to just check if the new input refers to a
+                // tx that's in the mempool.
+                if (pool.exists(tx.vin[j].prevout.hash)) {
+                    return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_NONSTANDARD, "replacement-adds-unconfirmed",
+                                     strprintf("replacement %s adds unconfirmed input, idx %d",
+                                              hash.ToString(), j));
+                }
             }
-            assert(IsTransactionReason(state.GetReason()));
-            return false; // state filled in by CheckInputs
-        }
-
-        // Check again against the current block tip's script verification
-        // flags to cache our script execution flags. This is, of course,
-        // useless if the next block has different script flags from the
-        // previous one, but because the cache tracks script flags for us it
-        // will auto-invalidate and we'll just have a few blocks of extra
-        // misses on soft-fork activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(::ChainActive().Tip(), chainparams.GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata)) {
-            return error("%s: BUG! PLEASE REPORT THIS! CheckInputs failed against latest-block but not STANDARD flags %s, %s",
-                    __func__, hash.ToString(), FormatStateMessage(state));
         }
 
-        if (test_accept) {
-            // Tx was accepted, but not added
-            return true;
+        // The replacement must pay greater fees than the transactions it
+        // replaces - if we did the bandwidth used by those conflicting
+        // transactions would not be paid for.
+        if (nModifiedFees < nConflictingFees)
+        {
+            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "insufficient fee",
+                             strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
+                                      hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
         }
 
-        // Remove conflicting transactions from the mempool
-        for (CTxMemPool::txiter it : allConflicting)
+        // Finally in addition to paying more fees than the conflicts the
+        // new transaction must pay for its own bandwidth.
+        CAmount nDeltaFees = nModifiedFees - nConflictingFees;
+        if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
         {
-            LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-            if (plTxnReplaced)
-                plTxnReplaced->push_back(it->GetSharedTx());
+            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "insufficient fee",
+                    strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
+                          hash.ToString(),
+                          FormatMoney(nDeltaFees),
+                          FormatMoney(::incrementalRelayFee.GetFee(nSize))));
         }
-        pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+    }
+
+
+    ws.m_block_script_flags = GetBlockScriptFlags(::ChainActive().Tip(), chainparams.GetConsensus());
+    if (!CheckCoinsFromMempoolAndCache(tx, view, pool)) {
+        return error("%s: BUG! PLEASE REPORT THIS! inputs of %s not found in the mempool or coins cache", __func__, hash.ToString());
+    }
+    ws.m_tip = ::ChainActive().Tip();
+    ws.m_pool_updates = pool.GetTransactionsUpdated();
+
+    return true;
+}
 
-        // This transaction should only count for fee estimation if:
-        // - it isn't a BIP 125 replacement transaction (may not be widely supported)
-        // - it's not being re-added during a reorg which bypasses typical mempool fee limits
-        // - the node is not behind
-        // - the transaction is not dependent on any other transactions in the mempool
-        bool validForFeeEstimation = !fReplacementTransaction && !bypass_limits && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+/**
+ * Verify the scripts of a transaction against the coins loaded by
+ * MemPoolInputChecks, with the standard flags and then with the flags of the
+ * next block. Needs neither cs_main nor the mempool lock.
+ */
+static bool MemPoolScriptChecks(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int block_script_flags, PrecomputedTransactionData& txdata)
+{
+    constexpr unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    if (!CheckInputsForMempool(tx, state, view, scriptVerifyFlags, txdata)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        CValidationState stateDummy; // Want reported failures to be from first CheckInputs
+        if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+            !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.Invalid(ValidationInvalidReason::TX_WITNESS_MUTATED, false,
+                    state.GetRejectCode(), state.GetRejectReason(), state.GetDebugMessage());
+        }
+        assert(IsTransactionReason(state.GetReason()));
+        return false; // state filled in by CheckInputs
+    }
+
+    // Check again against the current block tip's script verification
+    // flags to cache our script execution flags. This is, of course,
+    // useless if the next block has different script flags from the
+    // previous one, but because the cache tracks script flags for us it
+    // will auto-invalidate and we'll just have a few blocks of extra
+    // misses on soft-fork activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    if (!CheckInputs(tx, state, view, true, block_script_flags, true, true, txdata)) {
+        return error("%s: BUG! PLEASE REPORT THIS! CheckInputs failed against latest-block but not STANDARD flags %s, %s",
+                __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+    }
+
+    return true;
+}
+
+/** Add a transaction that passed all checks to the mempool, replacing the transactions it conflicts with. */
+static bool MemPoolFinalize(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, std::list<CTransactionRef>* plTxnReplaced,
+                            bool bypass_limits, MemPoolAcceptWorkspace& ws) EXCLUSIVE_LOCKS_REQUIRED(cs_main, pool.cs)
+{
+    const CTransaction& tx = *ptx;
+    const uint256 hash = tx.GetHash();
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+
+    CTxMemPool::setEntries& allConflicting = ws.m_all_conflicting;
+    CTxMemPool::setEntries& setAncestors = ws.m_ancestors;
+    std::unique_ptr<CTxMemPoolEntry>& entry = ws.m_entry;
+    const bool fReplacementTransaction = ws.m_replacement_transaction;
+    const CAmount nModifiedFees = ws.m_modified_fees;
+    const CAmount nConflictingFees = ws.m_conflicting_fees;
+    const size_t nConflictingSize = ws.m_conflicting_size;
+    const unsigned int nSize = entry->GetTxSize();
+
+    // Remove conflicting transactions from the mempool
+    for (CTxMemPool::txiter it : allConflicting)
+    {
+        LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(nModifiedFees - nConflictingFees),
+                (int)nSize - (int)nConflictingSize);
+        if (plTxnReplaced)
+            plTxnReplaced->push_back(it->GetSharedTx());
+    }
+    pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
+
+    // This transaction should only count for fee estimation if:
+    // - it isn't a BIP 125 replacement transaction (may not be widely supported)
+    // - it's not being re-added during a reorg which bypasses typical mempool fee limits
+    // - the node is not behind
+    // - the transaction is not dependent on any other transactions in the mempool
+    bool validForFeeEstimation = !fReplacementTransaction && !bypass_limits && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+
+    // Store transaction in memory
+    pool.addUnchecked(*entry, setAncestors, validForFeeEstimation);
+
+    // trim mempool and check if tx was trimmed
+    if (!bypass_limits) {
+        LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
+
+    return true;
+}
+
+/**
+ * Check a transaction and add it to the mempool.
+ *
+ * cs_main and pool.cs are only held while the transaction is checked against
+ * the chain tip and the mempool and while it is added, not while its scripts
+ * are verified, so that callers that do not hold cs_main can accept several
+ * transactions at once. If the tip or the mempool changed while the scripts
+ * were verified, the checks against them are repeated before adding the
+ * transaction. The scripts are not verified again: an outpoint always refers
+ * to the same coin, so the results stand unless the next block's script
+ * flags changed.
+ *
+ * See MemPoolInputChecks for coins_to_uncache.
+ */
+static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool bypass_limits, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache, bool test_accept)
+{
+    const CTransaction& tx = *ptx;
+    if (pfMissingInputs) {
+        *pfMissingInputs = false;
+    }
+
+    if (!MemPoolPreChecks(tx, state)) {
+        return false; // state filled in by MemPoolPreChecks
+    }
+
+    std::unique_ptr<MemPoolAcceptWorkspace> ws = MakeUnique<MemPoolAcceptWorkspace>();
+    {
+        LOCK2(cs_main, pool.cs);
+        if (!MemPoolInputChecks(chainparams, pool, state, ptx, pfMissingInputs, nAcceptTime, bypass_limits, nAbsurdFee, coins_to_uncache, *ws)) {
+            return false;
+        }
+    }
 
-        // Store transaction in memory
-        pool.addUnchecked(entry, setAncestors, validForFeeEstimation);
+    PrecomputedTransactionData txdata(tx);
+    if (!MemPoolScriptChecks(tx, state, ws->m_view, ws->m_block_script_flags, txdata)) {
+        return false; // state filled in by CheckInputs
+    }
 
-        // trim mempool and check if tx was trimmed
-        if (!bypass_limits) {
-            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.Invalid(ValidationInvalidReason::TX_MEMPOOL_POLICY, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    LOCK2(cs_main, pool.cs); // mempool "read lock" (held through GetMainSignals().TransactionAddedToMempool())
+    if (::ChainActive().Tip() != ws->m_tip || pool.GetTransactionsUpdated() != ws->m_pool_updates) {
+        const unsigned int checked_script_flags = ws->m_block_script_flags;
+        ws = MakeUnique<MemPoolAcceptWorkspace>();
+        if (!MemPoolInputChecks(chainparams, pool, state, ptx, pfMissingInputs, nAcceptTime, bypass_limits, nAbsurdFee, coins_to_uncache, *ws)) {
+            return false;
         }
+        if (ws->m_block_script_flags != checked_script_flags && !CheckInputs(tx, state, ws->m_view, true, ws->m_block_script_flags, true, true, txdata)) {
+            return error("%s: BUG! PLEASE REPORT THIS! CheckInputs failed against latest-block but not STANDARD flags %s, %s",
+                    __func__, tx.GetHash().ToString(), FormatStateMessage(state));
+        }
+    }
+
+    if (test_accept) {
+        // Tx was accepted, but not added
+        return true;
+    }
+
+    if (!MemPoolFinalize(pool, state, ptx, plTxnReplaced, bypass_limits, *ws)) {
+        return false;
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -977,10 +1169,11 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 static bool AcceptToMemoryPoolWithTime(const CChainParams& chainparams, CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept)
 {
     std::vector<COutPoint> coins_to_uncache;
     bool res = AcceptToMemoryPoolWorker(chainparams, pool, state, tx, pfMissingInputs, nAcceptTime, plTxnReplaced, bypass_limits, nAbsurdFee, coins_to_uncache, test_accept);
+    LOCK(cs_main);
     if (!res) {
         // Remove coins that were not present in the coins cache before calling ATMPW;
         // this is to prevent memory DoS in case we receive a large number of
@@ -1004,6 +1197,51 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, pfMissingInputs, GetTime(), plTxnReplaced, bypass_limits, nAbsurdFee, test_accept);
 }
 
+/**
+ * Read the transaction txid from the block at pindex through the block's
+ * transaction offset table, without reading the rest of the block. Returns
+ * false if there is no table for the block or the transaction is not found
+ * through it.
+ */
+static bool ReadTransactionFromDisk(CTransactionRef& tx, const uint256& txid, const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA)) return false;
+    CBlockTxOffsets offsets;
+    const auto dirty = mapDirtyBlockTxOffsets.find(pindex->GetBlockHash());
+    if (dirty != mapDirtyBlockTxOffsets.end()) {
+        offsets = dirty->second;
+    } else if (!pblocktree->ReadBlockTxOffsets(pindex->GetBlockHash(), offsets)) {
+        return false;
+    }
+
+    const FlatFilePos block_pos = pindex->GetBlockPos();
+    std::shared_ptr<const MappedFile> mapping;
+    Span<const unsigned char> record;
+    const bool mapped = MapFileRecord(g_block_file_maps, BlockFileSeq(), block_pos, 0, mapping, record);
+    const uint16_t short_txid = CBlockTxOffsets::ShortTxid(txid);
+    uint64_t next_offset = offsets.GetFirstTxOffset();
+    for (size_t i = 0; i < offsets.short_txids.size(); ++i) {
+        const uint64_t offset = next_offset;
+        next_offset += offsets.tx_sizes[i];
+        if (offsets.short_txids[i] != short_txid) continue;
+        try {
+            if (mapped) {
+                if (offset > (uint64_t)record.size()) return false;
+                SpanReader reader(SER_DISK, CLIENT_VERSION, record.subspan(offset));
+                reader >> tx;
+            } else {
+                CAutoFile filein(OpenBlockFile(FlatFilePos(block_pos.nFile, block_pos.nPos + offset), true), SER_DISK, CLIENT_VERSION);
+                if (filein.IsNull()) return false;
+                filein >> tx;
+            }
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), block_pos.ToString());
+        }
+        if (tx->GetHash() == txid) return true;
+    }
+    return false;
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -1023,6 +1261,10 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
             return g_txindex->FindTx(hash, hashBlock, txOut);
         }
     } else {
+        if (ReadTransactionFromDisk(txOut, hash, block_index)) {
+            hashBlock = block_index->GetBlockHash();
+            return true;
+        }
         CBlock block;
         if (ReadBlockFromDisk(block, block_index, consensusParams)) {
             for (const auto& tx : block.vtx) {
@@ -1069,18 +1311,47 @@ static bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos, const CMessa
     return true;
 }
 
+/**
+ * Find the record at pos in a block or undo file through a memory mapping of the file, so it can
+ * be deserialized in place. Only files no longer appended to are mapped, and only with
+ * -mapblockfiles, since an I/O error while reading a mapping raises SIGBUS instead of failing the
+ * read. The record spans the size written in front of it, plus trailing_size bytes after it.
+ * Returns false, for the caller to read the file instead, if the file is not mapped or the record
+ * does not fit in the mapping.
+ */
+static bool MapFileRecord(FlatFileMapCache& maps, const FlatFileSeq& seq, const FlatFilePos& pos, size_t trailing_size, std::shared_ptr<const MappedFile>& mapping, Span<const unsigned char>& record)
+{
+    if (!fMapBlockFiles) return false;
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile >= nLastBlockFile) return false;
+    }
+    if (pos.nPos < 8) return false;
+    mapping = maps.Map(seq, pos.nFile);
+    if (!mapping || pos.nPos > mapping->size()) return false;
+    const size_t record_size = ReadLE32(mapping->data() + pos.nPos - 4) + trailing_size;
+    if (record_size > mapping->size() - pos.nPos) return false;
+    record = Span<const unsigned char>(mapping->data() + pos.nPos, record_size);
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
+    // Read block, from a mapping of the history file if there is one
+    std::shared_ptr<const MappedFile> mapping;
+    Span<const unsigned char> record;
     try {
-        filein >> block;
+        if (MapFileRecord(g_block_file_maps, BlockFileSeq(), pos, 0, mapping, record)) {
+            SpanReader reader(SER_DISK, CLIENT_VERSION, record);
+            reader >> block;
+        } else {
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1111,6 +1382,16 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
+    std::shared_ptr<const MappedFile> mapping;
+    Span<const unsigned char> record;
+    if (MapFileRecord(g_block_file_maps, BlockFileSeq(), pos, 0, mapping, record) &&
+        memcmp(record.data() - 8, message_start, CMessageHeader::MESSAGE_START_SIZE) == 0 &&
+        (size_t)record.size() <= MAX_SIZE) {
+        block.assign(record.begin(), record.end());
+        return true;
+    }
+    // Otherwise read the file, reporting any problem with the record.
+
     FlatFilePos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
     CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
@@ -1349,6 +1630,8 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 
 static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
 static uint256 scriptExecutionCacheNonce(GetRandHash());
+//! Serializes inserts into scriptExecutionCache; lookups do not take it
+static Mutex cs_scriptExecutionCache;
 
 void InitScriptExecutionCache() {
     // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
@@ -1374,9 +1657,11 @@ void InitScriptExecutionCache() {
  * Note that we may set state.reason to NOT_STANDARD for extra soft-fork flags in flags, block-checking
  * callers should probably reset it to CONSENSUS in such cases.
  *
+ * Does not need cs_main, as long as inputs is not modified concurrently.
+ *
  * Non-static (and re-declared) in src/test/txvalidationcache_tests.cpp
  */
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -1403,7 +1688,6 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             // round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
             static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
             CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
-            AssertLockHeld(cs_main); //TODO: Remove this requirement by making CuckooCache not require external locks
             if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore)) {
                 return true;
             }
@@ -1455,6 +1739,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             if (cacheFullScriptStore && !pvChecks) {
                 // We executed all of the provided scripts, and were told to
                 // cache the result. Do so now.
+                LOCK(cs_scriptExecutionCache);
                 scriptExecutionCache.insert(hashCacheEntry);
             }
         }
@@ -1490,23 +1775,14 @@ static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+template <typename Stream>
+static bool UndoReadFromStream(CBlockUndo& blockundo, Stream& filein, const uint256& hashPrevBlock)
 {
-    FlatFilePos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
-        return error("%s: no undo data available", __func__);
-    }
-
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
     // Read block
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CHashVerifier<Stream> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
-        verifier << pindex->pprev->GetBlockHash();
+        verifier << hashPrevBlock;
         verifier >> blockundo;
         filein >> hashChecksum;
     }
@@ -1521,6 +1797,33 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
     return true;
 }
 
+static bool UndoReadFromDisk(CBlockUndo& blockundo, const FlatFilePos& pos, const uint256& hashPrevBlock)
+{
+    // Read from a mapping of the history file if there is one
+    std::shared_ptr<const MappedFile> mapping;
+    Span<const unsigned char> record;
+    if (MapFileRecord(g_undo_file_maps, UndoFileSeq(), pos, sizeof(uint256), mapping, record)) {
+        SpanReader reader(SER_DISK, CLIENT_VERSION, record);
+        return UndoReadFromStream(blockundo, reader, hashPrevBlock);
+    }
+
+    // Open history file to read
+    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenUndoFile failed", __func__);
+
+    return UndoReadFromStream(blockundo, filein, hashPrevBlock);
+}
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    FlatFilePos pos = pindex->GetUndoPos();
+    if (pos.IsNull()) {
+        return error("%s: no undo data available", __func__);
+    }
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
 /** Abort with a message */
 static bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1575,12 +1878,14 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, RollingCoinsStats* stats, CBlockUndo* pundo)
 {
     bool fClean = true;
 
     CBlockUndo blockUndo;
-    if (!UndoReadFromDisk(blockUndo, pindex)) {
+    if (pundo) {
+        blockUndo = std::move(*pundo);
+    } else if (!UndoReadFromDisk(blockUndo, pindex)) {
         error("DisconnectBlock(): failure reading undo data");
         return DISCONNECT_FAILED;
     }
@@ -1606,6 +1911,7 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
                 if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase) {
                     fClean = false; // transaction output mismatch
                 }
+                if (stats && is_spent) stats->Remove(out, coin);
             }
         }
 
@@ -1618,9 +1924,17 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
             }
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
+                if (stats) {
+                    const Coin& overwritten = view.AccessCoin(out);
+                    if (!overwritten.IsSpent()) stats->Remove(out, overwritten);
+                }
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
+                if (stats) {
+                    const Coin& restored = view.AccessCoin(out);
+                    if (!restored.IsSpent()) stats->Add(out, restored);
+                }
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -1628,6 +1942,7 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
 
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
+    if (stats) stats->hashBlock = pindex->pprev->GetBlockHash();
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
@@ -1658,6 +1973,8 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
             return error("ConnectBlock(): FindUndoPos failed");
         if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
             return AbortNode(state, "Failed to write undo data");
+        // A mapping of the file would not necessarily show what was written.
+        g_undo_file_maps.Invalidate(_pos.nFile);
 
         // update nUndoPos in block index
         pindex->nUndoPos = _pos.nPos;
@@ -1668,22 +1985,312 @@ static bool WriteUndoDataForBlock(const CBlockUndo& blockundo, CValidationState&
     return true;
 }
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CWorkStealingCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck(int worker_num) {
     util::ThreadRename(strprintf("scriptch.%i", worker_num));
     scriptcheckqueue.Thread();
 }
 
-VersionBitsCache versionbitscache GUARDED_BY(cs_main);
-
-int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
+/**
+ * CheckInputs for a transaction being accepted to the mempool, without
+ * caching the full script execution. The scripts of transactions with at
+ * least MIN_PARALLEL_MEMPOOL_SCRIPT_CHECK_INPUTS inputs are checked on the
+ * script check threads. If that fails, the inputs are checked again in order,
+ * so that state reports the first failing input as it would without threads.
+ */
+static bool CheckInputsForMempool(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags, PrecomputedTransactionData& txdata)
 {
-    LOCK(cs_main);
-    int32_t nVersion = VERSIONBITS_TOP_BITS;
-
-    for (int i = 0; i < (int)Consensus::MAX_VERSION_BITS_DEPLOYMENTS; i++) {
-        ThresholdState state = VersionBitsState(pindexPrev, params, static_cast<Consensus::DeploymentPos>(i), versionbitscache);
+    if (nScriptCheckThreads && tx.vin.size() >= MIN_PARALLEL_MEMPOOL_SCRIPT_CHECK_INPUTS) {
+        std::vector<CScriptCheck> vChecks;
+        if (!CheckInputs(tx, state, view, true, flags, true, false, txdata, &vChecks)) {
+            return false;
+        }
+        CCheckQueueControl<CScriptCheck, CWorkStealingCheckQueue<CScriptCheck>> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        if (control.Wait()) {
+            return true;
+        }
+    }
+    return CheckInputs(tx, state, view, true, flags, true, false, txdata);
+}
+
+/**
+ * Closure reading a single coin from the coins database, so that the inputs of
+ * a block can be looked up from several threads before the block is connected.
+ * Each check writes to its own result slot; a lookup that fails is left empty
+ * and simply repeated (and reported) by ConnectBlock. If missing is given, it
+ * is set when the coin was found not to exist, as opposed to the lookup
+ * failing.
+ */
+class CCoinsPrefetchCheck
+{
+private:
+    const CCoinsView* m_view;
+    COutPoint m_outpoint;
+    Coin* m_coin;
+    bool* m_missing;
+
+public:
+    CCoinsPrefetchCheck() : m_view(nullptr), m_coin(nullptr), m_missing(nullptr) {}
+    CCoinsPrefetchCheck(const CCoinsView* view, const COutPoint& outpoint, Coin* coin, bool* missing = nullptr) : m_view(view), m_outpoint(outpoint), m_coin(coin), m_missing(missing) {}
+
+    bool operator()()
+    {
+        try {
+            if (!m_view->GetCoin(m_outpoint, *m_coin)) {
+                m_coin->Clear();
+                if (m_missing) *m_missing = true;
+            }
+        } catch (const std::runtime_error&) {
+            m_coin->Clear();
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetchCheck& check)
+    {
+        std::swap(m_view, check.m_view);
+        std::swap(m_outpoint, check.m_outpoint);
+        std::swap(m_coin, check.m_coin);
+        std::swap(m_missing, check.m_missing);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetchCheck> coinsprefetchqueue(16);
+
+void ThreadCoinsPrefetch(int worker_num) {
+    util::ThreadRename(strprintf("prefetch.%i", worker_num));
+    coinsprefetchqueue.Thread();
+}
+
+/**
+ * Closure running the context-free checks of a single block transaction
+ * (CheckTransaction and the legacy sigop count), so that the transactions of
+ * a new block can be checked from several threads before cs_main is taken.
+ */
+class CBlockTxCheck
+{
+private:
+    const CTransaction* m_tx;
+    unsigned int* m_sigops;
+
+public:
+    CBlockTxCheck() : m_tx(nullptr), m_sigops(nullptr) {}
+    CBlockTxCheck(const CTransaction& tx, unsigned int* sigops) : m_tx(&tx), m_sigops(sigops) {}
+
+    bool operator()()
+    {
+        CValidationState state;
+        if (!CheckTransaction(*m_tx, state, true)) return false;
+        *m_sigops = GetLegacySigOpCount(*m_tx);
+        return true;
+    }
+
+    void swap(CBlockTxCheck& check)
+    {
+        std::swap(m_tx, check.m_tx);
+        std::swap(m_sigops, check.m_sigops);
+    }
+};
+
+static CCheckQueue<CBlockTxCheck> blockcheckqueue(128);
+
+void ThreadBlockCheck(int worker_num) {
+    util::ThreadRename(strprintf("blockch.%i", worker_num));
+    blockcheckqueue.Thread();
+}
+
+namespace {
+/**
+ * Reads blocks ahead of their use on background threads running Thread(), in
+ * the order they are queued. Unlike those of std::async, the futures returned
+ * do not wait for the read when they are destroyed, so a read that is no
+ * longer needed can be dropped at any time, even with cs_main held. Callers
+ * bound how many reads they queue. Until Start() is called, and once the
+ * threads are interrupted, a read runs as soon as it is queued.
+ */
+class BlockReadQueue
+{
+private:
+    boost::mutex m_mutex;
+    boost::condition_variable m_cond;
+    std::deque<std::function<void()>> m_reads;
+    bool m_running{false};
+    bool m_stop{false};
+
+public:
+    //! Queue reads for the threads running Thread() from now on.
+    void Start()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_running = true;
+    }
+
+    //! Make the threads return once done with their current read. Reads still queued are dropped.
+    void Stop()
+    {
+        std::deque<std::function<void()>> reads;
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        m_running = false;
+        m_stop = true;
+        reads.swap(m_reads);
+        m_cond.notify_all();
+    }
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> Push(F read)
+    {
+        typedef typename std::result_of<F()>::type Result;
+        std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(read));
+        std::future<Result> result = task->get_future();
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            if (m_running) {
+                m_reads.emplace_back([task] { (*task)(); });
+                m_cond.notify_one();
+                return result;
+            }
+        }
+        (*task)();
+        return result;
+    }
+
+    //! Serve reads until stopped or interrupted. The reads still queued when interrupted are run before returning.
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(m_mutex);
+        try {
+            while (true) {
+                while (!m_stop && m_reads.empty()) m_cond.wait(lock);
+                if (m_stop) return;
+                std::function<void()> read = std::move(m_reads.front());
+                m_reads.pop_front();
+                lock.unlock();
+                read();
+                lock.lock();
+            }
+        } catch (const boost::thread_interrupted&) {
+            m_running = false;
+            std::deque<std::function<void()>> reads;
+            reads.swap(m_reads);
+            lock.unlock();
+            for (const std::function<void()>& read : reads) read();
+            throw;
+        }
+    }
+};
+} // namespace
+
+static BlockReadQueue blockreadqueue;
+
+void ThreadBlockRead() {
+    util::ThreadRename("blockread");
+    blockreadqueue.Start();
+    blockreadqueue.Thread();
+}
+
+/**
+ * Warm pcoinsTip with the inputs of a block that are not cached yet, reading
+ * them from the coins database in parallel. ConnectBlock otherwise looks them
+ * up one at a time, which dominates connection time once the UTXO set no
+ * longer fits in the cache. Outputs created earlier in the same block are
+ * skipped, and entries already in the cache are never replaced.
+ */
+static void PrefetchBlockInputs(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    if (!nCoinsPrefetchThreads) return;
+
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vOutpoints;
+    for (const auto& tx : block.vtx) {
+        if (!tx->IsCoinBase()) {
+            for (const CTxIn& txin : tx->vin) {
+                if (!setBlockTxids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                    vOutpoints.push_back(txin.prevout);
+                }
+            }
+        }
+        setBlockTxids.insert(tx->GetHash());
+    }
+    if (vOutpoints.empty()) return;
+
+    std::vector<Coin> vCoins(vOutpoints.size());
+    std::vector<CCoinsPrefetchCheck> vChecks;
+    vChecks.reserve(vOutpoints.size());
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        vChecks.emplace_back(pcoinsdbview.get(), vOutpoints[i], &vCoins[i]);
+    }
+    CCheckQueueControl<CCoinsPrefetchCheck> control(&coinsprefetchqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        pcoinsTip->EmplaceCoinFromBase(vOutpoints[i], std::move(vCoins[i]));
+    }
+}
+
+/**
+ * Warm pcoinsTip for disconnecting a block: with the outputs of the block,
+ * which DisconnectBlock spends, and with the outputs the block spent, which it
+ * restores after checking that they do not exist. All of them are looked up
+ * in the coins database in parallel. The cache does not remember outpoints
+ * missing from the database, so those found missing (normally all of the
+ * restored ones) are recorded as spent entries.
+ */
+static void PrefetchDisconnectCoins(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    if (!nCoinsPrefetchThreads) return;
+
+    std::vector<COutPoint> vOutpoints;
+    for (const auto& tx : block.vtx) {
+        for (size_t o = 0; o < tx->vout.size(); o++) {
+            COutPoint out(tx->GetHash(), o);
+            if (!tx->vout[o].scriptPubKey.IsUnspendable() && !pcoinsTip->HaveCoinInCache(out)) {
+                vOutpoints.push_back(out);
+            }
+        }
+        if (!tx->IsCoinBase()) {
+            for (const CTxIn& txin : tx->vin) {
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                    vOutpoints.push_back(txin.prevout);
+                }
+            }
+        }
+    }
+    if (vOutpoints.empty()) return;
+
+    std::vector<Coin> vCoins(vOutpoints.size());
+    std::unique_ptr<bool[]> vMissing(new bool[vOutpoints.size()]());
+    std::vector<CCoinsPrefetchCheck> vChecks;
+    vChecks.reserve(vOutpoints.size());
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        vChecks.emplace_back(pcoinsdbview.get(), vOutpoints[i], &vCoins[i], &vMissing[i]);
+    }
+    CCheckQueueControl<CCoinsPrefetchCheck> control(&coinsprefetchqueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    for (size_t i = 0; i < vOutpoints.size(); i++) {
+        if (vMissing[i]) {
+            pcoinsTip->EmplaceSpentCoinFromBase(vOutpoints[i]);
+        } else {
+            pcoinsTip->EmplaceCoinFromBase(vOutpoints[i], std::move(vCoins[i]));
+        }
+    }
+}
+
+VersionBitsCache versionbitscache GUARDED_BY(cs_main);
+
+int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
+{
+    LOCK(cs_main);
+    int32_t nVersion = VERSIONBITS_TOP_BITS;
+
+    for (int i = 0; i < (int)Consensus::MAX_VERSION_BITS_DEPLOYMENTS; i++) {
+        ThresholdState state = VersionBitsState(pindexPrev, params, static_cast<Consensus::DeploymentPos>(i), versionbitscache);
         if (state == ThresholdState::LOCKED_IN || state == ThresholdState::STARTED) {
             nVersion |= VersionBitsMask(params, static_cast<Consensus::DeploymentPos>(i));
         }
@@ -1787,7 +2394,7 @@ static int64_t nBlocksTotal = 0;
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, RollingCoinsStats* stats)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1824,8 +2431,10 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
+        if (!fJustCheck) {
             view.SetBestBlock(pindex->GetBlockHash());
+            if (stats) stats->hashBlock = pindex->GetBlockHash();
+        }
         return true;
     }
 
@@ -1840,7 +2449,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         //  effectively caching the result of part of the verification.
         BlockMap::const_iterator  it = mapBlockIndex.find(hashAssumeValid);
         if (it != mapBlockIndex.end()) {
-            if (it->second->GetAncestor(pindex->nHeight) == pindex &&
+            if (it->second.GetAncestor(pindex->nHeight) == pindex &&
                 pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
                 pindexBestHeader->nChainWork >= nMinimumChainWork) {
                 // This block is a member of the assumed verified chain and an ancestor of the best header.
@@ -1858,6 +2467,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     }
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
+    if (!fJustCheck) g_validation_stats.Add(VALIDATION_STAGE_CHECK, nTime1 - nTimeStart);
     LogPrint(BCLog::BENCH, "    - Sanity checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime1 - nTimeStart), nTimeCheck * MICRO, nTimeCheck * MILLI / nBlocksTotal);
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
@@ -1960,11 +2570,15 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
+    if (!fJustCheck) g_validation_stats.Add(VALIDATION_STAGE_FORKS, nTime2 - nTime1);
     LogPrint(BCLog::BENCH, "    - Fork checks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime2 - nTime1), nTimeForks * MICRO, nTimeForks * MILLI / nBlocksTotal);
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    CCheckQueueControl<CScriptCheck, CWorkStealingCheckQueue<CScriptCheck>> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+
+    // Unspent coins that the (BIP30-violating) coinbase overwrites, to take out of stats
+    std::vector<std::pair<COutPoint, Coin>> overwritten_coins;
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
@@ -2044,6 +2658,14 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
             control.Add(vChecks);
         }
 
+        if (stats && !fEnforceBIP30 && tx.IsCoinBase()) {
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                const COutPoint out(tx.GetHash(), o);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent()) overwritten_coins.emplace_back(out, coin);
+            }
+        }
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2051,6 +2673,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    if (!fJustCheck) g_validation_stats.Add(VALIDATION_STAGE_CONNECT, nTime3 - nTime2);
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs (%.2fms/blk)]\n", (unsigned)block.vtx.size(), MILLI * (nTime3 - nTime2), MILLI * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : MILLI * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * MICRO, nTimeConnect * MILLI / nBlocksTotal);
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
@@ -2063,6 +2686,7 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!control.Wait())
         return state.Invalid(ValidationInvalidReason::CONSENSUS, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
+    if (!fJustCheck) g_validation_stats.Add(VALIDATION_STAGE_VERIFY, nTime4 - nTime2);
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
     if (fJustCheck)
@@ -2076,14 +2700,37 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
         setDirtyBlockIndex.insert(pindex);
     }
 
+    if (stats) {
+        for (const auto& overwritten : overwritten_coins) {
+            stats->Remove(overwritten.first, overwritten.second);
+        }
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *(block.vtx[i]);
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+                for (size_t j = 0; j < tx.vin.size(); j++) {
+                    stats->Remove(tx.vin[j].prevout, txundo.vprevout[j]);
+                }
+            }
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                    stats->Add(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase()));
+                }
+            }
+        }
+    }
+
     assert(pindex->phashBlock);
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
+    if (stats) stats->hashBlock = pindex->GetBlockHash();
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    g_validation_stats.Add(VALIDATION_STAGE_INDEX, nTime5 - nTime4);
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime5 - nTime4), nTimeIndex * MICRO, nTimeIndex * MILLI / nBlocksTotal);
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
+    g_validation_stats.Add(VALIDATION_STAGE_CALLBACKS, nTime6 - nTime5);
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime6 - nTime5), nTimeCallbacks * MICRO, nTimeCallbacks * MILLI / nBlocksTotal);
 
     return true;
@@ -2103,6 +2750,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
+    // Chain state of a background coins write, signalled once it is written
+    static bool fBackgroundFlushPending = false;
+    static CBlockLocator background_flush_locator;
     std::set<int> setFilesToPrune;
     bool full_flush_completed = false;
     try {
@@ -2134,7 +2784,8 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastFlush = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // Freed pool memory of the cache is reused before it grows, so it does not count towards the limit.
+        int64_t cacheSize = pcoinsTip->UsedDynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FlushStateMode::PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -2142,12 +2793,14 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         bool fCacheCritical = mode == FlushStateMode::IF_NEEDED && cacheSize > nTotalSpace;
         // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
         bool fPeriodicWrite = mode == FlushStateMode::PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
+        // The unwritten transaction offset tables have grown large.
+        bool fTxOffsetsLarge = mode != FlushStateMode::NONE && nDirtyBlockTxOffsetsUsage > MAX_DIRTY_BLOCK_TX_OFFSETS_USAGE;
         // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
         bool fPeriodicFlush = mode == FlushStateMode::PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
         // Write blocks and block index to disk.
-        if (fDoFullFlush || fPeriodicWrite) {
+        if (fDoFullFlush || fPeriodicWrite || fTxOffsetsLarge) {
             // Depend on nMinDiskSpace to ensure we can write block index
             if (!CheckDiskSpace(GetBlocksDir())) {
                 return AbortNode(state, "Disk space is low!", _("Error: Disk space is low!"));
@@ -2168,13 +2821,17 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     vBlocks.push_back(*it);
                     setDirtyBlockIndex.erase(it++);
                 }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+                std::vector<std::pair<uint256, const CBlockTxOffsets*> > vTxOffsets;
+                vTxOffsets.reserve(mapDirtyBlockTxOffsets.size());
+                for (const auto& entry : mapDirtyBlockTxOffsets) {
+                    vTxOffsets.emplace_back(entry.first, &entry.second);
+                }
+                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, vTxOffsets)) {
                     return AbortNode(state, "Failed to write to block index database");
                 }
+                mapDirtyBlockTxOffsets.clear();
+                nDirtyBlockTxOffsetsUsage = 0;
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
-                UnlinkPrunedFiles(setFilesToPrune);
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2187,16 +2844,53 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(GetDataDir(), 48 * 2 * 2 * pcoinsTip->GetCacheSize())) {
                 return AbortNode(state, "Disk space is low!", _("Error: Disk space is low!"));
             }
-            // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // At most one background write is in progress, so wait for the
+            // previous one. This also bounds the memory held by written coins.
+            if (!pcoinsdbview->WaitForBackgroundWrite())
+                return AbortNode(state, "Failed to write to coin database");
+            // Flush the chainstate (which may refer to block index entries),
+            // storing the UTXO set statistics next to the best block marker.
+            if (g_coins_stats) pcoinsdbview->SetRollingStats(*g_coins_stats);
+            // Routine flushes can be written in the background while blocks
+            // keep connecting on the emptied cache. Callers of ALWAYS expect
+            // the database to be complete when this returns, and pruned files
+            // may only be removed once the coins no longer need their blocks.
+            const bool fBackgroundWrite = fBackgroundFlush && mode != FlushStateMode::ALWAYS && !fFlushForPrune;
+            if (fBackgroundWrite)
+                pcoinsdbview->RequestBackgroundWrite();
+            if (fPartialFlush) {
+                // Keep the working set cached, so the next blocks do not
+                // start on a cold cache. Only when the cache is full, make
+                // room by dropping the least recently used coins.
+                if (!pcoinsTip->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
+                if (fCacheLarge || fCacheCritical) {
+                    const unsigned int nCachedBefore = pcoinsTip->GetCacheSize();
+                    pcoinsTip->Trim(nTotalSpace * PARTIAL_FLUSH_TARGET_PERCENT / 100);
+                    LogPrint(BCLog::COINDB, "Evicted %u coins from the coins cache, %u left (%.1fMiB)\n", nCachedBefore - pcoinsTip->GetCacheSize(), pcoinsTip->GetCacheSize(), pcoinsTip->UsedDynamicMemoryUsage() * (1.0 / (1 << 20)));
+                }
+            } else if (!pcoinsTip->Flush()) {
                 return AbortNode(state, "Failed to write to coin database");
+            }
             nLastFlush = nNow;
-            full_flush_completed = true;
+            fBackgroundFlushPending = fBackgroundWrite;
+            if (fBackgroundWrite) {
+                background_flush_locator = ::ChainActive().GetLocator();
+            } else {
+                full_flush_completed = true;
+            }
         }
+        // Finally remove any pruned files, now that the chainstate is written
+        if (fFlushForPrune)
+            UnlinkPrunedFiles(setFilesToPrune);
     }
     if (full_flush_completed) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().ChainStateFlushed(::ChainActive().GetLocator());
+    } else if (fBackgroundFlushPending && pcoinsdbview->IsBackgroundWriteDone()) {
+        // Only report a background write once it is in the database.
+        fBackgroundFlushPending = false;
+        GetMainSignals().ChainStateFlushed(background_flush_locator);
     }
     } catch (const std::runtime_error& e) {
         return AbortNode(state, std::string("System error while flushing: ") + e.what());
@@ -2298,24 +2992,32 @@ void static UpdateTip(const CBlockIndex *pindexNew, const CChainParams& chainPar
   * disconnectpool (note that the caller is responsible for mempool consistency
   * in any case).
   */
-bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool)
+bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool, std::shared_ptr<const CBlock> pblock, std::unique_ptr<CBlockUndo> pundo)
 {
     CBlockIndex *pindexDelete = m_chain.Tip();
     assert(pindexDelete);
-    // Read block from disk.
-    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-    CBlock& block = *pblock;
-    if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
-        return AbortNode(state, "Failed to read block");
+    // Read block from disk, unless it was read ahead.
+    if (!pblock || pblock->GetHash() != pindexDelete->GetBlockHash()) {
+        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockNew, pindexDelete, chainparams.GetConsensus()))
+            return AbortNode(state, "Failed to read block");
+        pblock = std::move(pblockNew);
+        pundo.reset();
+    }
+    const CBlock& block = *pblock;
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
+        PrefetchDisconnectCoins(block);
         CCoinsViewCache view(pcoinsTip.get());
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        std::unique_ptr<RollingCoinsStats> stats;
+        if (g_coins_stats) stats = MakeUnique<RollingCoinsStats>(*g_coins_stats);
+        if (DisconnectBlock(block, pindexDelete, view, stats.get(), pundo.get()) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        if (stats) g_coins_stats = std::move(stats);
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
@@ -2345,6 +3047,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2435,11 +3138,18 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     const CBlock& blockConnecting = *pthisBlock;
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    g_validation_stats.Add(VALIDATION_STAGE_READ, nTime2 - nTime1);
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
+    PrefetchBlockInputs(blockConnecting);
+    int64_t nTime2_1 = GetTimeMicros(); nTimePrefetch += nTime2_1 - nTime2;
+    g_validation_stats.Add(VALIDATION_STAGE_PREFETCH, nTime2_1 - nTime2);
+    LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2_1 - nTime2) * MILLI, nTimePrefetch * MICRO);
+    nTime2 = nTime2_1;
     {
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        // ConnectBlock only updates the stats once the block is known to be valid.
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, g_coins_stats.get());
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2447,16 +3157,19 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
             return error("%s: ConnectBlock %s failed, %s", __func__, pindexNew->GetBlockHash().ToString(), FormatStateMessage(state));
         }
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        g_validation_stats.Add(VALIDATION_STAGE_CONNECT_TOTAL, nTime3 - nTime2);
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
         bool flushed = view.Flush();
         assert(flushed);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    g_validation_stats.Add(VALIDATION_STAGE_FLUSH, nTime4 - nTime3);
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FlushStateMode::IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
+    g_validation_stats.Add(VALIDATION_STAGE_CHAINSTATE, nTime5 - nTime4);
     LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime5 - nTime4) * MILLI, nTimeChainState * MICRO, nTimeChainState * MILLI / nBlocksTotal);
     // Remove conflicting transactions from the mempool.;
     mempool.removeForBlock(blockConnecting.vtx, pindexNew->nHeight);
@@ -2466,6 +3179,8 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     UpdateTip(pindexNew, chainparams);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
+    g_validation_stats.Add(VALIDATION_STAGE_POST_CONNECT, nTime6 - nTime5);
+    g_validation_stats.Add(VALIDATION_STAGE_TOTAL, nTime6 - nTime1);
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
 
@@ -2473,6 +3188,111 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     return true;
 }
 
+/**
+ * Read a block from disk and run the context-free CheckBlock on it. Used by
+ * ActivateBestChainStep to prepare the blocks following the one being
+ * connected on the block read thread, so it must not take cs_main. Returns
+ * nullptr if the block cannot be read, in which case ConnectTip reads it
+ * again and reports the error. A block failing CheckBlock is returned
+ * unchecked, so that ConnectBlock rejects it with the proper state.
+ */
+static std::shared_ptr<const CBlock> ReadAndCheckBlock(const FlatFilePos pos, const uint256 hash, const Consensus::Params& consensusParams)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblock, pos, consensusParams) || pblock->GetHash() != hash) {
+        return nullptr;
+    }
+    CValidationState state;
+    CheckBlock(*pblock, state, consensusParams);
+    return pblock;
+}
+
+namespace {
+/** A block to be disconnected and its undo data, as read by ReadDisconnectData. */
+struct DisconnectData {
+    std::shared_ptr<const CBlock> block;
+    std::unique_ptr<CBlockUndo> undo;
+};
+} // namespace
+
+/**
+ * Read a block and its undo data from disk, for DisconnectTip. Like
+ * ReadAndCheckBlock this runs on the block read thread, so everything it needs
+ * from the block index is passed by value. Whatever cannot be read is left
+ * empty, for DisconnectTip to read again and report.
+ */
+static DisconnectData ReadDisconnectData(const FlatFilePos pos, const uint256 hash, const FlatFilePos undo_pos, const uint256 hashPrevBlock, const Consensus::Params& consensusParams)
+{
+    DisconnectData data;
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblock, pos, consensusParams) || pblock->GetHash() != hash) {
+        return data;
+    }
+    data.block = std::move(pblock);
+    std::unique_ptr<CBlockUndo> pundo = MakeUnique<CBlockUndo>();
+    if (!undo_pos.IsNull() && UndoReadFromDisk(*pundo, undo_pos, hashPrevBlock)) {
+        data.undo = std::move(pundo);
+    }
+    return data;
+}
+
+namespace {
+/**
+ * Reads the blocks to be disconnected from the tip, and their undo data, on
+ * the block read thread up to BLOCK_READAHEAD_DEPTH blocks ahead of the one
+ * being disconnected, so that disconnecting a run of blocks does not stall on
+ * disk I/O. Reads left over when the chain changes are dropped without
+ * waiting for them.
+ */
+class DisconnectReadahead
+{
+private:
+    //! The blocks to disconnect, tip first
+    std::vector<const CBlockIndex*> m_blocks;
+    std::vector<std::future<DisconnectData>> m_reads;
+    size_t m_next{0};
+    size_t m_read{0};
+    const Consensus::Params& m_params;
+
+public:
+    DisconnectReadahead(std::vector<const CBlockIndex*> blocks, const Consensus::Params& params) : m_blocks(std::move(blocks)), m_reads(m_blocks.size()), m_params(params) {}
+
+    /**
+     * Return what was read for pindex and start reading the blocks after it.
+     * The result is empty unless pindex is the next block of the list, which
+     * it is not if the chain changed since the list was made.
+     */
+    DisconnectData Next(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+    {
+        AssertLockHeld(cs_main);
+        if (m_next >= m_blocks.size() || m_blocks[m_next] != pindex) return DisconnectData();
+        for (; m_read < m_blocks.size() && m_read <= m_next + BLOCK_READAHEAD_DEPTH; m_read++) {
+            const CBlockIndex* pindexRead = m_blocks[m_read];
+            // Blocks without undo data (such as genesis) cannot be disconnected.
+            if (!(pindexRead->nStatus & BLOCK_HAVE_DATA) || !(pindexRead->nStatus & BLOCK_HAVE_UNDO) || !pindexRead->pprev) continue;
+            const FlatFilePos pos = pindexRead->GetBlockPos();
+            const uint256 hash = pindexRead->GetBlockHash();
+            const FlatFilePos undo_pos = pindexRead->GetUndoPos();
+            const uint256 hashPrevBlock = pindexRead->pprev->GetBlockHash();
+            const Consensus::Params& params = m_params;
+            m_reads[m_read] = blockreadqueue.Push([pos, hash, undo_pos, hashPrevBlock, &params] { return ReadDisconnectData(pos, hash, undo_pos, hashPrevBlock, params); });
+        }
+        std::future<DisconnectData>& read = m_reads[m_next++];
+        return read.valid() ? read.get() : DisconnectData();
+    }
+};
+} // namespace
+
+/**
+ * Whether a block may be in setBlockIndexCandidates as far as its validity is
+ * concerned: its transactions were checked, or it is assumed valid below a
+ * loaded UTXO snapshot and not known to be invalid.
+ */
+static bool IsCandidateValid(const CBlockIndex* pindex)
+{
+    return pindex->IsValid(BLOCK_VALID_TRANSACTIONS) || (pindex->IsAssumedValid() && !(pindex->nStatus & BLOCK_FAILED_MASK));
+}
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2553,12 +3373,20 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
 
     const CBlockIndex *pindexOldTip = m_chain.Tip();
     const CBlockIndex *pindexFork = m_chain.FindFork(pindexMostWork);
+    m_activate_step++;
 
-    // Disconnect active blocks which are no longer in the best chain.
+    // Disconnect active blocks which are no longer in the best chain. The
+    // blocks following the one being disconnected are read in the background.
     bool fBlocksDisconnected = false;
     DisconnectedBlockTransactions disconnectpool;
+    std::vector<const CBlockIndex*> vpindexToDisconnect;
+    for (const CBlockIndex* pindexIter = m_chain.Tip(); pindexIter && pindexIter != pindexFork; pindexIter = pindexIter->pprev) {
+        vpindexToDisconnect.push_back(pindexIter);
+    }
+    DisconnectReadahead disconnectReads(std::move(vpindexToDisconnect), chainparams.GetConsensus());
     while (m_chain.Tip() && m_chain.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+        DisconnectData read = disconnectReads.Next(m_chain.Tip());
+        if (!DisconnectTip(state, chainparams, &disconnectpool, std::move(read.block), std::move(read.undo))) {
             // This is likely a fatal error, but keep the mempool consistent,
             // just in case. Only remove from the mempool in this case.
             UpdateMempoolForReorg(disconnectpool, false);
@@ -2584,9 +3412,39 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
-        // Connect new blocks.
+        // Drop reads of blocks that are no longer about to be connected.
+        for (auto it = m_block_reads.begin(); it != m_block_reads.end();) {
+            const bool wanted = std::any_of(vpindexToConnect.begin(), vpindexToConnect.end(), [&it](const CBlockIndex* pindex) { return pindex->GetBlockHash() == it->first; });
+            it = wanted ? std::next(it) : m_block_reads.erase(it);
+        }
+
+        // Connect new blocks. The blocks following the one being connected are
+        // read and checked in the background, so that connecting them does not
+        // stall on disk I/O.
+        size_t nConnectPos = 0;
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            for (size_t nReadPos = nConnectPos; nReadPos < vpindexToConnect.size() && nReadPos <= nConnectPos + BLOCK_READAHEAD_DEPTH; nReadPos++) {
+                const CBlockIndex* pindexRead = vpindexToConnect[vpindexToConnect.size() - 1 - nReadPos];
+                if ((pindexRead == pindexMostWork && pblock) || !(pindexRead->nStatus & BLOCK_HAVE_DATA)) continue;
+                if (m_block_reads.count(pindexRead->GetBlockHash())) continue;
+                const FlatFilePos pos = pindexRead->GetBlockPos();
+                const uint256 hash = pindexRead->GetBlockHash();
+                const Consensus::Params& consensusParams = chainparams.GetConsensus();
+                m_block_reads.emplace(hash, BlockRead{blockreadqueue.Push([pos, hash, &consensusParams] { return ReadAndCheckBlock(pos, hash, consensusParams); }), m_activate_step});
+            }
+            std::shared_ptr<const CBlock> pblockConnect;
+            if (pindexConnect == pindexMostWork && pblock) {
+                pblockConnect = pblock;
+            } else {
+                auto it = m_block_reads.find(pindexConnect->GetBlockHash());
+                if (it != m_block_reads.end()) {
+                    pblockConnect = it->second.block.get();
+                    if (pblockConnect && it->second.step != m_activate_step) m_blocks_read_ahead++;
+                    m_block_reads.erase(it);
+                }
+            }
+            nConnectPos++;
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (state.GetReason() != ValidationInvalidReason::BLOCK_MUTATED) {
@@ -2790,7 +3648,7 @@ bool CChainState::PreciousBlock(CValidationState& state, const CChainParams& par
             // call preciousblock 2**31-1 times on the same set of tips...
             nBlockReverseSequenceId--;
         }
-        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && pindex->HaveTxsDownloaded()) {
+        if (IsCandidateValid(pindex) && pindex->HaveTxsDownloaded()) {
             setBlockIndexCandidates.insert(pindex);
             PruneBlockIndexCandidates();
         }
@@ -2808,6 +3666,19 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
     bool pindex_was_in_chain = false;
     int disconnected = 0;
 
+    // The blocks to disconnect are read in the background, ahead of the one
+    // being disconnected.
+    std::vector<const CBlockIndex*> vpindexToDisconnect;
+    {
+        LOCK(cs_main);
+        if (m_chain.Contains(pindex)) {
+            for (const CBlockIndex* pindexIter = m_chain.Tip(); pindexIter != pindex->pprev; pindexIter = pindexIter->pprev) {
+                vpindexToDisconnect.push_back(pindexIter);
+            }
+        }
+    }
+    DisconnectReadahead disconnectReads(std::move(vpindexToDisconnect), chainparams.GetConsensus());
+
     // Disconnect (descendants of) pindex, and mark them invalid.
     while (true) {
         if (ShutdownRequested()) break;
@@ -2823,7 +3694,8 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
         // ActivateBestChain considers blocks already in m_chain
         // unconditionally valid already, so force disconnect away from it.
         DisconnectedBlockTransactions disconnectpool;
-        bool ret = DisconnectTip(state, chainparams, &disconnectpool);
+        DisconnectData read = disconnectReads.Next(invalid_walk_tip);
+        bool ret = DisconnectTip(state, chainparams, &disconnectpool, std::move(read.block), std::move(read.undo));
         // DisconnectTip will add transactions to disconnectpool.
         // Adjust the mempool to be consistent with the new tip, adding
         // transactions back to the mempool if disconnecting was successful,
@@ -2871,8 +3743,8 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
         // add it again.
         BlockMap::iterator it = mapBlockIndex.begin();
         while (it != mapBlockIndex.end()) {
-            if (it->second->IsValid(BLOCK_VALID_TRANSACTIONS) && it->second->HaveTxsDownloaded() && !setBlockIndexCandidates.value_comp()(it->second, m_chain.Tip())) {
-                setBlockIndexCandidates.insert(it->second);
+            if (IsCandidateValid(&it->second) && it->second.HaveTxsDownloaded() && !setBlockIndexCandidates.value_comp()(&it->second, m_chain.Tip())) {
+                setBlockIndexCandidates.insert(&it->second);
             }
             it++;
         }
@@ -2899,17 +3771,17 @@ void CChainState::ResetBlockFailureFlags(CBlockIndex *pindex) {
     // Remove the invalidity flag from this block and all its descendants.
     BlockMap::iterator it = mapBlockIndex.begin();
     while (it != mapBlockIndex.end()) {
-        if (!it->second->IsValid() && it->second->GetAncestor(nHeight) == pindex) {
-            it->second->nStatus &= ~BLOCK_FAILED_MASK;
-            setDirtyBlockIndex.insert(it->second);
-            if (it->second->IsValid(BLOCK_VALID_TRANSACTIONS) && it->second->HaveTxsDownloaded() && setBlockIndexCandidates.value_comp()(m_chain.Tip(), it->second)) {
-                setBlockIndexCandidates.insert(it->second);
+        if (!it->second.IsValid() && it->second.GetAncestor(nHeight) == pindex) {
+            it->second.nStatus &= ~BLOCK_FAILED_MASK;
+            setDirtyBlockIndex.insert(&it->second);
+            if (IsCandidateValid(&it->second) && it->second.HaveTxsDownloaded() && setBlockIndexCandidates.value_comp()(m_chain.Tip(), &it->second)) {
+                setBlockIndexCandidates.insert(&it->second);
             }
-            if (it->second == pindexBestInvalid) {
+            if (&it->second == pindexBestInvalid) {
                 // Reset invalid block marker if it was pointing to one of those.
                 pindexBestInvalid = nullptr;
             }
-            m_failed_blocks.erase(it->second);
+            m_failed_blocks.erase(&it->second);
         }
         it++;
     }
@@ -2930,27 +3802,31 @@ void ResetBlockFailureFlags(CBlockIndex *pindex) {
 }
 
 CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
+{
+    return AddToBlockIndex(block, block.GetHash());
+}
+
+CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     AssertLockHeld(cs_main);
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
-        return it->second;
+        return &it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    BlockMap::iterator mi = mapBlockIndex.emplace(std::piecewise_construct, std::forward_as_tuple(hash), std::forward_as_tuple(block)).first;
+    CBlockIndex* pindexNew = &mi->second;
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
-        pindexNew->pprev = (*miPrev).second;
+        pindexNew->pprev = &(*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
     }
@@ -3092,13 +3968,15 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+/**
+ * The checks of CheckBlock, without reading or setting CBlock::fChecked. With
+ * fParallel the transactions are checked on the block check threads; if any
+ * of them fails, they are checked again in order to report the first failure.
+ */
+static bool CheckBlockContents(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, bool fParallel)
 {
     // These are checks that are independent of context.
 
-    if (block.fChecked)
-        return true;
-
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
@@ -3135,26 +4013,62 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
         if (block.vtx[i]->IsCoinBase())
             return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-cb-multiple", "more than one coinbase");
 
-    // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, true))
-            return state.Invalid(state.GetReason(), false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
-
     unsigned int nSigOps = 0;
-    for (const auto& tx : block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(*tx);
+    bool fTxChecked = false;
+    if (fParallel && nScriptCheckThreads) {
+        std::vector<unsigned int> vSigOps(block.vtx.size());
+        std::vector<CBlockTxCheck> vChecks;
+        vChecks.reserve(block.vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            vChecks.emplace_back(*block.vtx[i], &vSigOps[i]);
+        }
+        CCheckQueueControl<CBlockTxCheck> control(&blockcheckqueue);
+        control.Add(vChecks);
+        if (control.Wait()) {
+            for (unsigned int nTxSigOps : vSigOps) {
+                nSigOps += nTxSigOps;
+            }
+            fTxChecked = true;
+        }
+    }
+
+    if (!fTxChecked) {
+        // Check transactions
+        for (const auto& tx : block.vtx)
+            if (!CheckTransaction(*tx, state, true))
+                return state.Invalid(state.GetReason(), false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+
+        for (const auto& tx : block.vtx)
+        {
+            nSigOps += GetLegacySigOpCount(*tx);
+        }
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.Invalid(ValidationInvalidReason::CONSENSUS, false, REJECT_INVALID, "bad-blk-sigops", "out-of-bounds SigOpCount");
 
+    return true;
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    if (block.fChecked)
+        return true;
+
+    if (!CheckBlockContents(block, state, consensusParams, fCheckPOW, fCheckMerkleRoot, false))
+        return false;
+
     if (fCheckPOW && fCheckMerkleRoot)
         block.fChecked = true;
 
     return true;
 }
 
+bool PreCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams)
+{
+    return CheckBlockContents(block, state, consensusParams, true, true, true);
+}
+
 bool IsWitnessEnabled(const CBlockIndex* pindexPrev, const Consensus::Params& params)
 {
     LOCK(cs_main);
@@ -3376,16 +4290,20 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
 }
 
 bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    return AcceptBlockHeader(block, block.GetHash(), true, state, chainparams, ppindex);
+}
+
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, const uint256& hash, bool fCheckPOW, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = nullptr;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
         if (miSelf != mapBlockIndex.end()) {
             // Block header is already known.
-            pindex = miSelf->second;
+            pindex = &miSelf->second;
             if (ppindex)
                 *ppindex = pindex;
             if (pindex->nStatus & BLOCK_FAILED_MASK)
@@ -3393,7 +4311,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3401,7 +4319,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
         if (mi == mapBlockIndex.end())
             return state.Invalid(ValidationInvalidReason::BLOCK_MISSING_PREV, error("%s: prev block not found", __func__), 0, "prev-blk-not-found");
-        pindexPrev = (*mi).second;
+        pindexPrev = &(*mi).second;
         if (pindexPrev->nStatus & BLOCK_FAILED_MASK)
             return state.Invalid(ValidationInvalidReason::BLOCK_INVALID_PREV, error("%s: prev block invalid", __func__), REJECT_INVALID, "bad-prevblk");
         if (!ContextualCheckBlockHeader(block, state, chainparams, pindexPrev, GetAdjustedTime()))
@@ -3446,7 +4364,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
         }
     }
     if (pindex == nullptr)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3456,15 +4374,39 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
     return true;
 }
 
+/**
+ * Hash a run of headers and check their proof of work. vPOWValid[i] is set
+ * if the hash of headers[i] meets the target it claims.
+ */
+static void HashBlockHeaders(const std::vector<CBlockHeader>& headers, const Consensus::Params& consensusParams, std::vector<uint256>& vHashes, std::vector<char>& vPOWValid)
+{
+    vHashes.resize(headers.size());
+    vPOWValid.resize(headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        vHashes[i] = headers[i].GetHash();
+        vPOWValid[i] = CheckProofOfWork(vHashes[i], headers[i].nBits, consensusParams);
+    }
+}
+
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+
+    // Hash the headers and check their proof of work before taking cs_main,
+    // so that each header is hashed once and the lock is only held to look
+    // up and insert the index entries.
+    std::vector<uint256> vHashes;
+    std::vector<char> vPOWValid;
+    HashBlockHeaders(headers, chainparams.GetConsensus(), vHashes, vPOWValid);
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            // Headers that failed the proof of work check are checked again,
+            // in order, to report the failure.
+            if (!g_chainstate.AcceptBlockHeader(header, vHashes[i], !vPOWValid[i], state, chainparams, &pindex)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3493,6 +4435,11 @@ static FlatFilePos SaveBlockToDisk(const CBlock& block, int nHeight, const CChai
             return FlatFilePos();
         }
     }
+    if (fBlockTxOffsets) {
+        // Written together with the block index entry of the block.
+        const auto inserted = mapDirtyBlockTxOffsets.emplace(block.GetHash(), CBlockTxOffsets(block));
+        if (inserted.second) nDirtyBlockTxOffsetsUsage += BlockTxOffsetsUsage(inserted.first->second);
+    }
     return blockPos;
 }
 
@@ -3586,14 +4533,15 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
 
-        // CheckBlock() does not support multi-threaded block validation because CBlock::fChecked can cause data race.
-        // Therefore, the following critical section must include the CheckBlock() call as well.
+        // Ensure that the CheckBlock() rules pass before calling AcceptBlock,
+        // as belt-and-suspenders. They are run before taking cs_main, so that
+        // other peers and RPC calls are not held up while the transactions are
+        // checked. CBlock::fChecked is only set once cs_main is held, as
+        // concurrent writes to it would be a data race.
+        bool ret = PreCheckBlock(*pblock, state, chainparams.GetConsensus());
         LOCK(cs_main);
-
-        // Ensure that CheckBlock() passes before calling AcceptBlock, as
-        // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
         if (ret) {
+            pblock->fChecked = true;
             // Store to disk
             ret = g_chainstate.AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock);
         }
@@ -3658,9 +4606,11 @@ void PruneOneBlockFile(const int fileNumber)
 {
     LOCK(cs_LastBlockFile);
 
-    for (const auto& entry : mapBlockIndex) {
-        CBlockIndex* pindex = entry.second;
+    std::vector<uint256> pruned_hashes;
+    for (auto& entry : mapBlockIndex) {
+        CBlockIndex* pindex = &entry.second;
         if (pindex->nFile == fileNumber) {
+            if (fBlockTxOffsets && (pindex->nStatus & BLOCK_HAVE_DATA)) pruned_hashes.push_back(pindex->GetBlockHash());
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
             pindex->nStatus &= ~BLOCK_HAVE_UNDO;
             pindex->nFile = 0;
@@ -3683,6 +4633,17 @@ void PruneOneBlockFile(const int fileNumber)
         }
     }
 
+    // Any transaction offset tables of the pruned blocks are of no use any more.
+    if (fBlockTxOffsets) {
+        for (const uint256& hash : pruned_hashes) {
+            const auto dirty = mapDirtyBlockTxOffsets.find(hash);
+            if (dirty == mapDirtyBlockTxOffsets.end()) continue;
+            nDirtyBlockTxOffsetsUsage -= BlockTxOffsetsUsage(dirty->second);
+            mapDirtyBlockTxOffsets.erase(dirty);
+        }
+        pblocktree->EraseBlockTxOffsets(pruned_hashes);
+    }
+
     vinfoBlockFile[fileNumber].SetNull();
     setDirtyFileInfo.insert(fileNumber);
 }
@@ -3692,6 +4653,10 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         FlatFilePos pos(*it, 0);
+        // Readers may still be using a mapping of the files, which must be
+        // gone before they can be removed on some platforms.
+        g_block_file_maps.Release(*it);
+        g_undo_file_maps.Release(*it);
         fs::remove(BlockFileSeq().FileName(pos));
         fs::remove(UndoFileSeq().FileName(pos));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3835,11 +4800,11 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
     // Return existing
     BlockMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
-        return (*mi).second;
+        return &(*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
+    mi = mapBlockIndex.emplace(std::piecewise_construct, std::forward_as_tuple(hash), std::forward_as_tuple()).first;
+    CBlockIndex* pindexNew = &(*mi).second;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
@@ -3847,15 +4812,17 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
 
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
+    // A block index snapshot is only used if it was written at the best block of the coins database.
+    const uint256 coins_best_block = pcoinsdbview ? pcoinsdbview->GetBestBlock() : uint256();
+    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }, coins_best_block))
         return false;
 
     // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (std::pair<const uint256, CBlockIndex>& item : mapBlockIndex)
     {
-        CBlockIndex* pindex = item.second;
+        CBlockIndex* pindex = &item.second;
         vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
@@ -3883,7 +4850,7 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             pindex->nStatus |= BLOCK_FAILED_CHILD;
             setDirtyBlockIndex.insert(pindex);
         }
-        if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->HaveTxsDownloaded() || pindex->pprev == nullptr))
+        if (IsCandidateValid(pindex) && (pindex->HaveTxsDownloaded() || pindex->pprev == nullptr))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
@@ -3921,9 +4888,9 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
     // Check presence of blk files
     LogPrintf("Checking all blk files are present...\n");
     std::set<int> setBlkDataFiles;
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
+    for (std::pair<const uint256, CBlockIndex>& item : mapBlockIndex)
     {
-        CBlockIndex* pindex = item.second;
+        CBlockIndex* pindex = &item.second;
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
             setBlkDataFiles.insert(pindex->nFile);
         }
@@ -3941,6 +4908,11 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams) EXCLUSIVE_LOCKS_RE
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate was loaded from a UTXO snapshot
+    pblocktree->ReadFlag("utxosnapshot", fHaveUTXOSnapshot);
+    if (fHaveUTXOSnapshot)
+        LogPrintf("LoadBlockIndexDB(): Chainstate was loaded from a UTXO snapshot\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -3972,13 +4944,48 @@ bool LoadChainTip(const CChainParams& chainparams)
     return true;
 }
 
-CVerifyDB::CVerifyDB()
-{
-    uiInterface.ShowProgress(_("Verifying blocks..."), 0, false);
-}
-
-CVerifyDB::~CVerifyDB()
-{
+namespace {
+/** The result of checking a block at levels 0 to 2 of VerifyDB. */
+struct VerifyDBRead {
+    CBlock block;
+    bool fRead{false};
+    bool fValid{false};
+    CValidationState state;
+    bool fUndoValid{false};
+};
+} // namespace
+
+/**
+ * Run the checks of VerifyDB levels 0 to 2 on a block: read it, run
+ * CheckBlock on it and read its undo data. This runs on the block read
+ * thread, so everything it needs from the block index is passed by value.
+ */
+static VerifyDBRead VerifyDBReadBlock(const FlatFilePos pos, const uint256 hash, const FlatFilePos undo_pos, const uint256 hashPrevBlock, int nCheckLevel, const Consensus::Params& consensusParams)
+{
+    VerifyDBRead read;
+    // check level 0: read from disk
+    read.fRead = ReadBlockFromDisk(read.block, pos, consensusParams) && read.block.GetHash() == hash;
+    if (!read.fRead) return read;
+    // check level 1: verify block validity
+    read.fValid = nCheckLevel < 1 || CheckBlock(read.block, read.state, consensusParams);
+    if (!read.fValid) return read;
+    // check level 2: verify undo validity
+    if (nCheckLevel >= 2 && !undo_pos.IsNull()) {
+        CBlockUndo undo;
+        read.fUndoValid = UndoReadFromDisk(undo, undo_pos, hashPrevBlock);
+    } else {
+        read.fUndoValid = true;
+    }
+    return read;
+}
+
+CVerifyDB::CVerifyDB()
+{
+    uiInterface.ShowProgress(_("Verifying blocks..."), 0, false);
+}
+
+CVerifyDB::~CVerifyDB()
+{
     uiInterface.ShowProgress("", 100, false);
 }
 
@@ -3999,6 +5006,18 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     int nGoodTransactions = 0;
     CValidationState state;
     int reportDone = 0;
+
+    // Levels 0 to 2 are checked on the block read thread, up to
+    // BLOCK_READAHEAD_DEPTH blocks ahead of the one being verified; level 3
+    // disconnects the blocks in order on this thread. Reads still queued when
+    // verification stops early are dropped without waiting for them.
+    const auto should_verify = [&](const CBlockIndex* pindexCheck) {
+        return pindexCheck->nHeight > ::ChainActive().Height() - nCheckDepth &&
+               !((fPruneMode || fHavePruned || pindexCheck->IsAssumedValid()) && !(pindexCheck->nStatus & BLOCK_HAVE_DATA));
+    };
+    std::deque<std::future<VerifyDBRead>> reads;
+    CBlockIndex* pindexRead = ::ChainActive().Tip();
+
     LogPrintf("[0%%]..."); /* Continued */
     for (pindex = ::ChainActive().Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
         boost::this_thread::interruption_point();
@@ -4011,28 +5030,33 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
         if (pindex->nHeight <= ::ChainActive().Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if ((fPruneMode || fHavePruned || pindex->IsAssumedValid()) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, or below a UTXO snapshot, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
-        CBlock block;
+        for (; reads.size() < BLOCK_READAHEAD_DEPTH && pindexRead && pindexRead->pprev && should_verify(pindexRead); pindexRead = pindexRead->pprev) {
+            const FlatFilePos pos = pindexRead->GetBlockPos();
+            const uint256 hash = pindexRead->GetBlockHash();
+            const FlatFilePos undo_pos = pindexRead->GetUndoPos();
+            const uint256 hashPrevBlock = pindexRead->pprev->GetBlockHash();
+            const Consensus::Params& consensusParams = chainparams.GetConsensus();
+            reads.push_back(blockreadqueue.Push([pos, hash, undo_pos, hashPrevBlock, nCheckLevel, &consensusParams] { return VerifyDBReadBlock(pos, hash, undo_pos, hashPrevBlock, nCheckLevel, consensusParams); }));
+        }
+        assert(!reads.empty());
+        VerifyDBRead read = reads.front().get();
+        reads.pop_front();
+        CBlock& block = read.block;
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+        if (!read.fRead)
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
+        if (!read.fValid)
             return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
+                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(read.state));
         // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            if (!pindex->GetUndoPos().IsNull()) {
-                if (!UndoReadFromDisk(undo, pindex)) {
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                }
-            }
-        }
+        if (!read.fUndoValid)
+            return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             assert(coins.GetBestBlock() == pindex->GetBlockHash());
@@ -4123,13 +5147,13 @@ bool CChainState::ReplayBlocks(const CChainParams& params, CCoinsView* view)
     if (mapBlockIndex.count(hashHeads[0]) == 0) {
         return error("ReplayBlocks(): reorganization to unknown block requested");
     }
-    pindexNew = mapBlockIndex[hashHeads[0]];
+    pindexNew = &mapBlockIndex[hashHeads[0]];
 
     if (!hashHeads[1].IsNull()) { // The old tip is allowed to be 0, indicating it's the first flush.
         if (mapBlockIndex.count(hashHeads[1]) == 0) {
             return error("ReplayBlocks(): reorganization from unknown block requested");
         }
-        pindexOld = mapBlockIndex[hashHeads[1]];
+        pindexOld = &mapBlockIndex[hashHeads[1]];
         pindexFork = LastCommonAncestor(pindexOld, pindexNew);
         assert(pindexFork != nullptr);
     }
@@ -4173,6 +5197,201 @@ bool ReplayBlocks(const CChainParams& params, CCoinsView* view) {
     return g_chainstate.ReplayBlocks(params, view);
 }
 
+//! Number of coins written to the coins database at a time while loading a UTXO snapshot
+static const size_t SNAPSHOT_WRITE_BATCH_COINS = 200000;
+
+//! Check that a UTXO snapshot at base_hash can be loaded into chain. Returns the base block.
+static CBlockIndex* CheckUTXOSnapshotBase(const CChain& chain, const uint256& base_hash, std::string& strError) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CBlockIndex* pindexBase = LookupBlockIndex(base_hash);
+    if (!pindexBase) {
+        strError = strprintf("The headers of snapshot base block %s must be known before loading the snapshot", base_hash.ToString());
+        return nullptr;
+    }
+    if (pindexBase->nStatus & BLOCK_FAILED_MASK) {
+        strError = strprintf("Snapshot base block %s is invalid", base_hash.ToString());
+        return nullptr;
+    }
+    if (pindexBase->nHeight == 0 || chain.Height() != 0) {
+        strError = "A UTXO snapshot can only be loaded into an empty chainstate";
+        return nullptr;
+    }
+    for (const std::pair<const uint256, CBlockIndex>& entry : mapBlockIndex) {
+        if (entry.second.nHeight > 0 && entry.second.nTx > 0) {
+            strError = "A UTXO snapshot cannot be loaded once blocks have been downloaded";
+            return nullptr;
+        }
+    }
+    return pindexBase;
+}
+
+//! Write the coins of a verified UTXO snapshot to the coins database, without marking it as consistent.
+static bool WriteUTXOSnapshotCoins(CAutoFile& coins_file, const SnapshotMetadata& metadata, RollingCoinsStats* stats, std::string& strError) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CCoinsMap mapCoins;
+    try {
+        for (uint64_t i = 0; i < metadata.m_coins_count; i++) {
+            COutPoint outpoint;
+            Coin coin;
+            coins_file >> outpoint;
+            coins_file >> coin;
+            if (stats) stats->Add(outpoint, coin);
+            CCoinsCacheEntry& entry = mapCoins[outpoint];
+            entry.coin = CompactCoin(coin);
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            if (mapCoins.size() >= SNAPSHOT_WRITE_BATCH_COINS || i + 1 == metadata.m_coins_count) {
+                if (!pcoinsdbview->WriteCoins(mapCoins, metadata.m_base_blockhash, false)) {
+                    strError = "Failed to write UTXO snapshot to the coins database";
+                    return false;
+                }
+                LogPrintf("[%d%%]...", (int)((i + 1) * 100 / metadata.m_coins_count)); /* Continued */
+            }
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Failed to read UTXO snapshot: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool CChainState::LoadUTXOSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const uint256& expected_hash_serialized, const CChainParams& chainparams, std::string& strError)
+{
+    // No block can be connected until the snapshot is loaded. cs_main is only
+    // taken once the snapshot has been verified.
+    LOCK(m_cs_chainstate);
+
+    if (metadata.m_version != SnapshotMetadata::CURRENT_VERSION) {
+        strError = strprintf("Unsupported snapshot version %u", metadata.m_version);
+        return false;
+    }
+    if (metadata.m_hash_serialized != expected_hash_serialized) {
+        strError = strprintf("Snapshot commits to hash %s instead of the expected hash %s", metadata.m_hash_serialized.ToString(), expected_hash_serialized.ToString());
+        return false;
+    }
+    int nBaseHeight;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexBase = CheckUTXOSnapshotBase(m_chain, metadata.m_base_blockhash, strError);
+        if (!pindexBase) return false;
+        nBaseHeight = pindexBase->nHeight;
+    }
+
+    // Verify the coins against the expected hash before the chainstate is touched.
+    LogPrintf("Verifying UTXO snapshot with %u coins at block %s (%d)\n", metadata.m_coins_count, metadata.m_base_blockhash.ToString(), nBaseHeight);
+    FILE* file = coins_file.Get();
+    const long nCoinsStart = ftell(file);
+    CCoinsStatsBuilder builder(metadata.m_base_blockhash);
+    uint64_t nCoinsRead = 0;
+    try {
+        for (; nCoinsRead < metadata.m_coins_count; nCoinsRead++) {
+            if (nCoinsRead % SNAPSHOT_WRITE_BATCH_COINS == 0 && ShutdownRequested()) {
+                strError = "Shutdown requested";
+                return false;
+            }
+            COutPoint outpoint;
+            Coin coin;
+            coins_file >> outpoint;
+            coins_file >> coin;
+            if (coin.IsSpent() || coin.nHeight > (uint32_t)nBaseHeight) {
+                strError = strprintf("Bad snapshot data: invalid coin %s", outpoint.ToString());
+                return false;
+            }
+            builder.Add(outpoint, std::move(coin));
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Bad snapshot data after %u coins: %s", nCoinsRead, e.what());
+        return false;
+    }
+    const uint256 hashSerialized = builder.Finalize().hashSerialized;
+    if (hashSerialized != expected_hash_serialized) {
+        strError = strprintf("Snapshot hash %s does not match the expected hash %s", hashSerialized.ToString(), expected_hash_serialized.ToString());
+        return false;
+    }
+    if (nCoinsStart < 0 || fseek(file, nCoinsStart, SEEK_SET) != 0) {
+        strError = "Unable to rewind the snapshot file";
+        return false;
+    }
+
+    // Coin lookups that miss pcoinsTip go to the coins database, so cs_main is
+    // held until the database is consistent again.
+    LOCK(cs_main);
+    // Blocks may have been received while the snapshot was verified.
+    CBlockIndex* pindexBase = CheckUTXOSnapshotBase(m_chain, metadata.m_base_blockhash, strError);
+    if (!pindexBase) return false;
+    const uint256 hashEmptyTip = m_chain.Tip()->GetBlockHash();
+    // A background write of an earlier flush stores its own rolling
+    // statistics, so let it complete before they are replaced below.
+    if (!pcoinsdbview->WaitForBackgroundWrite()) {
+        strError = "Failed to write to coin database";
+        return AbortNode(strError);
+    }
+
+    // Bulk load the coins. Every batch leaves the coins database marked as
+    // being in transition to the base block; only the flush below marks it as
+    // consistent, so an interruption is detected by ReplayBlocks at the next
+    // startup.
+    LogPrintf("Loading UTXO snapshot into the coins database\n");
+    std::unique_ptr<RollingCoinsStats> stats;
+    if (g_coins_stats) stats = MakeUnique<RollingCoinsStats>();
+    if (!WriteUTXOSnapshotCoins(coins_file, metadata, stats.get(), strError)) {
+        // The database had no coins before, so erasing them all undoes the load.
+        if (!pcoinsdbview->EraseAllCoins(hashEmptyTip)) {
+            return AbortNode(strError, _("Failed to undo an incomplete UTXO snapshot load. Restart with -reindex."));
+        }
+        return false;
+    }
+    if (stats) {
+        stats->hashBlock = metadata.m_base_blockhash;
+        pcoinsdbview->SetRollingStats(*stats);
+    }
+    LogPrintf("[DONE].\n");
+
+    // The blocks up to the base are never going to be downloaded. Mark them as
+    // assumed valid rather than validated, see BLOCK_ASSUMED_VALID.
+    //
+    // Their transaction counts are unknown. A placeholder nTx = 1 links the
+    // blocks below the base into the block tree (nChainTx > 0), which lets the
+    // blocks on top of the snapshot be connected. The base block's placeholder
+    // makes up the snapshot's nChainTx, so counts from the base on are real.
+    for (int nHeight = 1; nHeight <= pindexBase->nHeight; nHeight++) {
+        CBlockIndex* pindex = pindexBase->GetAncestor(nHeight);
+        pindex->nTx = 1;
+        if (pindex == pindexBase && metadata.m_nchaintx > pindex->pprev->nChainTx) {
+            pindex->nTx = metadata.m_nchaintx - pindex->pprev->nChainTx;
+        }
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->nStatus |= BLOCK_ASSUMED_VALID;
+        setDirtyBlockIndex.insert(pindex);
+    }
+    pblocktree->WriteFlag("utxosnapshot", true);
+    fHaveUTXOSnapshot = true;
+
+    if (stats) g_coins_stats = std::move(stats);
+    pcoinsTip->SetBestBlock(metadata.m_base_blockhash);
+    CBlockIndex* pindexOldTip = m_chain.Tip();
+    m_chain.SetTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+    PruneBlockIndexCandidates();
+    // Writes the block index, then marks the coins database as consistent with the base block.
+    CValidationState state;
+    if (!FlushStateToDisk(chainparams, state, FlushStateMode::ALWAYS)) {
+        strError = strprintf("Failed to write UTXO snapshot: %s", FormatStateMessage(state));
+        return false;
+    }
+    UpdateTip(pindexBase, chainparams);
+    GetMainSignals().UpdatedBlockTip(pindexBase, pindexOldTip, IsInitialBlockDownload());
+    CheckBlockIndex(chainparams.GetConsensus());
+    return true;
+}
+
+bool LoadUTXOSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const uint256& expected_hash_serialized, const CChainParams& chainparams, std::string& strError) {
+    if (!g_chainstate.LoadUTXOSnapshot(coins_file, metadata, expected_hash_serialized, chainparams, strError)) {
+        return false;
+    }
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), ::ChainActive().Tip());
+    return true;
+}
+
 //! Helper for CChainState::RewindBlockIndex
 void CChainState::EraseBlockData(CBlockIndex* index)
 {
@@ -4204,7 +5423,7 @@ void CChainState::EraseBlockData(CBlockIndex* index)
         }
     }
     // Mark parent as eligible for main chain again
-    if (index->pprev && index->pprev->IsValid(BLOCK_VALID_TRANSACTIONS) && index->pprev->HaveTxsDownloaded()) {
+    if (index->pprev && IsCandidateValid(index->pprev) && index->pprev->HaveTxsDownloaded()) {
         setBlockIndexCandidates.insert(index->pprev);
     }
 }
@@ -4218,9 +5437,9 @@ bool CChainState::RewindBlockIndex(const CChainParams& params)
     // blocks will be dealt with below (releasing cs_main in between).
     {
         LOCK(cs_main);
-        for (const auto& entry : mapBlockIndex) {
-            if (IsWitnessEnabled(entry.second->pprev, params.GetConsensus()) && !(entry.second->nStatus & BLOCK_OPT_WITNESS) && !m_chain.Contains(entry.second)) {
-                EraseBlockData(entry.second);
+        for (auto& entry : mapBlockIndex) {
+            if (IsWitnessEnabled(entry.second.pprev, params.GetConsensus()) && !(entry.second.nStatus & BLOCK_OPT_WITNESS) && !entry.second.IsAssumedValid() && !m_chain.Contains(&entry.second)) {
+                EraseBlockData(&entry.second);
             }
         }
     }
@@ -4234,7 +5453,8 @@ bool CChainState::RewindBlockIndex(const CChainParams& params)
             // Although SCRIPT_VERIFY_WITNESS is now generally enforced on all
             // blocks in ConnectBlock, we don't need to go back and
             // re-download/re-verify blocks from before segwit actually activated.
-            if (IsWitnessEnabled(m_chain[nHeight - 1], params.GetConsensus()) && !(m_chain[nHeight]->nStatus & BLOCK_OPT_WITNESS)) {
+            // Blocks below a UTXO snapshot were never downloaded at all.
+            if (IsWitnessEnabled(m_chain[nHeight - 1], params.GetConsensus()) && !(m_chain[nHeight]->nStatus & BLOCK_OPT_WITNESS) && !m_chain[nHeight]->IsAssumedValid()) {
                 break;
             }
             nHeight++;
@@ -4323,6 +5543,7 @@ bool RewindBlockIndex(const CChainParams& params) {
 }
 
 void CChainState::UnloadBlockIndex() {
+    m_block_reads.clear();
     nBlockSequenceId = 1;
     m_failed_blocks.clear();
     setBlockIndexCandidates.clear();
@@ -4341,22 +5562,46 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    g_block_file_maps.Clear();
+    g_undo_file_maps.Clear();
     setDirtyBlockIndex.clear();
+    mapDirtyBlockTxOffsets.clear();
+    nDirtyBlockTxOffsetsUsage = 0;
     setDirtyFileInfo.clear();
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
 
-    for (const BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fHaveUTXOSnapshot = false;
+    g_coins_stats.reset();
 
     g_chainstate.UnloadBlockIndex();
 }
 
+bool LoadCoinsStats()
+{
+    AssertLockHeld(cs_main);
+    std::unique_ptr<RollingCoinsStats> stats = MakeUnique<RollingCoinsStats>();
+    const uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+    if (pcoinsdbview->ReadRollingStats(*stats) && stats->hashBlock == hashBestBlock) {
+        LogPrintf("Loaded UTXO set statistics at %s\n", hashBestBlock.ToString());
+    } else {
+        LogPrintf("Computing UTXO set statistics at %s, this may take a while...\n", hashBestBlock.ToString());
+        // The statistics are computed from the database, so write out any pending changes first.
+        if (!hashBestBlock.IsNull() && !pcoinsTip->Flush()) {
+            return error("%s: failed to write to coin database", __func__);
+        }
+        if (!ComputeRollingCoinsStats(pcoinsdbview.get(), *stats)) {
+            return false;
+        }
+    }
+    g_coins_stats = std::move(stats);
+    return true;
+}
+
 bool LoadBlockIndex(const CChainParams& chainparams)
 {
     // Load block index from databases
@@ -4409,13 +5654,30 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp)
-{
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+namespace {
 
-    int nLoaded = 0;
+/** A block read from a block file during -reindex, with its position */
+struct ExternalBlock {
+    std::shared_ptr<CBlock> block;
+    FlatFilePos pos;
+};
+
+/** The blocks read from one block file during -reindex */
+struct ReindexFile {
+    bool fOpened = false;
+    std::vector<ExternalBlock> blocks;
+};
+
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
+
+} // anon namespace
+
+/** Scan a file for serialized blocks and pass each of them to process, which
+ *  returns false to stop the scan. If dbp is set, its nPos is set to the
+ *  position of the block before process is called. */
+static void ScanExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos* dbp, const std::function<bool(const std::shared_ptr<CBlock>&)>& process)
+{
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
@@ -4451,73 +5713,11 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
+                blkdat >> *pblock;
                 nRewind = blkdat.GetPos();
 
-                uint256 hash = block.GetHash();
-                {
-                    LOCK(cs_main);
-                    // detect out of order blocks, and store them for later
-                    if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
-                        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                                block.hashPrevBlock.ToString());
-                        if (dbp)
-                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                        continue;
-                    }
-
-                    // process in case the block isn't known yet
-                    CBlockIndex* pindex = LookupBlockIndex(hash);
-                    if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
-                      CValidationState state;
-                      if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
-                          nLoaded++;
-                      }
-                      if (state.IsError()) {
-                          break;
-                      }
-                    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
-                      LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
-                    }
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, FlatFilePos>::iterator, std::multimap<uint256, FlatFilePos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, FlatFilePos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
+                if (!process(pblock)) {
+                    break;
                 }
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
@@ -4526,11 +5726,218 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFi
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+}
+
+/** Accept a block read from a file, followed by the blocks read earlier that
+ *  were waiting for it as their parent. Returns false on a system error. */
+static bool AcceptExternalBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, FlatFilePos* dbp, int& nLoaded)
+{
+    const CBlock& block = *pblock;
+    uint256 hash = block.GetHash();
+    {
+        LOCK(cs_main);
+        // detect out of order blocks, and store them for later
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && !LookupBlockIndex(block.hashPrevBlock)) {
+            LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    block.hashPrevBlock.ToString());
+            if (dbp)
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        CBlockIndex* pindex = LookupBlockIndex(hash);
+        if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+          CValidationState state;
+          if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+              nLoaded++;
+          }
+          if (state.IsError()) {
+              return false;
+          }
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && pindex->nHeight % 1000 == 0) {
+          LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), pindex->nHeight);
+        }
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, FlatFilePos>::iterator, std::multimap<uint256, FlatFilePos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, FlatFilePos>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    ScanExternalBlockFile(chainparams, fileIn, dbp, [&](const std::shared_ptr<CBlock>& pblock) {
+        return AcceptExternalBlock(chainparams, pblock, dbp, nLoaded);
+    });
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+/** Read all blocks of a block file, and run the checks that do not depend on
+ *  the chain on them. */
+static ReindexFile ReadBlockFileForReindex(const CChainParams& chainparams, int nFile)
+{
+    ReindexFile file;
+    FlatFilePos pos(nFile, 0);
+    FILE* fileIn = OpenBlockFile(pos, true);
+    if (!fileIn) {
+        return file; // This error is logged in OpenBlockFile
+    }
+    file.fOpened = true;
+    ScanExternalBlockFile(chainparams, fileIn, &pos, [&](const std::shared_ptr<CBlock>& pblock) {
+        if (ShutdownRequested()) return false;
+        // A block that passes is marked as checked, so AcceptBlock does not
+        // repeat the checks. One that fails is rejected by AcceptBlock.
+        CValidationState state;
+        CheckBlock(*pblock, state, chainparams.GetConsensus());
+        file.blocks.push_back(ExternalBlock{pblock, pos});
+        return true;
+    });
+    return file;
+}
+
+namespace {
+/**
+ * The threads reading block files ahead of their blocks being accepted during
+ * -reindex. They are started once for the whole reindex, and stopped when it
+ * returns, including on shutdown.
+ */
+class ReindexReaders
+{
+private:
+    BlockReadQueue m_queue;
+    boost::thread_group m_threads;
+
+public:
+    ReindexReaders(const ReindexReaders&) = delete;
+    ReindexReaders& operator=(const ReindexReaders&) = delete;
+
+    explicit ReindexReaders(int nThreads)
+    {
+        for (int i = 0; i < nThreads; i++) {
+            try {
+                m_threads.create_thread([this, i] {
+                    util::ThreadRename(strprintf("reindex.%i", i));
+                    m_queue.Thread();
+                });
+            } catch (const boost::thread_resource_error& e) {
+                LogPrint(BCLog::REINDEX, "%s: failed to start block file reader: %s\n", __func__, e.what());
+                break;
+            }
+        }
+        // Without any thread the files are read on the import thread.
+        if (m_threads.size() > 0) m_queue.Start();
+    }
+
+    ~ReindexReaders()
+    {
+        // Joining is an interruption point, which must not throw here.
+        boost::this_thread::disable_interruption no_interruption;
+        m_queue.Stop();
+        m_threads.join_all();
+    }
+
+    std::future<ReindexFile> Read(const CChainParams& chainparams, int nFile)
+    {
+        return m_queue.Push([&chainparams, nFile] { return ReadBlockFileForReindex(chainparams, nFile); });
+    }
+};
+} // namespace
+
+bool ReindexBlockFiles(const CChainParams& chainparams, int nThreads)
+{
+    if (nThreads <= 1) {
+        int nFile = 0;
+        while (true) {
+            if (ShutdownRequested()) return false;
+            FlatFilePos pos(nFile, 0);
+            if (!fs::exists(GetBlockPosFilename(pos)))
+                break; // No block files left to reindex
+            FILE *file = OpenBlockFile(pos, true);
+            if (!file)
+                break; // This error is logged in OpenBlockFile
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+            LoadExternalBlockFile(chainparams, file, &pos);
+            nFile++;
+        }
+        return true;
+    }
+
+    // Read and deserialize the next nThreads block files in the background,
+    // and accept their blocks in file order.
+    ReindexReaders readers(nThreads);
+    std::deque<std::future<ReindexFile>> reads;
+    int nNextRead = 0;
+    bool fMoreFiles = true;
+    for (int nFile = 0; ; nFile++) {
+        while (fMoreFiles && reads.size() < (size_t)nThreads && !ShutdownRequested()) {
+            if (!fs::exists(GetBlockPosFilename(FlatFilePos(nNextRead, 0)))) {
+                fMoreFiles = false; // No block files left to reindex
+                break;
+            }
+            reads.push_back(readers.Read(chainparams, nNextRead));
+            nNextRead++;
+        }
+        // Reads still running stop early, and are waited for when readers is destroyed.
+        if (ShutdownRequested()) return false;
+        if (reads.empty()) break;
+        ReindexFile file = reads.front().get();
+        reads.pop_front();
+        if (!file.fOpened) break;
+
+        LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+        int64_t nStart = GetTimeMillis();
+        int nLoaded = 0;
+        for (ExternalBlock& entry : file.blocks) {
+            boost::this_thread::interruption_point();
+            if (!AcceptExternalBlock(chainparams, entry.block, &entry.pos, nLoaded)) break;
+        }
+        if (nLoaded > 0)
+            LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    }
+    return true;
+}
+
 void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4549,8 +5956,8 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
 
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
-    for (const std::pair<const uint256, CBlockIndex*>& entry : mapBlockIndex) {
-        forward.insert(std::make_pair(entry.second->pprev, entry.second));
+    for (std::pair<const uint256, CBlockIndex>& entry : mapBlockIndex) {
+        forward.insert(std::make_pair(entry.second.pprev, &entry.second));
     }
 
     assert(forward.size() == mapBlockIndex.size());
@@ -4575,12 +5982,16 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        // Assumed valid blocks (below a UTXO snapshot) have no data and only
+        // their header validated, but stand in for blocks that have both.
+        if (pindexFirstMissing == nullptr && !(pindex->nStatus & BLOCK_HAVE_DATA) && !pindex->IsAssumedValid()) pindexFirstMissing = pindex;
         if (pindexFirstNeverProcessed == nullptr && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotTreeValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
-        if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
-        if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
-        if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        if (pindex->pprev != nullptr && !pindex->IsAssumedValid()) {
+            if (pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
+            if (pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
+            if (pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        }
 
         // Begin: actual consistency checks.
         if (pindex->pprev == nullptr) {
@@ -4591,7 +6002,7 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
         if (!pindex->HaveTxsDownloaded()) assert(pindex->nSequenceId <= 0); // nSequenceId can't be set positive for blocks that aren't linked (negative is used for preciousblock)
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        if (!fHavePruned && !pindex->IsAssumedValid()) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
@@ -4600,7 +6011,11 @@ void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        if (pindex->IsAssumedValid()) {
+            assert(pindex->nTx > 0); // Assumed valid blocks have a placeholder nTx.
+        } else {
+            assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        }
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to HaveTxsDownloaded().
         assert((pindexFirstNeverProcessed == nullptr) == pindex->HaveTxsDownloaded());
         assert((pindexFirstNotTransactionsValid == nullptr) == pindex->HaveTxsDownloaded());
@@ -4877,6 +6292,133 @@ bool DumpMempool(const CTxMemPool& pool)
     return true;
 }
 
+static const uint64_t SCRIPT_CACHES_DUMP_VERSION = 2;
+
+bool LoadScriptCaches()
+{
+    const fs::path path = GetDataDir() / "sigcache.dat";
+    FILE* filestr = fsbridge::fopen(path, "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open signature cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    uint256 sig_nonce;
+    std::vector<uint256> sig_entries;
+    uint256 script_nonce;
+    std::vector<uint256> script_entries;
+    std::string discard_reason;
+    try {
+        CHashVerifier<CAutoFile> verifier(&file);
+        uint64_t version;
+        int client_version;
+        verifier >> version >> client_version;
+        if (version != SCRIPT_CACHES_DUMP_VERSION) {
+            discard_reason = strprintf("unknown version %u", version);
+        } else if (client_version != CLIENT_VERSION) {
+            // Cache entries only say that the verification rules of the
+            // version that wrote them accepted a script, so the file is not
+            // reused across versions. This also limits how long the nonces
+            // are reused.
+            discard_reason = strprintf("written by client version %d", client_version);
+        } else {
+            // Entries are salted hashes, so they are only usable together with
+            // the nonces they were computed with.
+            verifier >> sig_nonce >> sig_entries;
+            verifier >> script_nonce >> script_entries;
+            uint256 checksum;
+            file >> checksum;
+            if (checksum != verifier.GetHash()) {
+                discard_reason = "checksum mismatch";
+            }
+        }
+    } catch (const std::exception& e) {
+        discard_reason = strprintf("deserialize error: %s", e.what());
+    }
+    if (!discard_reason.empty()) {
+        file.fclose();
+        LogPrintf("Discarding signature cache file from disk (%s). Continuing anyway.\n", discard_reason);
+        fs::remove(path);
+        return false;
+    }
+
+    LoadSignatureCacheEntries(sig_nonce, sig_entries);
+    {
+        LOCK(cs_scriptExecutionCache);
+        scriptExecutionCacheNonce = script_nonce;
+        for (const uint256& entry : script_entries) {
+            scriptExecutionCache.insert(entry);
+        }
+    }
+    LogPrintf("Imported signature cache from disk: %u signature entries, %u script execution entries\n", sig_entries.size(), script_entries.size());
+    return true;
+}
+
+bool DumpScriptCaches()
+{
+    int64_t start = GetTimeMicros();
+
+    uint256 sig_nonce;
+    const std::vector<uint256> sig_entries = GetSignatureCacheEntries(sig_nonce);
+    uint256 script_nonce;
+    std::vector<uint256> script_entries;
+    {
+        LOCK(cs_scriptExecutionCache);
+        script_nonce = scriptExecutionCacheNonce;
+        script_entries = scriptExecutionCache.get_elements();
+    }
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "sigcache.dat.new", "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        uint64_t version = SCRIPT_CACHES_DUMP_VERSION;
+        hasher << version << CLIENT_VERSION;
+        hasher << sig_nonce << sig_entries;
+        hasher << script_nonce << script_entries;
+        file << version << CLIENT_VERSION;
+        file << sig_nonce << sig_entries;
+        file << script_nonce << script_entries;
+        file << hasher.GetHash();
+        if (!FileCommit(file.Get()))
+            throw std::runtime_error("FileCommit failed");
+        file.fclose();
+        RenameOver(GetDataDir() / "sigcache.dat.new", GetDataDir() / "sigcache.dat");
+        LogPrintf("Dumped signature cache: %u signature entries, %u script execution entries in %gs\n", sig_entries.size(), script_entries.size(), (GetTimeMicros() - start) * MICRO);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump signature cache: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool WriteBlockIndexSnapshot()
+{
+    AssertLockHeld(cs_main);
+    if (!setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty()) {
+        return error("%s: block index has not been flushed", __func__);
+    }
+
+    int64_t start = GetTimeMicros();
+    std::vector<const CBlockIndex*> vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    for (const std::pair<const uint256, CBlockIndex>& item : mapBlockIndex) {
+        vSortedByHeight.push_back(&item.second);
+    }
+    std::sort(vSortedByHeight.begin(), vSortedByHeight.end(), [](const CBlockIndex* a, const CBlockIndex* b) { return a->nHeight < b->nHeight; });
+    if (!pblocktree->WriteBlockIndexSnapshot(vSortedByHeight, pcoinsdbview->GetBestBlock())) {
+        return false;
+    }
+    LogPrintf("Wrote block index snapshot with %u entries: %gs\n", vSortedByHeight.size(), (GetTimeMicros() - start) * MICRO);
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 //! require cs_main if pindex has not been validated yet (because nChainTx might be unset)
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
@@ -4902,9 +6444,6 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
     }
 } instance_of_cmaincleanup;
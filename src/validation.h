@@ -11,12 +11,14 @@
 #endif
 
 #include <amount.h>
+#include <chain.h>
 #include <coins.h>
 #include <crypto/common.h> // for ReadLE64
 #include <fs.h>
 #include <policy/feerate.h>
 #include <protocol.h> // For CMessageHeader::MessageStartChars
 #include <script/script_error.h>
+#include <support/allocators/pool.h>
 #include <sync.h>
 #include <versionbits.h>
 
@@ -42,6 +44,9 @@ class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+class CAutoFile;
+class SnapshotMetadata;
+struct RollingCoinsStats;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -76,6 +81,27 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Transactions with at least this many inputs have their scripts checked on the script-checking threads when accepted to the mempool */
+static const unsigned int MIN_PARALLEL_MEMPOOL_SCRIPT_CHECK_INPUTS = 16;
+/** Maximum number of coins prefetch threads allowed */
+static const int MAX_COINS_PREFETCH_THREADS = 16;
+/** -parprefetch default (number of threads reading block inputs ahead of connection, 0 = disabled) */
+static const int DEFAULT_COINS_PREFETCH_THREADS = 4;
+/** Maximum number of threads reading block files during -reindex */
+static const int MAX_REINDEX_THREADS = 16;
+/** -reindexthreads default (0 = auto, 1 = read on the import thread) */
+static const int DEFAULT_REINDEX_THREADS = 1;
+/** Number of threads used for -reindexthreads=0. Every thread keeps the blocks of a whole block file in memory. */
+static const int AUTO_REINDEX_THREADS = 4;
+/** Number of blocks read and checked in the background ahead of the one being connected */
+static const unsigned int BLOCK_READAHEAD_DEPTH = 4;
+/** Maximum number of block files, and of undo files, kept memory mapped for reading with -mapblockfiles
+ *  (none in a 32-bit address space, nor on Windows, where a file cannot be removed while it is mapped) */
+#ifdef WIN32
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 0;
+#else
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 32 : 0;
+#endif
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -110,10 +136,21 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_UTXOSTATS = false;
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
+static const bool DEFAULT_PARTIAL_FLUSH = false;
+static const bool DEFAULT_BLOCK_TX_OFFSETS = false;
+static const bool DEFAULT_MAP_BLOCK_FILES = false;
+/** With -partialflush, a full coins cache is trimmed to this percentage of its limit */
+static const int PARTIAL_FLUSH_TARGET_PERCENT = 75;
 static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistsigcache */
+static const bool DEFAULT_PERSIST_SIGCACHE = false;
+/** Default for -blockindexsnapshot */
+static const bool DEFAULT_BLOCK_INDEX_SNAPSHOT = false;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -142,7 +179,11 @@ extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CBlockPolicyEstimator feeEstimator;
 extern CTxMemPool mempool;
-typedef std::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
+/** The block index entries are stored in the map nodes next to their hash,
+ *  and the nodes are allocated from large chunks of memory. */
+typedef PoolAllocator<std::pair<const uint256, CBlockIndex>, sizeof(std::pair<const uint256, CBlockIndex>) + sizeof(void*) * 4, alignof(void*)> BlockMapAllocator;
+typedef std::unordered_map<uint256, CBlockIndex, BlockHasher, std::equal_to<uint256>, BlockMapAllocator> BlockMap;
+typedef BlockMapAllocator::ResourceType BlockMapMemoryResource;
 extern BlockMap& mapBlockIndex GUARDED_BY(cs_main);
 extern Mutex g_best_block_mutex;
 extern std::condition_variable g_best_block_cv;
@@ -150,10 +191,19 @@ extern uint256 g_best_block;
 extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
+extern int nCoinsPrefetchThreads;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Whether routine coins cache flushes are written by a background thread (-backgroundflush) */
+extern bool fBackgroundFlush;
+/** Whether flushes keep the unmodified coins cached and only evict the least recently used ones (-partialflush) */
+extern bool fPartialFlush;
+/** Whether a table of the offsets of its transactions is stored for each block written to disk (-blocktxoffsets) */
+extern bool fBlockTxOffsets;
+/** Whether block and undo files no longer appended to are read through memory mappings (-mapblockfiles) */
+extern bool fMapBlockFiles;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
@@ -172,6 +222,8 @@ extern CBlockIndex *pindexBestHeader;
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
+/** True if the chainstate was loaded from a UTXO snapshot (blocks below its base were never downloaded). */
+extern bool fHaveUTXOSnapshot;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
@@ -236,6 +288,11 @@ FILE* OpenBlockFile(const FlatFilePos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const FlatFilePos &pos);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, FlatFilePos *dbp = nullptr);
+/** Import the blocks of all block files (-reindex). With more than one thread,
+ *  the next nThreads files are read and checked in parallel while the blocks
+ *  of the current one are accepted. Returns false if stopped by a shutdown
+ *  request before all files were imported. */
+bool ReindexBlockFiles(const CChainParams& chainparams, int nThreads);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -243,10 +300,18 @@ bool LoadGenesisBlock(const CChainParams& chainparams);
 bool LoadBlockIndex(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Update the chain tip based on database information. */
 bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/** Load the stored UTXO set statistics into g_coins_stats, or compute them if they are missing or out of date. */
+bool LoadCoinsStats() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(int worker_num);
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsPrefetch(int worker_num);
+/** Run an instance of the block check thread */
+void ThreadBlockCheck(int worker_num);
+/** Run the thread reading blocks ahead of their validation */
+void ThreadBlockRead();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -284,10 +349,13 @@ void PruneAndFlush();
 void PruneBlockFilesManual(int nManualPruneHeight);
 
 /** (try to) add transaction to memory pool
- * plTxnReplaced will be appended to with all transactions replaced from mempool **/
+ * plTxnReplaced will be appended to with all transactions replaced from mempool
+ * cs_main is taken only around the checks against the chain tip and the mempool,
+ * not while scripts are verified, so callers not holding it may accept
+ * transactions from several threads at once. **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx,
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
-                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+                        bool bypass_limits, const CAmount nAbsurdFee, bool test_accept=false);
 
 /** Get the BIP9 state for a given deployment at the current tip. */
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos);
@@ -382,6 +450,9 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 /** Context-independent validity checks */
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Run the checks of CheckBlock with the transactions checked on the block check threads.
+ *  Does not need cs_main, and does not mark the block as checked. */
+bool PreCheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -412,11 +483,22 @@ public:
 /** Replay blocks that aren't fully applied to the database. */
 bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
 
+/**
+ * Load a UTXO snapshot (see the dumptxoutset RPC) into a chainstate that has
+ * not connected any block beyond genesis yet, and make the snapshot's base
+ * block the active tip. The headers leading to the base block must already be
+ * known. The coins are verified against expected_hash_serialized, which must
+ * come from a trusted source rather than the snapshot itself, before the
+ * chainstate is modified. Blocks below the base are treated as validated but
+ * pruned, with placeholder transaction counts.
+ */
+bool LoadUTXOSnapshot(CAutoFile& coins_file, const SnapshotMetadata& metadata, const uint256& expected_hash_serialized, const CChainParams& chainparams, std::string& strError) LOCKS_EXCLUDED(cs_main);
+
 inline CBlockIndex* LookupBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     AssertLockHeld(cs_main);
-    BlockMap::const_iterator it = mapBlockIndex.find(hash);
-    return it == mapBlockIndex.end() ? nullptr : it->second;
+    BlockMap::iterator it = mapBlockIndex.find(hash);
+    return it == mapBlockIndex.end() ? nullptr : &it->second;
 }
 
 /** Find the last common block between the parameter chain and a locator. */
@@ -438,6 +520,9 @@ void ResetBlockFailureFlags(CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_mai
 /** @returns the most-work chain. */
 CChain& ChainActive();
 
+/** Number of blocks connected whose read had been started ahead of the ActivateBestChain step that connected them. */
+uint64_t GetBlocksReadAhead() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
@@ -447,6 +532,9 @@ extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
+/** Rolling statistics of the UTXO set in pcoinsTip, only maintained with -utxostats (protected by cs_main) */
+extern std::unique_ptr<RollingCoinsStats> g_coins_stats;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -478,6 +566,17 @@ bool DumpMempool(const CTxMemPool& pool);
 /** Load the mempool from disk. */
 bool LoadMempool(CTxMemPool& pool);
 
+/** Dump the signature and script execution caches to disk. */
+bool DumpScriptCaches();
+
+/** Load the signature and script execution caches from disk, before they are used. */
+bool LoadScriptCaches();
+
+/** Write a snapshot of the block index that is loaded instead of the block
+ *  tree database on the next start. Only does so if the block index has been
+ *  flushed completely. */
+bool WriteBlockIndexSnapshot() EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 //! Check whether the block associated with this index entry is pruned or not.
 inline bool IsBlockPruned(const CBlockIndex* pblockindex)
 {
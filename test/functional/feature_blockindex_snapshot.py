@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the block index snapshot written on shutdown.
+
+- A clean restart loads the block index from the snapshot.
+- The snapshot is not used after the block index has changed, when it is
+  corrupted or when it belongs to another state of the database.
+- A snapshot written at another chain tip than the one of the coins database
+  is discarded, as versions without snapshots change the block index without
+  marking the snapshot as out of date.
+- In all cases the node ends up with the same block index.
+"""
+import os
+import shutil
+
+from test_framework.address import ADDRESS_BCRT1_UNSPENDABLE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, wait_until
+
+
+class BlockIndexSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+        self.extra_args = [['-blockindexsnapshot']]
+
+    def block_index_state(self):
+        node = self.nodes[0]
+        headers = [node.getblockheader(node.getblockhash(height)) for height in range(node.getblockcount() + 1)]
+        headers.append(node.getblockheader(self.invalid_hash))
+        return node.getchaintips(), headers
+
+    def run_test(self):
+        node = self.nodes[0]
+        snapshot_path = os.path.join(node.datadir, 'regtest', 'blocks', 'indexsnapshot.dat')
+
+        self.log.info("Load the block index from the snapshot")
+        node.generatetoaddress(20, node.get_deterministic_priv_key().address)
+        self.invalid_hash = node.getblockhash(18)
+        node.invalidateblock(self.invalid_hash)
+        state = self.block_index_state()
+        with node.assert_debug_log(expected_msgs=['Loaded 21 block index entries from the snapshot']):
+            self.restart_node(0)
+        assert os.path.isfile(snapshot_path)
+        assert_equal(self.block_index_state(), state)
+
+        self.log.info("Do not use the snapshot after the block index has changed")
+        self.restart_node(0, extra_args=['-blockindexsnapshot=0'])
+        node.generatetoaddress(5, ADDRESS_BCRT1_UNSPENDABLE)
+        state = self.block_index_state()
+        with node.assert_debug_log(expected_msgs=['Block index snapshot is out of date']):
+            self.restart_node(0)
+        assert_equal(self.block_index_state(), state)
+
+        self.log.info("Do not use a snapshot of another database state")
+        self.stop_node(0)
+        shutil.copyfile(snapshot_path, snapshot_path + '.old')
+        self.start_node(0)
+        self.stop_node(0)
+        shutil.move(snapshot_path + '.old', snapshot_path)
+        with node.assert_debug_log(expected_msgs=['Block index snapshot does not match the database']):
+            self.start_node(0)
+        assert_equal(self.block_index_state(), state)
+
+        self.log.info("Discard a snapshot written at another chain tip")
+        chainstate_path = os.path.join(node.datadir, 'regtest', 'chainstate')
+        self.stop_node(0)
+        shutil.copytree(chainstate_path, chainstate_path + '.old')
+        self.start_node(0)
+        node.generatetoaddress(3, ADDRESS_BCRT1_UNSPENDABLE)
+        best_hash = node.getbestblockhash()
+        state = self.block_index_state()
+        self.stop_node(0)
+        shutil.rmtree(chainstate_path)
+        shutil.move(chainstate_path + '.old', chainstate_path)
+        with node.assert_debug_log(expected_msgs=['Block index snapshot was written at a different chain tip, discarding it']):
+            self.start_node(0)
+        assert not os.path.isfile(snapshot_path)
+        # The blocks the coins database is behind by are connected again
+        wait_until(lambda: node.getbestblockhash() == best_hash)
+        assert_equal(self.block_index_state(), state)
+
+        self.log.info("Do not use a corrupted snapshot")
+        self.stop_node(0)
+        with open(snapshot_path, 'r+b') as f:
+            f.seek(150)
+            byte = f.read(1)
+            f.seek(150)
+            f.write(bytes([byte[0] ^ 1]))
+        with node.assert_debug_log(expected_msgs=['Block index snapshot is corrupted']):
+            self.start_node(0)
+        assert_equal(self.block_index_state(), state)
+
+
+if __name__ == '__main__':
+    BlockIndexSnapshotTest().main()
@@ -48,10 +48,11 @@ class ChainstateWriteCrashTest(BitcoinTestFramework):
         self.base_args = ["-limitdescendantsize=0", "-maxmempool=0", "-rpcservertimeout=900", "-dbbatchsize=200000"]
 
         # Set different crash ratios and cache sizes.  Note that not all of
-        # -dbcache goes to pcoinsTip.
+        # -dbcache goes to pcoinsTip.  Node1 crashes in the middle of
+        # background writes, node2 while only partially flushing its cache.
         self.node0_args = ["-dbcrashratio=8", "-dbcache=4"] + self.base_args
-        self.node1_args = ["-dbcrashratio=16", "-dbcache=8"] + self.base_args
-        self.node2_args = ["-dbcrashratio=24", "-dbcache=16"] + self.base_args
+        self.node1_args = ["-dbcrashratio=16", "-dbcache=8", "-backgroundflush"] + self.base_args
+        self.node2_args = ["-dbcrashratio=24", "-dbcache=16", "-partialflush"] + self.base_args
 
         # Node3 is a normal node with default args, except will mine full blocks
         self.node3_args = ["-blockmaxweight=4000000"]
@@ -7,7 +7,12 @@
 - Start a single node and generate 3 blocks.
 - Stop the node and restart it with -reindex. Verify that the node has reindexed up to block 3.
 - Stop the node and restart it with -reindex-chainstate. Verify that the node has reindexed up to block 3.
+- Reindex with blocks read on the import thread (-reindexthreads=1).
+- Split the blocks over two block files, with part of them stored before their
+  parents, and reindex with the files read in parallel.
 """
+import os
+import struct
 
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import wait_until
@@ -18,20 +23,54 @@ class ReindexTest(BitcoinTestFramework):
         self.setup_clean_chain = True
         self.num_nodes = 1
 
-    def reindex(self, justchainstate=False):
+    def reindex(self, justchainstate=False, extra_args=[]):
         self.nodes[0].generatetoaddress(3, self.nodes[0].get_deterministic_priv_key().address)
         blockcount = self.nodes[0].getblockcount()
         self.stop_nodes()
-        extra_args = [["-reindex-chainstate" if justchainstate else "-reindex"]]
+        extra_args = [["-reindex-chainstate" if justchainstate else "-reindex"] + extra_args]
         self.start_nodes(extra_args)
         wait_until(lambda: self.nodes[0].getblockcount() == blockcount)
         self.log.info("Success")
 
+    def reindex_split_files(self):
+        node = self.nodes[0]
+        node.generatetoaddress(10, node.get_deterministic_priv_key().address)
+        blockcount = node.getblockcount()
+        besthash = node.getbestblockhash()
+        self.stop_nodes()
+
+        blocks_dir = os.path.join(node.datadir, 'regtest', 'blocks')
+        with open(os.path.join(blocks_dir, 'blk00000.dat'), 'rb') as f:
+            data = f.read()
+        magic = data[:4]
+        records = []
+        pos = data.find(magic)
+        while pos != -1:
+            size = struct.unpack('<I', data[pos + 4:pos + 8])[0]
+            records.append(data[pos:pos + 8 + size])
+            pos = data.find(magic, pos + 8 + size)
+        assert len(records) > blockcount
+        # The second half of the blocks comes first, followed by the block
+        # file holding their parents.
+        half = len(records) // 2
+        with open(os.path.join(blocks_dir, 'blk00000.dat'), 'wb') as f:
+            f.write(b''.join(records[:1] + records[half:]))
+        with open(os.path.join(blocks_dir, 'blk00001.dat'), 'wb') as f:
+            f.write(b''.join(records[1:half]))
+
+        with node.assert_debug_log(expected_msgs=['Reindexing block file blk00001.dat', 'Processing out of order child']):
+            self.start_nodes([["-reindex", "-reindexthreads=2"]])
+            wait_until(lambda: node.getblockcount() == blockcount)
+        assert node.getbestblockhash() == besthash
+        self.log.info("Success")
+
     def run_test(self):
         self.reindex(False)
         self.reindex(True)
         self.reindex(False)
         self.reindex(True)
+        self.reindex(False, ["-reindexthreads=1"])
+        self.reindex_split_files()
 
 if __name__ == '__main__':
     ReindexTest().main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the dumptxoutset and loadtxoutset RPCs.
+
+- Mine a chain on node0 and dump its UTXO set.
+- Give node1 and node2 the headers only, and check that node2 rejects a
+  snapshot with an unexpected hash and a tampered snapshot.
+- Load the snapshot into node1 and check it reports the same UTXO set.
+- Spend a coin from the snapshot on node0 and check that node1 syncs the new
+  blocks on top of the snapshot, also across a restart.
+"""
+import os
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes,
+)
+
+SNAPSHOT_HEIGHT = 150
+# version (2) + base block hash (32) + coins count (8) + nchaintx (8) + hash (32)
+METADATA_SIZE = 82
+
+
+class UTXOSnapshotTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+
+    def setup_network(self):
+        # Keep the nodes disconnected, so that only node0 has any blocks.
+        self.setup_nodes()
+
+    def run_test(self):
+        node0, node1, node2 = self.nodes
+        address = node0.get_deterministic_priv_key().address
+        node0.generatetoaddress(SNAPSHOT_HEIGHT, address)
+
+        self.log.info("Dump the UTXO set of node0")
+        dump = node0.dumptxoutset('utxo.dat')
+        stats = node0.gettxoutsetinfo()
+        assert_equal(dump['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(dump['base_hash'], stats['bestblock'])
+        assert_equal(dump['coins_written'], stats['txouts'])
+        assert_equal(dump['hash_serialized_2'], stats['hash_serialized_2'])
+        assert_equal(dump['path'], os.path.join(node0.datadir, 'regtest', 'utxo.dat'))
+        assert_raises_rpc_error(-8, "already exists", node0.dumptxoutset, 'utxo.dat')
+
+        self.log.info("Refuse to load a snapshot before its headers are known")
+        assert_raises_rpc_error(-1, "must be known", node1.loadtxoutset, dump['path'], dump['hash_serialized_2'])
+        for height in range(1, SNAPSHOT_HEIGHT + 1):
+            header = node0.getblockheader(node0.getblockhash(height), False)
+            node1.submitheader(header)
+            node2.submitheader(header)
+
+        self.log.info("Reject a snapshot that does not commit to the expected hash")
+        assert_raises_rpc_error(-1, "instead of the expected hash", node2.loadtxoutset, dump['path'], '00' * 32)
+        assert_raises_rpc_error(-8, "must be of length 64", node2.loadtxoutset, dump['path'], '00')
+
+        self.log.info("Reject a snapshot that does not match the expected hash")
+        with open(dump['path'], 'rb') as f:
+            data = bytearray(f.read())
+        data[METADATA_SIZE] ^= 1  # first byte of the first coin's txid
+        bad_path = os.path.join(node2.datadir, 'bad_utxo.dat')
+        with open(bad_path, 'wb') as f:
+            f.write(data)
+        assert_raises_rpc_error(-1, "does not match the expected hash", node2.loadtxoutset, bad_path, dump['hash_serialized_2'])
+        assert_equal(node2.getblockcount(), 0)
+
+        self.log.info("Load the snapshot into node1")
+        result = node1.loadtxoutset(dump['path'], dump['hash_serialized_2'])
+        assert_equal(result['coins_loaded'], dump['coins_written'])
+        assert_equal(result['base_hash'], dump['base_hash'])
+        assert_equal(result['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(node1.getbestblockhash(), dump['base_hash'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], dump['hash_serialized_2'])
+        assert_raises_rpc_error(-1, "Block not available (loaded from a UTXO snapshot)", node1.getblock, node0.getblockhash(SNAPSHOT_HEIGHT - 1))
+        assert 'nTx' not in node1.getblockheader(node0.getblockhash(SNAPSHOT_HEIGHT - 1))
+        assert_equal(node1.getchaintxstats(0)['txcount'], node0.getchaintxstats(0, dump['base_hash'])['txcount'])
+        assert_raises_rpc_error(-8, "not known below the base block", node1.getchaintxstats, 1)
+        assert_raises_rpc_error(-1, "empty chainstate", node1.loadtxoutset, dump['path'], dump['hash_serialized_2'])
+
+        self.log.info("Sync blocks spending snapshot coins on top of the snapshot")
+        txid = node0.getblock(node0.getblockhash(1))['tx'][0]
+        prevout = node0.gettxout(txid, 0)
+        raw_tx = node0.createrawtransaction([{'txid': txid, 'vout': 0}], {address: prevout['value'] - Decimal('0.001')})
+        signed_tx = node0.signrawtransactionwithkey(raw_tx, [node0.get_deterministic_priv_key().key])
+        node0.sendrawtransaction(signed_tx['hex'])
+        node0.generatetoaddress(10, address)
+        connect_nodes(node1, 0)
+        self.sync_blocks(self.nodes[0:2])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+
+        self.log.info("Restart node1 and check its chainstate")
+        self.restart_node(1)
+        assert_equal(node1.getblockcount(), SNAPSHOT_HEIGHT + 10)
+        assert node1.verifychain(4, 0)
+        assert_equal(node1.getchaintxstats(0)['txcount'], node0.getchaintxstats(0)['txcount'])
+        assert_equal(node1.gettxoutsetinfo()['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the rolling UTXO set statistics kept with -utxostats.
+
+node0 keeps the statistics up to date while connecting blocks, node1 computes
+them by scanning its coins database. Check that both agree:
+
+- after connecting blocks with spends and unspendable outputs,
+- after disconnecting and reconnecting blocks,
+- after restarting, with stored statistics and when they have to be rebuilt.
+"""
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    connect_nodes_bi,
+)
+
+
+class UTXOStatsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-utxostats'], []]
+
+    def assert_stats_match(self):
+        self.sync_all()
+        rolling = self.nodes[0].gettxoutsetinfo('muhash')
+        scanned = self.nodes[1].gettxoutsetinfo('muhash')
+        assert 'transactions' not in rolling
+        assert 'hash_serialized_2' not in rolling
+        for key in ['height', 'bestblock', 'txouts', 'bogosize', 'muhash', 'total_amount']:
+            assert_equal(rolling[key], scanned[key])
+        legacy = self.nodes[0].gettxoutsetinfo()
+        assert 'muhash' not in legacy
+        for key in ['bestblock', 'txouts', 'bogosize', 'total_amount']:
+            assert_equal(rolling[key], legacy[key])
+        return rolling
+
+    def spend(self, txid, outputs):
+        node = self.nodes[0]
+        raw_tx = node.createrawtransaction([{'txid': txid, 'vout': 0}], outputs)
+        signed_tx = node.signrawtransactionwithkey(raw_tx, [node.get_deterministic_priv_key().key])
+        return node.sendrawtransaction(signed_tx['hex'])
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        address = node0.get_deterministic_priv_key().address
+
+        self.log.info("Check the statistics of the empty UTXO set")
+        stats = self.assert_stats_match()
+        assert_equal(stats['height'], 0)
+        assert_equal(stats['txouts'], 0)
+        assert_raises_rpc_error(-8, "foo is not a valid hash_type", node0.gettxoutsetinfo, 'foo')
+
+        self.log.info("Connect blocks with spends and unspendable outputs")
+        node0.generatetoaddress(110, address)
+        self.assert_stats_match()
+        coinbase_txid = node0.getblock(node0.getblockhash(1))['tx'][0]
+        txid = self.spend(coinbase_txid, {address: Decimal('49.999'), 'data': '00'})
+        # Spent in the same block it is created in
+        self.spend(txid, [{address: Decimal('10')}, {self.nodes[1].get_deterministic_priv_key().address: Decimal('39.998')}])
+        node0.generatetoaddress(1, address)
+        stats = self.assert_stats_match()
+        assert_equal(stats['height'], 111)
+
+        self.log.info("Disconnect and reconnect blocks")
+        tip = node0.getbestblockhash()
+        disconnect_hash = node0.getblockhash(109)
+        for node in self.nodes:
+            node.invalidateblock(disconnect_hash)
+        stats = self.assert_stats_match()
+        assert_equal(stats['height'], 108)
+        for node in self.nodes:
+            node.reconsiderblock(disconnect_hash)
+        stats = self.assert_stats_match()
+        assert_equal(stats['bestblock'], tip)
+
+        self.log.info("Restart and load the stored statistics")
+        with node0.assert_debug_log(expected_msgs=['Loaded UTXO set statistics']):
+            self.restart_node(0, extra_args=['-utxostats'])
+        self.assert_stats_match()
+
+        self.log.info("Rebuild the statistics after running without -utxostats")
+        self.restart_node(0, extra_args=[])
+        node0.generatetoaddress(1, address)
+        with node0.assert_debug_log(expected_msgs=['Computing UTXO set statistics']):
+            self.restart_node(0, extra_args=['-utxostats'])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.assert_stats_match()
+
+        self.log.info("Keep the statistics up to date on a node that is switched to -utxostats")
+        self.restart_node(1, extra_args=['-utxostats'])
+        connect_nodes_bi(self.nodes, 0, 1)
+        node0.generatetoaddress(5, address)
+        self.sync_all()
+        stats = self.nodes[1].gettxoutsetinfo('muhash')
+        assert 'transactions' not in stats
+        assert_equal(stats['muhash'], node0.gettxoutsetinfo('muhash')['muhash'])
+
+
+if __name__ == '__main__':
+    UTXOStatsTest().main()
@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the block database checks run on startup and by verifychain.
+
+- verifychain passes at every check level, with blocks checked on several
+  threads and on one thread.
+- Corrupted undo data is found by the startup checks and by verifychain at
+  check level 2, but not below.
+"""
+import os
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.test_node import ErrorMatch
+from test_framework.util import assert_equal
+
+
+class VerifyDBTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 1
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generatetoaddress(120, node.get_deterministic_priv_key().address)
+
+        self.log.info("Verify the chain at every check level")
+        for par in ["-par=1", "-par=4"]:
+            self.restart_node(0, extra_args=[par, "-checkblocks=0", "-checklevel=4"])
+            for level in range(5):
+                assert node.verifychain(level, 0)
+
+        self.log.info("Find corrupted undo data")
+        self.stop_node(0)
+        # The first record of the undo file belongs to block 1, which only
+        # has a coinbase transaction: its undo data is a single byte,
+        # followed by the checksum.
+        rev_path = os.path.join(node.datadir, 'regtest', 'blocks', 'rev00000.dat')
+        with open(rev_path, 'r+b') as f:
+            f.seek(9)
+            byte = f.read(1)
+            f.seek(9)
+            f.write(bytes([byte[0] ^ 1]))
+        with node.assert_debug_log(expected_msgs=['found bad undo data at 1']):
+            node.assert_start_raises_init_error(extra_args=["-checkblocks=0", "-checklevel=2"], expected_msg="Corrupted block database detected", match=ErrorMatch.PARTIAL_REGEX)
+
+        self.start_node(0, extra_args=["-checkblocks=0", "-checklevel=1"])
+        assert node.verifychain(1, 0)
+        with node.assert_debug_log(expected_msgs=['found bad undo data at 1']):
+            assert_equal(node.verifychain(2, 0), False)
+
+
+if __name__ == '__main__':
+    VerifyDBTest().main()
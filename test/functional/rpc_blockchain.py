@@ -12,6 +12,7 @@ Test the following RPCs:
     - getblockhash
     - getblockheader
     - getchaintxstats
+    - getvalidationstats
     - getnetworkhashps
     - verifychain
 
@@ -62,6 +63,7 @@ class BlockchainTest(BitcoinTestFramework):
         self._test_getnetworkhashps()
         self._test_stopatheight()
         self._test_waitforblockheight()
+        self._test_getvalidationstats()
         assert self.nodes[0].verifychain(4, 0)
 
     def mine_chain(self):
@@ -176,6 +178,27 @@ class BlockchainTest(BitcoinTestFramework):
         assert 'window_interval' not in chaintxstats
         assert 'txrate' not in chaintxstats
 
+    def _test_getvalidationstats(self):
+        self.log.info("Test getvalidationstats")
+        node = self.nodes[0]
+        stages = ['check', 'forks', 'connect', 'verify', 'index', 'callbacks', 'read', 'prefetch',
+                  'connect_total', 'flush', 'chainstate', 'post_connect', 'total']
+        before = node.getvalidationstats()
+        assert_equal(sorted(before.keys()), sorted(stages))
+
+        # The block is connected once by getblocktemplate's validity check,
+        # which is not measured, and once to the chain.
+        node.generatetoaddress(1, node.get_deterministic_priv_key().address)
+        stats = node.getvalidationstats()
+        for stage in ['check', 'forks', 'connect', 'verify', 'total']:
+            assert_equal(stats[stage]['count'], before[stage]['count'] + 1)
+        for stage in stages:
+            s = stats[stage]
+            assert_greater_than(s['window'], 0)
+            assert_equal(sum(s['histogram']), s['window'])
+            assert s['min'] <= s['p50'] <= s['p90'] <= s['p99'] <= s['max']
+            assert s['min'] <= s['mean'] <= s['max']
+
     def _test_gettxoutsetinfo(self):
         node = self.nodes[0]
         res = node.gettxoutsetinfo()
@@ -85,6 +85,15 @@ class InvalidateTest(BitcoinTestFramework):
         # Should be back at the tip by now
         assert_equal(self.nodes[1].getbestblockhash(), blocks[-1])
 
+        self.log.info("Verify that invalidating the genesis block fails without crashing the node")
+        tip = self.nodes[1].getbestblockhash()
+        genesis = self.nodes[1].getblockhash(0)
+        self.nodes[1].invalidateblock(genesis)
+        assert_equal(self.nodes[1].getblockcount(), 0)
+        assert_equal(self.nodes[1].getbestblockhash(), genesis)
+        self.nodes[1].reconsiderblock(genesis)
+        assert_equal(self.nodes[1].getbestblockhash(), tip)
+
 
 if __name__ == '__main__':
     InvalidateTest().main()
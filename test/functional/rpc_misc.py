@@ -34,6 +34,21 @@ class RpcMiscTest(BitcoinTestFramework):
         assert_greater_than(memory['chunks_free'], 0)
         assert_equal(memory['used'] + memory['free'], memory['total'])
 
+        blockindex = node.getmemoryinfo()['blockindex']
+        assert_equal(blockindex['entries'], node.getblockcount() + 1)
+        assert_greater_than(blockindex['usage'], 0)
+        assert_greater_than(blockindex['chunks'], 0)
+        assert_greater_than_or_equal(blockindex['free'], 0)
+
+        tip = node.getbestblockhash()
+        node.getblock(tip)
+        blockcache = node.getmemoryinfo()['blockcache']
+        node.getblock(tip)
+        assert_equal(node.getmemoryinfo()['blockcache']['hits'], blockcache['hits'] + 1)
+        assert_greater_than(blockcache['entries'], 0)
+        assert_greater_than(blockcache['usage'], 0)
+        assert_equal(blockcache['limit'], 32 * 1024 * 1024)
+
         self.log.info("test mallocinfo")
         try:
             mallocinfo = node.getmemoryinfo(mode="mallocinfo")
@@ -107,6 +107,8 @@ BASE_SCRIPTS = [
     'feature_bip68_sequence.py',
     'p2p_feefilter.py',
     'feature_reindex.py',
+    'feature_utxo_snapshot.py',
+    'feature_utxostats.py',
     # vv Tests less than 30s vv
     'wallet_keypool_topup.py',
     'interface_zmq.py',
@@ -196,6 +198,8 @@ BASE_SCRIPTS = [
     'feature_logging.py',
     'p2p_node_network_limited.py',
     'feature_blocksdir.py',
+    'feature_blockindex_snapshot.py',
+    'feature_verifydb.py',
     'feature_config_args.py',
     'rpc_help.py',
     'feature_help.py',